@@ -24,6 +24,7 @@
  */
 #include "activation.h"
 #include "desktop-file.h"
+#include "dir-watch.h"
 #include "services.h"
 #include "test.h"
 #include "utils.h"
@@ -59,6 +60,8 @@ typedef struct
   int refcount;
   char *dir_c;
   DBusHashTable *entries;
+  unsigned int watched : 1;      /**< Changes to files are reported to bus_activation_service_file_changed() */
+  unsigned int needs_rescan : 1; /**< A change may have been missed, so scan the directory on the next cache miss */
 } BusServiceDirectory;
 
 typedef struct
@@ -66,7 +69,8 @@ typedef struct
   int refcount;
   char *name;
   char *exec;
-  unsigned long mtime;
+  unsigned long mtime; /**< mtime and size of the file when it was loaded */
+  unsigned long size;
   BusServiceDirectory *s_dir;
   char *filename;
 } BusActivationEntry;
@@ -380,6 +384,7 @@ update_desktop_file_entry (BusActivation       *activation,
     }
   
   entry->mtime = stat_buf.mtime;
+  entry->size = stat_buf.size;
   
   _dbus_string_free (&file_path);
   bus_activation_entry_unref (entry);
@@ -442,7 +447,11 @@ check_service_file (BusActivation       *activation,
     }
   else 
     {
-      if (stat_buf.mtime > entry->mtime) 
+      /* Only re-read the file if it looks different from when we
+       * loaded it
+       */
+      if (stat_buf.mtime != entry->mtime ||
+          stat_buf.size != entry->size)
         {
           BusDesktopFile *desktop_file;
           DBusError tmp_error;
@@ -494,6 +503,81 @@ out:
 }
 
 
+/* Adds a service file that isn't in the cache yet. Files that
+ * can't be loaded are skipped; only returns FALSE if out of memory.
+ */
+static dbus_bool_t
+load_service_file (BusActivation       *activation,
+                   BusServiceDirectory *s_dir,
+                   const DBusString    *filename,
+                   DBusError           *error)
+{
+  BusDesktopFile *desktop_file;
+  DBusError tmp_error;
+  DBusString full_path;
+  dbus_bool_t retval;
+
+  _DBUS_ASSERT_ERROR_IS_CLEAR (error);
+
+  if (!_dbus_string_init (&full_path))
+    {
+      BUS_SET_OOM (error);
+      return FALSE;
+    }
+
+  retval = FALSE;
+
+  if (!_dbus_string_append (&full_path, s_dir->dir_c) ||
+      !_dbus_concat_dir_and_file (&full_path, filename))
+    {
+      BUS_SET_OOM (error);
+      goto out;
+    }
+
+  dbus_error_init (&tmp_error);
+
+  desktop_file = bus_desktop_file_load (&full_path, &tmp_error);
+  if (desktop_file == NULL)
+    {
+      _dbus_verbose ("Could not load %s: %s\n",
+                     _dbus_string_get_const_data (&full_path),
+                     tmp_error.message);
+
+      if (dbus_error_has_name (&tmp_error, DBUS_ERROR_NO_MEMORY))
+        {
+          dbus_move_error (&tmp_error, error);
+          goto out;
+        }
+
+      dbus_error_free (&tmp_error);
+      retval = TRUE;
+      goto out;
+    }
+
+  if (!update_desktop_file_entry (activation, s_dir, (DBusString *) filename,
+                                  desktop_file, &tmp_error))
+    {
+      _dbus_verbose ("Could not add %s to activation entry list: %s\n",
+                     _dbus_string_get_const_data (&full_path), tmp_error.message);
+
+      if (dbus_error_has_name (&tmp_error, DBUS_ERROR_NO_MEMORY))
+        {
+          bus_desktop_file_free (desktop_file);
+          dbus_move_error (&tmp_error, error);
+          goto out;
+        }
+
+      dbus_error_free (&tmp_error);
+    }
+
+  bus_desktop_file_free (desktop_file);
+  retval = TRUE;
+
+ out:
+  _dbus_string_free (&full_path);
+  return retval;
+}
+
 /* warning: this doesn't fully "undo" itself on failure, i.e. doesn't strip
  * hash entries it already added.
  */
@@ -504,16 +588,13 @@ update_directory (BusActivation       *activation,
 {
   DBusDirIter *iter;
   DBusString dir, filename;
-  BusDesktopFile *desktop_file;
   DBusError tmp_error;
   dbus_bool_t retval;
   BusActivationEntry *entry;
-  DBusString full_path;
   
   _DBUS_ASSERT_ERROR_IS_CLEAR (error);
   
   iter = NULL;
-  desktop_file = NULL;
   
   _dbus_string_init_const (&dir, s_dir->dir_c);
   
@@ -523,13 +604,6 @@ update_directory (BusActivation       *activation,
       return FALSE;
     }
 
-  if (!_dbus_string_init (&full_path))
-    {
-      BUS_SET_OOM (error);
-      _dbus_string_free (&filename);
-      return FALSE;
-    }
-
   retval = FALSE;
 
   /* from this point it's safe to "goto out" */
@@ -549,8 +623,6 @@ update_directory (BusActivation       *activation,
     {
       _dbus_assert (!dbus_error_is_set (&tmp_error));
       
-      _dbus_string_set_length (&full_path, 0);
-      
       if (!_dbus_string_ends_with_c_str (&filename, ".service"))
         {
           _dbus_verbose ("Skipping non-.service file %s\n",
@@ -567,54 +639,9 @@ update_directory (BusActivation       *activation,
           continue;
         }
       
-      if (!_dbus_string_append (&full_path, s_dir->dir_c) ||
-          !_dbus_concat_dir_and_file (&full_path, &filename))
-        {
-          BUS_SET_OOM (error);
-          goto out;
-        }
-          
       /* New file */
-      desktop_file = bus_desktop_file_load (&full_path, &tmp_error);
-      if (desktop_file == NULL)
-        {
-          _dbus_verbose ("Could not load %s: %s\n",
-                         _dbus_string_get_const_data (&full_path),
-                         tmp_error.message);
-
-          if (dbus_error_has_name (&tmp_error, DBUS_ERROR_NO_MEMORY))
-            {
-              dbus_move_error (&tmp_error, error);
-              goto out;
-            }
-          
-          dbus_error_free (&tmp_error);
-          continue;
-        }
-
-      if (!update_desktop_file_entry (activation, s_dir, &filename, desktop_file, &tmp_error))
-        {
-          bus_desktop_file_free (desktop_file);
-          desktop_file = NULL;
-          
-          _dbus_verbose ("Could not add %s to activation entry list: %s\n",
-                         _dbus_string_get_const_data (&full_path), tmp_error.message);
-
-          if (dbus_error_has_name (&tmp_error, DBUS_ERROR_NO_MEMORY))
-            {
-              dbus_move_error (&tmp_error, error);
-              goto out;
-            }
-
-          dbus_error_free (&tmp_error);
-          continue;
-        }
-      else
-        {
-          bus_desktop_file_free (desktop_file);
-          desktop_file = NULL;
-          continue;
-        }
+      if (!load_service_file (activation, s_dir, &filename, error))
+        goto out;
     }
 
   if (dbus_error_is_set (&tmp_error))
@@ -633,10 +660,7 @@ update_directory (BusActivation       *activation,
   
   if (iter != NULL)
     _dbus_directory_close (iter);
-  if (desktop_file)
-    bus_desktop_file_free (desktop_file);
   _dbus_string_free (&filename);
-  _dbus_string_free (&full_path);
   
   return retval;
 }
@@ -1236,8 +1260,15 @@ update_service_cache (BusActivation *activation, DBusError *error)
 
       s_dir = _dbus_hash_iter_get_value (&iter);
 
+      /* If we're told about every change to the directory the
+       * cache is already up to date
+       */
+      if (s_dir->watched && !s_dir->needs_rescan)
+        continue;
+
       dbus_error_init (&tmp_error);
-      if (!update_directory (activation, s_dir, &tmp_error))
+      if (!update_directory (activation, s_dir, &tmp_error) ||
+          dbus_error_is_set (&tmp_error))
         {
           if (dbus_error_has_name (&tmp_error, DBUS_ERROR_NO_MEMORY))
             {
@@ -1248,11 +1279,101 @@ update_service_cache (BusActivation *activation, DBusError *error)
           dbus_error_free (&tmp_error);
           continue;
         }
+
+      s_dir->needs_rescan = FALSE;
     }
   
   return TRUE;
 }
 
+/**
+ * Starts watching the service directories for changes, if the
+ * platform can tell us which file changed. Once a directory is
+ * watched, a lookup of an unknown service no longer rescans it.
+ *
+ * @param activation the activation
+ */
+void
+bus_activation_watch_service_directories (BusActivation *activation)
+{
+  DBusHashIter iter;
+
+  _dbus_hash_iter_init (activation->directories, &iter);
+  while (_dbus_hash_iter_next (&iter))
+    {
+      BusServiceDirectory *s_dir;
+
+      s_dir = _dbus_hash_iter_get_value (&iter);
+
+      if (s_dir->watched)
+        continue;
+
+      s_dir->watched = bus_watch_service_directory (s_dir->dir_c,
+                                                    activation->context);
+
+      /* A file might have changed between loading the directory
+       * and starting to watch it
+       */
+      s_dir->needs_rescan = TRUE;
+    }
+}
+
+/**
+ * Updates the cache entry for one service file in a watched
+ * directory after it was created, changed or removed. Only that
+ * file is re-read, and only if its mtime or size changed. If we
+ * run out of memory, the directory is rescanned on the next cache
+ * miss instead.
+ *
+ * @param activation the activation
+ * @param directory the service directory
+ * @param filename the file in the directory, or #NULL if it's not known
+ */
+void
+bus_activation_service_file_changed (BusActivation *activation,
+                                     const char    *directory,
+                                     const char    *filename)
+{
+  BusServiceDirectory *s_dir;
+  BusActivationEntry *entry;
+  DBusString filename_str;
+  DBusError error;
+  dbus_bool_t retval;
+
+  s_dir = _dbus_hash_table_lookup_string (activation->directories, directory);
+  if (s_dir == NULL || !s_dir->watched)
+    return;
+
+  if (filename == NULL)
+    {
+      s_dir->needs_rescan = TRUE;
+      return;
+    }
+
+  _dbus_string_init_const (&filename_str, filename);
+
+  if (!_dbus_string_ends_with_c_str (&filename_str, ".service"))
+    return;
+
+  _dbus_verbose ("Service file %s in %s changed\n", filename, directory);
+
+  dbus_error_init (&error);
+
+  entry = _dbus_hash_table_lookup_string (s_dir->entries, filename);
+  if (entry != NULL)
+    retval = check_service_file (activation, entry, NULL, &error);
+  else
+    retval = load_service_file (activation, s_dir, &filename_str, &error);
+
+  if (!retval)
+    {
+      _dbus_verbose ("Failed to update service file %s: %s\n",
+                     filename, error.message);
+      dbus_error_free (&error);
+      s_dir->needs_rescan = TRUE;
+    }
+}
+
 static BusActivationEntry *
 activation_find_entry (BusActivation *activation, 
                        const char    *service_name,
@@ -1568,6 +1689,7 @@ bus_activation_activate_service (BusActivation  *activation,
 #ifdef DBUS_BUILD_TESTS
 
 #include <stdio.h>
+#include <unistd.h>
 
 #define SERVICE_NAME_1 "MyService1"
 #define SERVICE_NAME_2 "MyService2"
@@ -1615,6 +1737,27 @@ out:
   return ret_val;
 }
 
+static dbus_bool_t
+test_link_service_file (DBusString *dir,
+                        const char *filename,
+                        const char *target)
+{
+  DBusString  file_name, full_path;
+  dbus_bool_t ret_val;
+
+  _dbus_string_init_const (&file_name, filename);
+
+  if (!_dbus_string_init (&full_path))
+    return FALSE;
+
+  ret_val = _dbus_string_append (&full_path, _dbus_string_get_const_data (dir)) &&
+            _dbus_concat_dir_and_file (&full_path, &file_name) &&
+            symlink (target, _dbus_string_get_const_data (&full_path)) == 0;
+
+  _dbus_string_free (&full_path);
+  return ret_val;
+}
+
 static dbus_bool_t
 test_remove_service_file (DBusString *dir, const char *filename)
 {
@@ -1734,6 +1877,8 @@ typedef struct
   BusActivation *activation;
   const char    *service_name;
   dbus_bool_t    expecting_find;
+  const char    *directory;
+  const char    *changed_file;
 } CheckData;
 
 static dbus_bool_t
@@ -1748,6 +1893,11 @@ check_func (void *data)
   d = data;
   
   dbus_error_init (&error);
+
+  /* Pretend the directory watch told us about the file */
+  if (d->changed_file != NULL)
+    bus_activation_service_file_changed (d->activation, d->directory,
+                                         d->changed_file);
  
   entry = activation_find_entry (d->activation, d->service_name, &error);
   if (entry == NULL)
@@ -1793,6 +1943,7 @@ static dbus_bool_t
 do_service_reload_test (DBusString *dir, dbus_bool_t oom_test)
 {
   BusActivation *activation;
+  BusServiceDirectory *s_dir;
   DBusString     address;
   DBusList      *directories;
   CheckData      d;
@@ -1808,6 +1959,8 @@ do_service_reload_test (DBusString *dir, dbus_bool_t oom_test)
     return FALSE;
 
   d.activation = activation;
+  d.directory = _dbus_string_get_const_data (dir);
+  d.changed_file = NULL;
   
   /* Check for existing service file */
   d.expecting_find = TRUE;
@@ -1838,7 +1991,7 @@ do_service_reload_test (DBusString *dir, dbus_bool_t oom_test)
     return FALSE;
 
   d.expecting_find = FALSE;
-  d.service_name = SERVICE_FILE_2;
+  d.service_name = SERVICE_NAME_2;
 
   if (!do_test ("Removed service file", oom_test, &d))
     return FALSE;
@@ -1862,6 +2015,54 @@ do_service_reload_test (DBusString *dir, dbus_bool_t oom_test)
   if (!do_test ("Updated service file, part 2", oom_test, &d))
     return FALSE; 
 
+  /* Once the directory is watched, an unknown service doesn't
+   * rescan it; only the files we're told about are loaded
+   */
+  s_dir = _dbus_hash_table_lookup_string (activation->directories,
+                                          d.directory);
+  _dbus_assert (s_dir != NULL);
+  s_dir->watched = TRUE;
+  s_dir->needs_rescan = FALSE;
+
+  if (!test_create_service_file (dir, SERVICE_FILE_2, SERVICE_NAME_2, "exec-2"))
+    return FALSE;
+
+  d.expecting_find = FALSE;
+  d.service_name = SERVICE_NAME_2;
+
+  if (!do_test ("Added service file in watched directory, unnotified", oom_test, &d))
+    return FALSE;
+
+  d.expecting_find = TRUE;
+  d.changed_file = SERVICE_FILE_2;
+
+  if (!do_test ("Added service file in watched directory", oom_test, &d))
+    return FALSE;
+
+  if (!test_remove_service_file (dir, SERVICE_FILE_2))
+    return FALSE;
+
+  d.expecting_find = FALSE;
+
+  if (!do_test ("Removed service file in watched directory", oom_test, &d))
+    return FALSE;
+
+  /* A service file that is a symlink only shows up as created */
+  if (!test_create_service_file (dir, "service-2.target", SERVICE_NAME_2, "exec-2") ||
+      !test_link_service_file (dir, SERVICE_FILE_2, "service-2.target"))
+    return FALSE;
+
+  d.expecting_find = TRUE;
+
+  if (!do_test ("Symlinked service file in watched directory", oom_test, &d))
+    return FALSE;
+
+  if (!test_remove_service_file (dir, SERVICE_FILE_2) ||
+      !test_remove_service_file (dir, "service-2.target"))
+    return FALSE;
+
+  d.changed_file = NULL;
+
   bus_activation_unref (activation);
   _dbus_list_clear (&directories);
 
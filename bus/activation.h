@@ -46,6 +46,11 @@ dbus_bool_t    bus_activation_service_created  (BusActivation     *activation,
 						BusTransaction    *transaction,
 						DBusError         *error);
 
+void           bus_activation_watch_service_directories (BusActivation *activation);
+void           bus_activation_service_file_changed      (BusActivation *activation,
+                                                         const char    *directory,
+                                                         const char    *filename);
+
 dbus_bool_t    bus_activation_send_pending_auto_activation_messages (BusActivation     *activation,
 								     BusService        *service,
 								     BusTransaction    *transaction,
@@ -512,7 +512,10 @@ process_config_postinit (BusContext      *context,
   /* Watch all conf directories */
   _dbus_list_foreach (bus_config_parser_get_conf_dirs (parser),
 		      (DBusForeachFunction) bus_watch_directory,
-		      NULL);
+		      context);
+
+  /* Watch service directories, so we only reload the files that change */
+  bus_activation_watch_service_directories (context->activation);
 
   return TRUE;
 }
@@ -880,6 +883,8 @@ bus_context_unref (BusContext *context)
       
       bus_context_shutdown (context);
 
+      bus_shutdown_directory_watches (context);
+
       if (context->connections)
         {
           bus_connections_unref (context->connections);
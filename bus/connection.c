@@ -189,30 +189,59 @@ bus_connection_disconnected (DBusConnection *connection)
    * disconnecting a client, and preallocating a broadcast "service is
    * now gone" message for every client-service pair seems kind of
    * involved. Probably we need to do that though.
+   *
+   * All the names are dropped in one transaction, so the
+   * NameOwnerChanged signals share a single signal batch and the
+   * match rules and policy are only consulted once for the lot
+   * rather than once per name. If we run out of memory the
+   * whole transaction is cancelled, which restores the primary
+   * ownerships it had removed, and we start over.
    */
-  while ((service = _dbus_list_get_last (&d->services_owned)))
+  while (d->services_owned != NULL)
     {
       BusTransaction *transaction;
       DBusError error;
+      DBusList *link;
 
-    retry:
-      
       dbus_error_init (&error);
         
       while ((transaction = bus_transaction_new (d->connections->context)) == NULL)
         _dbus_wait_for_memory ();
+
+      if (!bus_transaction_enable_signal_batch (transaction))
+        {
+          bus_transaction_cancel_and_free (transaction);
+          _dbus_wait_for_memory ();
+          continue;
+        }
         
-      if (!bus_service_remove_owner (service, connection,
-                                     transaction, &error))
+      /* The services we were primary owner of stay in services_owned
+       * until the transaction is freed, so walk the list rather than
+       * popping it; queued ownerships are dropped from it right away.
+       */
+      link = _dbus_list_get_last_link (&d->services_owned);
+      while (link != NULL)
+        {
+          DBusList *prev;
+
+          prev = _dbus_list_get_prev_link (&d->services_owned, link);
+          service = link->data;
+
+          if (!bus_service_remove_owner (service, connection,
+                                         transaction, &error))
+            break;
+
+          link = prev;
+        }
+
+      if (dbus_error_is_set (&error))
         {
-          _DBUS_ASSERT_ERROR_IS_SET (&error);
-          
           if (dbus_error_has_name (&error, DBUS_ERROR_NO_MEMORY))
             {
               dbus_error_free (&error);
               bus_transaction_cancel_and_free (transaction);
               _dbus_wait_for_memory ();
-              goto retry;
+              continue;
             }
           else
             {
@@ -1818,6 +1847,7 @@ struct BusTransaction
   DBusList *connections;
   BusContext *context;
   DBusList *cancel_hooks;
+  BusSignalBatch *signal_batch;
 };
 
 static void
@@ -1880,6 +1910,28 @@ bus_transaction_new (BusContext *context)
   return transaction;
 }
 
+/* Lets signals from the bus driver sent in this transaction share
+ * their match rule and security policy lookups, see BusSignalBatch.
+ * Only safe if the match rules and policies don't change while
+ * the transaction is being filled in.
+ */
+dbus_bool_t
+bus_transaction_enable_signal_batch (BusTransaction *transaction)
+{
+  if (transaction->signal_batch != NULL)
+    return TRUE;
+
+  transaction->signal_batch = bus_signal_batch_new ();
+
+  return transaction->signal_batch != NULL;
+}
+
+BusSignalBatch*
+bus_transaction_get_signal_batch (BusTransaction *transaction)
+{
+  return transaction->signal_batch;
+}
+
 BusContext*
 bus_transaction_get_context (BusTransaction  *transaction)
 {
@@ -2065,6 +2117,9 @@ bus_transaction_cancel_and_free (BusTransaction *transaction)
                       cancel_hook_cancel, NULL);
 
   free_cancel_hooks (transaction);
+
+  if (transaction->signal_batch)
+    bus_signal_batch_free (transaction->signal_batch);
   
   dbus_free (transaction);
 }
@@ -2123,6 +2178,9 @@ bus_transaction_execute_and_free (BusTransaction *transaction)
   _dbus_assert (transaction->connections == NULL);
 
   free_cancel_hooks (transaction);
+
+  if (transaction->signal_batch)
+    bus_signal_batch_free (transaction->signal_batch);
   
   dbus_free (transaction);
 }
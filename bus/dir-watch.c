@@ -23,19 +23,308 @@
 
 #include <config.h>
 
-#ifdef DBUS_BUS_ENABLE_DNOTIFY_ON_LINUX 
+#if defined (DBUS_BUS_ENABLE_INOTIFY)
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#elif defined (DBUS_BUS_ENABLE_DNOTIFY_ON_LINUX)
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#endif /* DBUS_BUS_ENABLE_DNOTIFY_ON_LINUX */
+#endif
 
 #include <dbus/dbus-internals.h>
+#include <dbus/dbus-watch.h>
+#include "activation.h"
 #include "dir-watch.h"
 
 
+/* inotify is available on Linux 2.6.13 or greater, and unlike D_NOTIFY
+ * tells us which file in the directory changed, so a change to a
+ * service directory only updates that file's activation entry.
+ */
+#if defined (DBUS_BUS_ENABLE_INOTIFY)
+
+#define MAX_DIRS_TO_WATCH 128
+#define INOTIFY_EVENT_SIZE (sizeof (struct inotify_event))
+#define INOTIFY_BUF_LEN (1024 * (INOTIFY_EVENT_SIZE + 16))
+
+typedef struct
+{
+  int wd;                     /**< inotify watch descriptor */
+  char *dir;                  /**< The directory */
+  dbus_bool_t is_service_dir; /**< #TRUE for a service directory, #FALSE for a config directory */
+} WatchedDir;
+
+/* use a static array to avoid handling OOM */
+static WatchedDir dirs[MAX_DIRS_TO_WATCH];
+static int num_dirs = 0;
+
+static int inotify_fd = -1;
+static DBusWatch *inotify_watch = NULL;
+static BusContext *inotify_context = NULL;
+
+static WatchedDir *
+find_watched_dir (int wd)
+{
+  int i;
+
+  for (i = 0; i < num_dirs; i++)
+    {
+      if (dirs[i].wd == wd)
+        return &dirs[i];
+    }
+
+  return NULL;
+}
+
+static dbus_bool_t
+handle_inotify_watch (DBusWatch    *watch,
+                      unsigned int  flags,
+                      void         *data)
+{
+  char buffer[INOTIFY_BUF_LEN];
+  dbus_bool_t need_reload;
+  ssize_t ret;
+  int i;
+
+  ret = read (inotify_fd, buffer, INOTIFY_BUF_LEN);
+  if (ret < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        _dbus_verbose ("Error reading inotify events: %s\n",
+                       _dbus_strerror (errno));
+      return TRUE;
+    }
+
+  need_reload = FALSE;
+
+  i = 0;
+  while (i < ret)
+    {
+      struct inotify_event *ev;
+      WatchedDir *dir;
+
+      ev = (struct inotify_event *) &buffer[i];
+      i += INOTIFY_EVENT_SIZE + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW)
+        {
+          int j;
+
+          /* We lost track, so look at everything again */
+          _dbus_verbose ("inotify queue overflowed\n");
+
+          for (j = 0; j < num_dirs; j++)
+            {
+              if (dirs[j].is_service_dir)
+                bus_activation_service_file_changed (bus_context_get_activation (inotify_context),
+                                                     dirs[j].dir, NULL);
+              else
+                need_reload = TRUE;
+            }
+
+          continue;
+        }
+
+      dir = find_watched_dir (ev->wd);
+      if (dir == NULL)
+        continue;
+
+      if (dir->is_service_dir)
+        {
+          if (ev->len > 0)
+            bus_activation_service_file_changed (bus_context_get_activation (inotify_context),
+                                                 dir->dir, ev->name);
+        }
+      else
+        {
+          need_reload = TRUE;
+        }
+    }
+
+  /* Reloading drops and re-adds the watches, so only do it
+   * once we're done with the event buffer
+   */
+  if (need_reload)
+    {
+      DBusError error;
+
+      dbus_error_init (&error);
+      if (!bus_context_reload_config (inotify_context, &error))
+        {
+          _dbus_warn ("Unable to reload configuration: %s\n",
+                      error.message);
+          dbus_error_free (&error);
+          exit (1);
+        }
+    }
+
+  return TRUE;
+}
+
+static dbus_bool_t
+inotify_watch_callback (DBusWatch    *watch,
+                        unsigned int  condition,
+                        void         *data)
+{
+  return dbus_watch_handle (watch, condition);
+}
+
+static dbus_bool_t
+init_inotify (BusContext *context)
+{
+  if (inotify_fd >= 0)
+    return inotify_context == context;
+
+  inotify_fd = inotify_init ();
+  if (inotify_fd < 0)
+    {
+      _dbus_warn ("Cannot initialize inotify: %s\n", _dbus_strerror (errno));
+      return FALSE;
+    }
+
+  _dbus_fd_set_close_on_exec (inotify_fd);
+  fcntl (inotify_fd, F_SETFL, fcntl (inotify_fd, F_GETFL) | O_NONBLOCK);
+
+  inotify_watch = _dbus_watch_new (inotify_fd, DBUS_WATCH_READABLE, TRUE,
+                                   handle_inotify_watch, NULL, NULL);
+  if (inotify_watch == NULL)
+    {
+      _dbus_verbose ("Unable to create inotify watch: no memory\n");
+      goto failed;
+    }
+
+  if (!_dbus_loop_add_watch (bus_context_get_loop (context), inotify_watch,
+                             inotify_watch_callback, NULL, NULL))
+    {
+      _dbus_verbose ("Unable to add inotify watch to main loop: no memory\n");
+      _dbus_watch_unref (inotify_watch);
+      inotify_watch = NULL;
+      goto failed;
+    }
+
+  inotify_context = context;
+
+  return TRUE;
+
+ failed:
+  close (inotify_fd);
+  inotify_fd = -1;
+  return FALSE;
+}
+
+static dbus_bool_t
+add_watch (const char  *dir,
+           BusContext  *context,
+           dbus_bool_t  is_service_dir)
+{
+  int wd;
+  uint32_t mask;
+  char *dir_copy;
+
+  _dbus_assert (dir != NULL);
+
+  if (num_dirs >= MAX_DIRS_TO_WATCH)
+    {
+      _dbus_warn ("Cannot watch config directory '%s'. Already watching %d directories\n", dir, MAX_DIRS_TO_WATCH);
+      return FALSE;
+    }
+
+  if (!init_inotify (context))
+    return FALSE;
+
+  dir_copy = _dbus_strdup (dir);
+  if (dir_copy == NULL)
+    {
+      _dbus_verbose ("Cannot watch directory '%s': no memory\n", dir);
+      return FALSE;
+    }
+
+  mask = IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+
+  /* Symlinks, and files that are written without being closed, only
+   * show up as created. A service file that is still being written
+   * when we read it is read again when it is closed; a broken config
+   * file would make the reload fail, so config directories wait for
+   * the close.
+   */
+  if (is_service_dir)
+    mask |= IN_CREATE;
+
+  wd = inotify_add_watch (inotify_fd, dir, mask);
+  if (wd < 0)
+    {
+      _dbus_warn ("Cannot setup inotify for '%s'; error '%s'\n", dir, _dbus_strerror (errno));
+      dbus_free (dir_copy);
+      return FALSE;
+    }
+
+  dirs[num_dirs].wd = wd;
+  dirs[num_dirs].dir = dir_copy;
+  dirs[num_dirs].is_service_dir = is_service_dir;
+  num_dirs++;
+
+  _dbus_verbose ("Added watch on %s directory '%s'\n",
+                 is_service_dir ? "service" : "config", dir);
+
+  return TRUE;
+}
+
+void
+bus_watch_directory (const char *dir, BusContext *context)
+{
+  add_watch (dir, context, FALSE);
+}
+
+dbus_bool_t
+bus_watch_service_directory (const char *dir, BusContext *context)
+{
+  return add_watch (dir, context, TRUE);
+}
+
+void 
+bus_drop_all_directory_watches (void)
+{
+  int i;
+
+  _dbus_verbose ("Dropping all watches on directories\n");
+
+  for (i = 0; i < num_dirs; i++)
+    {
+      if (inotify_rm_watch (inotify_fd, dirs[i].wd) != 0)
+        _dbus_verbose ("Error removing inotify watch on '%s'\n", dirs[i].dir);
+
+      dbus_free (dirs[i].dir);
+    }
+
+  num_dirs = 0;
+}
+
+void
+bus_shutdown_directory_watches (BusContext *context)
+{
+  if (inotify_context != context)
+    return;
+
+  bus_drop_all_directory_watches ();
+
+  _dbus_loop_remove_watch (bus_context_get_loop (context), inotify_watch,
+                           inotify_watch_callback, NULL);
+  _dbus_watch_invalidate (inotify_watch);
+  _dbus_watch_unref (inotify_watch);
+  inotify_watch = NULL;
+
+  close (inotify_fd);
+  inotify_fd = -1;
+  inotify_context = NULL;
+}
+
 /* D_NOTIFY is available on Linux 2.4 or greater - the actual SIGIO signal is handled in main.c:signal_handler() */
-#ifdef DBUS_BUS_ENABLE_DNOTIFY_ON_LINUX 
+#elif defined (DBUS_BUS_ENABLE_DNOTIFY_ON_LINUX)
 
 #define MAX_DIRS_TO_WATCH 128
 
@@ -44,7 +333,7 @@ static int fds[MAX_DIRS_TO_WATCH];
 static int num_fds = 0;
 
 void
-bus_watch_directory (const char *dir, void *userdata)
+bus_watch_directory (const char *dir, BusContext *context)
 {
   int fd;
 
@@ -95,6 +384,19 @@ bus_drop_all_directory_watches (void)
   num_fds = 0;
 }
 
+dbus_bool_t
+bus_watch_service_directory (const char *dir, BusContext *context)
+{
+  /* We can't tell which file changed */
+  return FALSE;
+}
+
+void
+bus_shutdown_directory_watches (BusContext *context)
+{
+  bus_drop_all_directory_watches ();
+}
+
 #else /* fallback to NOP */
 
 void 
@@ -103,7 +405,18 @@ bus_drop_all_directory_watches (void)
 }
 
 void
-bus_watch_directory (const char *dir, void *userdata)
+bus_watch_directory (const char *dir, BusContext *context)
+{
+}
+
+dbus_bool_t
+bus_watch_service_directory (const char *dir, BusContext *context)
+{
+  return FALSE;
+}
+
+void
+bus_shutdown_directory_watches (BusContext *context)
 {
 }
 
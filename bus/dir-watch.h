@@ -24,10 +24,20 @@
 #ifndef DIR_WATCH_H
 #define DIR_WATCH_H
 
-/* setup a watch on a directory (OS dependent, may be a NOP) */
-void bus_watch_directory (const char *directory, void *userdata);
+#include "bus.h"
 
-/* drop all the watches previously set up by bus_config_watch_directory (OS dependent, may be a NOP) */
+/* setup a watch on a config directory, reloading the config when it changes (OS dependent, may be a NOP) */
+void bus_watch_directory (const char *directory, BusContext *context);
+
+/* setup a watch on a service directory, reporting each changed file to
+ * bus_activation_service_file_changed(); returns FALSE if the OS can't
+ * tell us which file changed */
+dbus_bool_t bus_watch_service_directory (const char *directory, BusContext *context);
+
+/* drop all the watches previously set up by bus_watch_directory and bus_watch_service_directory (OS dependent, may be a NOP) */
 void bus_drop_all_directory_watches (void);
 
+/* drop all the watches and free the resources used to watch for the context */
+void bus_shutdown_directory_watches (BusContext *context);
+
 #endif /* DIR_WATCH_H */
@@ -33,6 +33,7 @@
 #include "signals.h"
 #include "test.h"
 #include <dbus/dbus-internals.h>
+#include <dbus/dbus-hash.h>
 #include <string.h>
 
 static dbus_bool_t
@@ -126,6 +127,216 @@ bus_dispatch_matches (BusTransaction *transaction,
     return TRUE;
 }
 
+/* A signal batch caches the work that is the same for a run of
+ * signals from the bus driver that differ only in their arguments,
+ * such as the NameOwnerChanged signals sent when a connection
+ * owning many names disconnects. The match rules that accept the
+ * signal header are looked up once, and so is the security policy
+ * verdict for each recipient; neither depends on the arguments, and
+ * the recipients' outgoing queues don't change until the
+ * transaction is executed.
+ */
+struct BusSignalBatch
+{
+  char *path;           /**< Path of the signals in the batch */
+  char *interface;      /**< Interface of the signals in the batch */
+  char *member;         /**< Member of the signals in the batch */
+  DBusList *rules;      /**< Match rules accepting the header, ref'd */
+  dbus_bool_t have_rules; /**< #TRUE once rules has been filled in */
+  DBusHashTable *verdicts; /**< Recipient connection to ALLOWED or DENIED */
+};
+
+#define BATCH_VERDICT_ALLOWED ((void*) 1)
+#define BATCH_VERDICT_DENIED  ((void*) 2)
+
+BusSignalBatch*
+bus_signal_batch_new (void)
+{
+  BusSignalBatch *batch;
+
+  batch = dbus_new0 (BusSignalBatch, 1);
+  if (batch == NULL)
+    return NULL;
+
+  batch->verdicts = _dbus_hash_table_new (DBUS_HASH_POINTER, NULL, NULL);
+  if (batch->verdicts == NULL)
+    {
+      dbus_free (batch);
+      return NULL;
+    }
+
+  return batch;
+}
+
+void
+bus_signal_batch_free (BusSignalBatch *batch)
+{
+  while (batch->rules != NULL)
+    bus_match_rule_unref (_dbus_list_pop_first (&batch->rules));
+
+  _dbus_hash_table_unref (batch->verdicts);
+  dbus_free (batch->path);
+  dbus_free (batch->interface);
+  dbus_free (batch->member);
+  dbus_free (batch);
+}
+
+static dbus_bool_t
+batch_string_equal (const char *a,
+                    const char *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  else
+    return strcmp (a, b) == 0;
+}
+
+/* Returns FALSE if the message can't use the batch, because
+ * the batch was started with a signal of another shape.
+ */
+static dbus_bool_t
+batch_accepts_message (BusSignalBatch *batch,
+                       DBusMessage    *message)
+{
+  if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_SIGNAL ||
+      dbus_message_get_destination (message) != NULL)
+    return FALSE;
+
+  if (!batch->have_rules)
+    return TRUE;
+
+  return batch_string_equal (batch->path, dbus_message_get_path (message)) &&
+    batch_string_equal (batch->interface, dbus_message_get_interface (message)) &&
+    batch_string_equal (batch->member, dbus_message_get_member (message));
+}
+
+static dbus_bool_t
+batch_fill_rules (BusSignalBatch *batch,
+                  BusMatchmaker  *matchmaker,
+                  DBusMessage    *message)
+{
+  const char *path;
+  const char *interface;
+  const char *member;
+
+  _dbus_assert (!batch->have_rules);
+  _dbus_assert (batch->rules == NULL);
+
+  path = dbus_message_get_path (message);
+  interface = dbus_message_get_interface (message);
+  member = dbus_message_get_member (message);
+
+  if (path != NULL &&
+      (batch->path = _dbus_strdup (path)) == NULL)
+    goto nomem;
+
+  if (interface != NULL &&
+      (batch->interface = _dbus_strdup (interface)) == NULL)
+    goto nomem;
+
+  if (member != NULL &&
+      (batch->member = _dbus_strdup (member)) == NULL)
+    goto nomem;
+
+  if (!bus_matchmaker_get_rules_matching_header (matchmaker,
+                                                 NULL, NULL, message,
+                                                 &batch->rules))
+    goto nomem;
+
+  batch->have_rules = TRUE;
+  return TRUE;
+
+ nomem:
+  dbus_free (batch->path);
+  batch->path = NULL;
+  dbus_free (batch->interface);
+  batch->interface = NULL;
+  dbus_free (batch->member);
+  batch->member = NULL;
+  return FALSE;
+}
+
+/* Like bus_dispatch_matches() for a signal from the bus driver,
+ * but using and filling in the cached state in the batch.
+ */
+dbus_bool_t
+bus_dispatch_matches_batched (BusTransaction *transaction,
+                              BusSignalBatch *batch,
+                              DBusMessage    *message,
+                              DBusError      *error)
+{
+  BusConnections *connections;
+  DBusList *recipients;
+  DBusList *link;
+  BusContext *context;
+
+  _DBUS_ASSERT_ERROR_IS_CLEAR (error);
+  _dbus_assert (dbus_message_get_sender (message) != NULL);
+
+  if (!batch_accepts_message (batch, message))
+    return bus_dispatch_matches (transaction, NULL, NULL, message, error);
+
+  connections = bus_transaction_get_connections (transaction);
+  context = bus_transaction_get_context (transaction);
+
+  if (!batch->have_rules &&
+      !batch_fill_rules (batch, bus_context_get_matchmaker (context), message))
+    {
+      BUS_SET_OOM (error);
+      return FALSE;
+    }
+
+  recipients = NULL;
+  if (!bus_matchmaker_get_recipients_from_rules (bus_context_get_matchmaker (context),
+                                                 &batch->rules, connections,
+                                                 NULL, NULL, message,
+                                                 &recipients))
+    {
+      BUS_SET_OOM (error);
+      return FALSE;
+    }
+
+  link = _dbus_list_get_first_link (&recipients);
+  while (link != NULL)
+    {
+      DBusConnection *dest;
+      void *verdict;
+
+      dest = link->data;
+      link = _dbus_list_get_next_link (&recipients, link);
+
+      verdict = _dbus_hash_table_lookup_pointer (batch->verdicts, dest);
+      if (verdict == NULL)
+        {
+          if (bus_context_check_security_policy (context, transaction,
+                                                 NULL, NULL, dest,
+                                                 message, NULL))
+            verdict = BATCH_VERDICT_ALLOWED;
+          else
+            verdict = BATCH_VERDICT_DENIED;
+
+          /* The table is only a cache, so just check again
+           * next time if we can't record the verdict.
+           */
+          _dbus_hash_table_insert_pointer (batch->verdicts, dest, verdict);
+        }
+
+      if (verdict == BATCH_VERDICT_DENIED)
+        continue; /* silently don't send it */
+
+      if (!bus_transaction_send (transaction, dest, message))
+        {
+          _dbus_list_clear (&recipients);
+          BUS_SET_OOM (error);
+          return FALSE;
+        }
+    }
+
+  _dbus_list_clear (&recipients);
+
+  return TRUE;
+}
+
 static DBusHandlerResult
 bus_dispatch (DBusConnection *connection,
               DBusMessage    *message)
@@ -35,4 +35,11 @@ dbus_bool_t bus_dispatch_matches           (BusTransaction *transaction,
                                             DBusMessage    *message,
                                             DBusError      *error);
 
+BusSignalBatch* bus_signal_batch_new         (void);
+void            bus_signal_batch_free        (BusSignalBatch *batch);
+dbus_bool_t     bus_dispatch_matches_batched (BusTransaction *transaction,
+                                              BusSignalBatch *batch,
+                                              DBusMessage    *message,
+                                              DBusError      *error);
+
 #endif /* BUS_DISPATCH_H */
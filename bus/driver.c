@@ -48,6 +48,7 @@ bus_driver_send_service_owner_changed (const char     *service_name,
 				       DBusError      *error)
 {
   DBusMessage *message;
+  BusSignalBatch *batch;
   dbus_bool_t retval;
   const char *null_service;
 
@@ -81,7 +82,11 @@ bus_driver_send_service_owner_changed (const char     *service_name,
 
   _dbus_assert (dbus_message_has_signature (message, "sss"));
   
-  retval = bus_dispatch_matches (transaction, NULL, NULL, message, error);
+  batch = bus_transaction_get_signal_batch (transaction);
+  if (batch != NULL)
+    retval = bus_dispatch_matches_batched (transaction, batch, message, error);
+  else
+    retval = bus_dispatch_matches (transaction, NULL, NULL, message, error);
   dbus_message_unref (message);
 
   return retval;
@@ -876,7 +876,6 @@ typedef struct
   BusService     *service;
   BusOwner       *before_owner; /* restore to position before this connection in owners list */
   DBusList       *owner_link;
-  DBusList       *service_link;
   DBusPreallocatedHash *hash_entry;
 } OwnershipRestoreData;
 
@@ -886,7 +885,6 @@ restore_ownership (void *data)
   OwnershipRestoreData *d = data;
   DBusList *link;
 
-  _dbus_assert (d->service_link != NULL);
   _dbus_assert (d->owner_link != NULL);
   
   if (d->service->owners == NULL)
@@ -914,16 +912,13 @@ restore_ownership (void *data)
   
   _dbus_list_insert_before_link (&d->service->owners, link, d->owner_link);
 
-  /* Note that removing then restoring this changes the order in which
-   * ServiceDeleted messages are sent on destruction of the
-   * connection.  This should be OK as the only guarantee there is
-   * that the base service is destroyed last, and we never even
-   * tentatively remove the base service.
+  /* The owners list holds a reference to the owner again. The owner
+   * never left the connection's list of owned services, since we were
+   * holding a reference to it the whole time.
    */
-  bus_connection_add_owned_service_link (d->owner->conn, d->service_link);
+  bus_owner_ref (d->owner);
   
   d->hash_entry = NULL;
-  d->service_link = NULL;
   d->owner_link = NULL;
 }
 
@@ -932,8 +927,6 @@ free_ownership_restore_data (void *data)
 {
   OwnershipRestoreData *d = data;
 
-  if (d->service_link)
-    _dbus_list_free_link (d->service_link);
   if (d->owner_link)
     _dbus_list_free_link (d->owner_link);
   if (d->hash_entry)
@@ -961,7 +954,6 @@ add_restore_ownership_to_transaction (BusTransaction *transaction,
   
   d->service = service;
   d->owner = owner;
-  d->service_link = _dbus_list_alloc_link (service);
   d->owner_link = _dbus_list_alloc_link (owner);
   d->hash_entry = _dbus_hash_table_preallocate_entry (service->registry->service_hash);
   
@@ -986,8 +978,7 @@ add_restore_ownership_to_transaction (BusTransaction *transaction,
       link = _dbus_list_get_next_link (&service->owners, link);
     }
   
-  if (d->service_link == NULL ||
-      d->owner_link == NULL ||
+  if (d->owner_link == NULL ||
       d->hash_entry == NULL ||
       !bus_transaction_add_cancel_hook (transaction, restore_ownership, d,
                                         free_ownership_restore_data))
@@ -23,6 +23,7 @@
 #include "signals.h"
 #include "services.h"
 #include "utils.h"
+#include <dbus/dbus-hash.h>
 #include <dbus/dbus-marshal-validate.h>
 
 struct BusMatchRule
@@ -42,6 +43,8 @@ struct BusMatchRule
 
   char **args;
   int args_len;
+
+  DBusList *index_link; /**< Link in the matchmaker's rules_by_arg0 or rules_without_arg0 */
 };
 
 BusMatchRule*
@@ -976,13 +979,132 @@ bus_match_rule_parse (DBusConnection   *matches_go_to,
   return rule;
 }
 
+/* Rules that require the same string for arg0, such as the
+ * arg0='com.example.Foo' rules clients add to watch NameOwnerChanged
+ * for one name, so a message only needs to be checked against the
+ * rules for its own arg0.
+ */
+typedef struct
+{
+  char *arg0;       /**< The arg0 value, also the hash key */
+  DBusList *rules;  /**< Rules with this arg0 */
+} Arg0Rules;
+
 struct BusMatchmaker
 {
   int refcount;
 
   DBusList *all_rules;
+
+  DBusHashTable *rules_by_arg0; /**< arg0 value to Arg0Rules */
+  DBusList *rules_without_arg0; /**< Rules not in rules_by_arg0 */
 };
 
+static void
+arg0_rules_free (void *data)
+{
+  Arg0Rules *a = data;
+
+  if (a == NULL) /* hash table requires this */
+    return;
+
+  _dbus_list_clear (&a->rules);
+  dbus_free (a->arg0);
+  dbus_free (a);
+}
+
+static dbus_bool_t
+match_rule_has_arg0 (BusMatchRule *rule)
+{
+  return (rule->flags & BUS_MATCH_ARGS) &&
+    rule->args_len > 0 && rule->args[0] != NULL;
+}
+
+/* Puts the rule in rules_by_arg0 or rules_without_arg0 */
+static dbus_bool_t
+match_rule_index (BusMatchmaker *matchmaker,
+                  BusMatchRule  *rule)
+{
+  DBusList *link;
+
+  _dbus_assert (rule->index_link == NULL);
+
+  link = _dbus_list_alloc_link (rule);
+  if (link == NULL)
+    return FALSE;
+
+  if (match_rule_has_arg0 (rule))
+    {
+      Arg0Rules *a;
+
+      a = _dbus_hash_table_lookup_string (matchmaker->rules_by_arg0,
+                                          rule->args[0]);
+      if (a == NULL)
+        {
+          a = dbus_new0 (Arg0Rules, 1);
+          if (a == NULL)
+            goto nomem;
+
+          a->arg0 = _dbus_strdup (rule->args[0]);
+          if (a->arg0 == NULL)
+            {
+              dbus_free (a);
+              goto nomem;
+            }
+
+          if (!_dbus_hash_table_insert_string (matchmaker->rules_by_arg0,
+                                               a->arg0, a))
+            {
+              arg0_rules_free (a);
+              goto nomem;
+            }
+        }
+
+      _dbus_list_append_link (&a->rules, link);
+    }
+  else
+    {
+      _dbus_list_append_link (&matchmaker->rules_without_arg0, link);
+    }
+
+  rule->index_link = link;
+
+  return TRUE;
+
+ nomem:
+  _dbus_list_free_link (link);
+  return FALSE;
+}
+
+static void
+match_rule_unindex (BusMatchmaker *matchmaker,
+                    BusMatchRule  *rule)
+{
+  _dbus_assert (rule->index_link != NULL);
+
+  if (match_rule_has_arg0 (rule))
+    {
+      Arg0Rules *a;
+
+      a = _dbus_hash_table_lookup_string (matchmaker->rules_by_arg0,
+                                          rule->args[0]);
+      _dbus_assert (a != NULL);
+
+      _dbus_list_remove_link (&a->rules, rule->index_link);
+
+      if (a->rules == NULL)
+        _dbus_hash_table_remove_string (matchmaker->rules_by_arg0,
+                                        rule->args[0]);
+    }
+  else
+    {
+      _dbus_list_remove_link (&matchmaker->rules_without_arg0,
+                              rule->index_link);
+    }
+
+  rule->index_link = NULL;
+}
+
 BusMatchmaker*
 bus_matchmaker_new (void)
 {
@@ -993,6 +1115,16 @@ bus_matchmaker_new (void)
     return NULL;
 
   matchmaker->refcount = 1;
+
+  /* the Arg0Rules own their key */
+  matchmaker->rules_by_arg0 = _dbus_hash_table_new (DBUS_HASH_STRING,
+                                                    NULL,
+                                                    arg0_rules_free);
+  if (matchmaker->rules_by_arg0 == NULL)
+    {
+      dbus_free (matchmaker);
+      return NULL;
+    }
   
   return matchmaker;
 }
@@ -1020,11 +1152,15 @@ bus_matchmaker_unref (BusMatchmaker *matchmaker)
           BusMatchRule *rule;
 
           rule = matchmaker->all_rules->data;
+          match_rule_unindex (matchmaker, rule);
           bus_match_rule_unref (rule);
           _dbus_list_remove_link (&matchmaker->all_rules,
                                   matchmaker->all_rules);
         }
 
+      _dbus_assert (matchmaker->rules_without_arg0 == NULL);
+      _dbus_hash_table_unref (matchmaker->rules_by_arg0);
+
       dbus_free (matchmaker);
     }
 }
@@ -1039,8 +1175,15 @@ bus_matchmaker_add_rule (BusMatchmaker   *matchmaker,
   if (!_dbus_list_append (&matchmaker->all_rules, rule))
     return FALSE;
 
+  if (!match_rule_index (matchmaker, rule))
+    {
+      _dbus_list_remove_last (&matchmaker->all_rules, rule);
+      return FALSE;
+    }
+
   if (!bus_connection_add_match_rule (rule->matches_go_to, rule))
     {
+      match_rule_unindex (matchmaker, rule);
       _dbus_list_remove_last (&matchmaker->all_rules, rule);
       return FALSE;
     }
@@ -1126,6 +1269,7 @@ bus_matchmaker_remove_rule_link (BusMatchmaker   *matchmaker,
   
   bus_connection_remove_match_rule (rule->matches_go_to, rule);
   _dbus_list_remove_link (&matchmaker->all_rules, link);
+  match_rule_unindex (matchmaker, rule);
 
 #ifdef DBUS_ENABLE_VERBOSE_MODE
   {
@@ -1146,6 +1290,7 @@ bus_matchmaker_remove_rule (BusMatchmaker   *matchmaker,
 {
   bus_connection_remove_match_rule (rule->matches_go_to, rule);
   _dbus_list_remove (&matchmaker->all_rules, rule);
+  match_rule_unindex (matchmaker, rule);
 
 #ifdef DBUS_ENABLE_VERBOSE_MODE
   {
@@ -1278,10 +1423,10 @@ connection_is_primary_owner (DBusConnection *connection,
 }
 
 static dbus_bool_t
-match_rule_matches (BusMatchRule    *rule,
-                    DBusConnection  *sender,
-                    DBusConnection  *addressed_recipient,
-                    DBusMessage     *message)
+match_rule_matches_header (BusMatchRule    *rule,
+                           DBusConnection  *sender,
+                           DBusConnection  *addressed_recipient,
+                           DBusMessage     *message)
 {
   /* All features of the match rule are AND'd together,
    * so FALSE if any of them don't match.
@@ -1382,42 +1527,86 @@ match_rule_matches (BusMatchRule    *rule,
         return FALSE;
     }
 
+  return TRUE;
+}
+
+/* The string arguments of a message, read as far as the rules
+ * being checked have needed them, so each argument is only
+ * demarshaled once however many rules look at it.
+ */
+typedef struct
+{
+  DBusMessageIter iter;  /**< Positioned at argument n_read */
+  int n_read;            /**< Number of arguments read so far */
+  const char *values[DBUS_MAXIMUM_MATCH_RULE_ARG_NUMBER + 1]; /**< NULL if not a string */
+} MatchArgs;
+
+static void
+match_args_init (MatchArgs   *args,
+                 DBusMessage *message)
+{
+  dbus_message_iter_init (message, &args->iter);
+  args->n_read = 0;
+}
+
+/* Returns NULL if argument i doesn't exist or isn't a string */
+static const char*
+match_args_get (MatchArgs *args,
+                int        i)
+{
+  _dbus_assert (i <= DBUS_MAXIMUM_MATCH_RULE_ARG_NUMBER);
+
+  while (args->n_read <= i)
+    {
+      int current_type;
+
+      current_type = dbus_message_iter_get_arg_type (&args->iter);
+
+      args->values[args->n_read] = NULL;
+      if (current_type == DBUS_TYPE_STRING)
+        {
+          dbus_message_iter_get_basic (&args->iter,
+                                       &args->values[args->n_read]);
+          _dbus_assert (args->values[args->n_read] != NULL);
+        }
+
+      if (current_type != DBUS_TYPE_INVALID)
+        dbus_message_iter_next (&args->iter);
+
+      ++args->n_read;
+    }
+
+  return args->values[i];
+}
+
+static dbus_bool_t
+match_rule_matches_args (BusMatchRule    *rule,
+                         MatchArgs       *args)
+{
   if (rule->flags & BUS_MATCH_ARGS)
     {
       int i;
-      DBusMessageIter iter;
       
       _dbus_assert (rule->args != NULL);
 
-      dbus_message_iter_init (message, &iter);
-      
       i = 0;
       while (i < rule->args_len)
         {
-          int current_type;
           const char *expected_arg;
 
           expected_arg = rule->args[i];
           
-          current_type = dbus_message_iter_get_arg_type (&iter);
-
           if (expected_arg != NULL)
             {
               const char *actual_arg;
               
-              if (current_type != DBUS_TYPE_STRING)
+              actual_arg = match_args_get (args, i);
+              if (actual_arg == NULL)
                 return FALSE;
 
-              actual_arg = NULL;
-              dbus_message_iter_get_basic (&iter, &actual_arg);
-              _dbus_assert (actual_arg != NULL);
-
               if (strcmp (expected_arg, actual_arg) != 0)
                 return FALSE;
             }
-          
-          if (current_type != DBUS_TYPE_INVALID)
-            dbus_message_iter_next (&iter);
 
           ++i;
         }
@@ -1426,38 +1615,42 @@ match_rule_matches (BusMatchRule    *rule,
   return TRUE;
 }
 
-dbus_bool_t
-bus_matchmaker_get_recipients (BusMatchmaker   *matchmaker,
-                               BusConnections  *connections,
-                               DBusConnection  *sender,
-                               DBusConnection  *addressed_recipient,
-                               DBusMessage     *message,
-                               DBusList       **recipients_p)
+static dbus_bool_t
+match_rule_matches (BusMatchRule    *rule,
+                    DBusConnection  *sender,
+                    DBusConnection  *addressed_recipient,
+                    DBusMessage     *message)
 {
-  /* FIXME for now this is a wholly unoptimized linear search */
-  /* Guessing the important optimization is to skip the signal-related
-   * match lists when processing method call and exception messages.
-   * So separate match rule lists for signals?
+  MatchArgs args;
+
+  /* All features of the match rule are AND'd together,
+   * so FALSE if any of them don't match.
    */
-  
-  DBusList *link;
+  if (!match_rule_matches_header (rule, sender, addressed_recipient, message))
+    return FALSE;
 
-  _dbus_assert (*recipients_p == NULL);
+  match_args_init (&args, message);
 
-  /* This avoids sending same message to the same connection twice.
-   * Purpose of the stamp instead of a bool is to avoid iterating over
-   * all connections resetting the bool each time.
-   */
-  bus_connections_increment_stamp (connections);
+  return match_rule_matches_args (rule, &args);
+}
 
-  /* addressed_recipient is already receiving the message, don't add to list.
-   * NULL addressed_recipient means either bus driver, or this is a signal
-   * and thus lacks a specific addressed_recipient.
-   */
-  if (addressed_recipient != NULL)
-    bus_connection_mark_stamp (addressed_recipient);
+/* Appends the owners of the rules in the list that match the message
+ * to the recipients, skipping connections already marked with the
+ * current stamp. If check_header is FALSE the rules are known to
+ * match the message header already.
+ */
+static dbus_bool_t
+get_recipients_from_list (DBusList       **rules,
+                          dbus_bool_t      check_header,
+                          DBusConnection  *sender,
+                          DBusConnection  *addressed_recipient,
+                          DBusMessage     *message,
+                          MatchArgs       *args,
+                          DBusList       **recipients_p)
+{
+  DBusList *link;
 
-  link = _dbus_list_get_first_link (&matchmaker->all_rules);
+  link = _dbus_list_get_first_link (rules);
   while (link != NULL)
     {
       BusMatchRule *rule;
@@ -1474,8 +1667,9 @@ bus_matchmaker_get_recipients (BusMatchmaker   *matchmaker,
       }
 #endif
       
-      if (match_rule_matches (rule,
-                              sender, addressed_recipient, message))
+      if ((!check_header ||
+           match_rule_matches_header (rule, sender, addressed_recipient, message)) &&
+          match_rule_matches_args (rule, args))
         {
           _dbus_verbose ("Rule matched\n");
           
@@ -1483,7 +1677,7 @@ bus_matchmaker_get_recipients (BusMatchmaker   *matchmaker,
           if (bus_connection_mark_stamp (rule->matches_go_to))
             {
               if (!_dbus_list_append (recipients_p, rule->matches_go_to))
-                goto nomem;
+                return FALSE;
             }
 #ifdef DBUS_ENABLE_VERBOSE_MODE
           else
@@ -1493,10 +1687,172 @@ bus_matchmaker_get_recipients (BusMatchmaker   *matchmaker,
 #endif /* DBUS_ENABLE_VERBOSE_MODE */
         }
 
-      link = _dbus_list_get_next_link (&matchmaker->all_rules, link);
+      link = _dbus_list_get_next_link (rules, link);
     }
 
   return TRUE;
+}
+
+/* Checks the message against the rules for its arg0, if it
+ * has a string arg0
+ */
+static dbus_bool_t
+get_recipients_by_arg0 (BusMatchmaker   *matchmaker,
+                        DBusConnection  *sender,
+                        DBusConnection  *addressed_recipient,
+                        DBusMessage     *message,
+                        MatchArgs       *args,
+                        DBusList       **recipients_p)
+{
+  const char *arg0;
+  Arg0Rules *a;
+
+  arg0 = match_args_get (args, 0);
+  if (arg0 == NULL)
+    return TRUE;
+
+  a = _dbus_hash_table_lookup_string (matchmaker->rules_by_arg0, arg0);
+  if (a == NULL)
+    return TRUE;
+
+  return get_recipients_from_list (&a->rules, TRUE,
+                                   sender, addressed_recipient, message,
+                                   args, recipients_p);
+}
+
+dbus_bool_t
+bus_matchmaker_get_recipients (BusMatchmaker   *matchmaker,
+                               BusConnections  *connections,
+                               DBusConnection  *sender,
+                               DBusConnection  *addressed_recipient,
+                               DBusMessage     *message,
+                               DBusList       **recipients_p)
+{
+  /* FIXME apart from rules on arg0 this is still a linear search */
+  /* Guessing the important optimization is to skip the signal-related
+   * match lists when processing method call and exception messages.
+   * So separate match rule lists for signals?
+   */
+  
+  MatchArgs args;
+
+  _dbus_assert (*recipients_p == NULL);
+
+  /* This avoids sending same message to the same connection twice.
+   * Purpose of the stamp instead of a bool is to avoid iterating over
+   * all connections resetting the bool each time.
+   */
+  bus_connections_increment_stamp (connections);
+
+  /* addressed_recipient is already receiving the message, don't add to list.
+   * NULL addressed_recipient means either bus driver, or this is a signal
+   * and thus lacks a specific addressed_recipient.
+   */
+  if (addressed_recipient != NULL)
+    bus_connection_mark_stamp (addressed_recipient);
+
+  match_args_init (&args, message);
+
+  if (!get_recipients_from_list (&matchmaker->rules_without_arg0, TRUE,
+                                 sender, addressed_recipient, message,
+                                 &args, recipients_p))
+    goto nomem;
+
+  if (!get_recipients_by_arg0 (matchmaker,
+                               sender, addressed_recipient, message,
+                               &args, recipients_p))
+    goto nomem;
+
+  return TRUE;
+
+ nomem:
+  _dbus_list_clear (recipients_p);
+  return FALSE;
+}
+
+/* Finds the rules that match everything about the message except
+ * its arguments. When sending a run of messages that differ only in
+ * their arguments, like the NameOwnerChanged signals sent when a
+ * connection owning many names goes away, this is done once and
+ * bus_matchmaker_get_recipients_from_rules() used for each message.
+ * Rules on arg0 are left out, since those are looked up by
+ * the arg0 of each message anyway.
+ * The rules in the list are ref'd and must be unref'd by the caller.
+ */
+dbus_bool_t
+bus_matchmaker_get_rules_matching_header (BusMatchmaker   *matchmaker,
+                                          DBusConnection  *sender,
+                                          DBusConnection  *addressed_recipient,
+                                          DBusMessage     *message,
+                                          DBusList       **rules_p)
+{
+  DBusList *link;
+
+  _dbus_assert (*rules_p == NULL);
+
+  link = _dbus_list_get_first_link (&matchmaker->rules_without_arg0);
+  while (link != NULL)
+    {
+      BusMatchRule *rule;
+
+      rule = link->data;
+
+      if (match_rule_matches_header (rule,
+                                     sender, addressed_recipient, message))
+        {
+          if (!_dbus_list_append (rules_p, rule))
+            goto nomem;
+
+          bus_match_rule_ref (rule);
+        }
+
+      link = _dbus_list_get_next_link (&matchmaker->rules_without_arg0, link);
+    }
+
+  return TRUE;
+
+ nomem:
+  while (*rules_p != NULL)
+    bus_match_rule_unref (_dbus_list_pop_first (rules_p));
+  return FALSE;
+}
+
+/* Like bus_matchmaker_get_recipients(), but only checks the arguments
+ * of the message against rules from
+ * bus_matchmaker_get_rules_matching_header(), plus the rules on
+ * the message's arg0.
+ */
+dbus_bool_t
+bus_matchmaker_get_recipients_from_rules (BusMatchmaker   *matchmaker,
+                                          DBusList       **rules,
+                                          BusConnections  *connections,
+                                          DBusConnection  *sender,
+                                          DBusConnection  *addressed_recipient,
+                                          DBusMessage     *message,
+                                          DBusList       **recipients_p)
+{
+  MatchArgs args;
+
+  _dbus_assert (*recipients_p == NULL);
+
+  bus_connections_increment_stamp (connections);
+
+  if (addressed_recipient != NULL)
+    bus_connection_mark_stamp (addressed_recipient);
+
+  match_args_init (&args, message);
+
+  if (!get_recipients_from_list (rules, FALSE,
+                                 sender, addressed_recipient, message,
+                                 &args, recipients_p))
+    goto nomem;
+
+  if (!get_recipients_by_arg0 (matchmaker,
+                               sender, addressed_recipient, message,
+                               &args, recipients_p))
+    goto nomem;
+
+  return TRUE;
 
  nomem:
   _dbus_list_clear (recipients_p);
@@ -1928,6 +2284,85 @@ test_matching (void)
   dbus_message_unref (message1);
 }
 
+static int
+count_arg0_rules (BusMatchmaker *matchmaker,
+                  const char    *arg0)
+{
+  Arg0Rules *a;
+
+  a = _dbus_hash_table_lookup_string (matchmaker->rules_by_arg0, arg0);
+  if (a == NULL)
+    return 0;
+
+  return _dbus_list_get_length (&a->rules);
+}
+
+static void
+test_arg0_index (void)
+{
+  BusMatchmaker *matchmaker;
+  BusMatchRule *rules[4];
+  DBusMessage *message;
+  const char *v_STRING;
+  MatchArgs args;
+  int i;
+
+  matchmaker = bus_matchmaker_new ();
+  _dbus_assert (matchmaker != NULL);
+
+  rules[0] = check_parse (TRUE, "member='NameOwnerChanged',arg0='com.example.Foo'");
+  rules[1] = check_parse (TRUE, "arg0='com.example.Foo',arg2=''");
+  rules[2] = check_parse (TRUE, "arg0='com.example.Bar'");
+  rules[3] = check_parse (TRUE, "member='NameOwnerChanged',arg1='com.example.Foo'");
+
+  for (i = 0; i < (int) _DBUS_N_ELEMENTS (rules); i++)
+    {
+      _dbus_assert (rules[i] != NULL);
+      if (!match_rule_index (matchmaker, rules[i]))
+        _dbus_assert_not_reached ("oom");
+    }
+
+  _dbus_assert (count_arg0_rules (matchmaker, "com.example.Foo") == 2);
+  _dbus_assert (count_arg0_rules (matchmaker, "com.example.Bar") == 1);
+  _dbus_assert (_dbus_list_length_is_one (&matchmaker->rules_without_arg0));
+  _dbus_assert (matchmaker->rules_without_arg0->data == rules[3]);
+
+  /* Each argument is only read once, however many rules look at it */
+  message = dbus_message_new_signal ("/", "com.example", "NameOwnerChanged");
+  _dbus_assert (message != NULL);
+  v_STRING = "com.example.Foo";
+  if (!dbus_message_append_args (message,
+                                 DBUS_TYPE_STRING, &v_STRING,
+                                 DBUS_TYPE_STRING, &v_STRING,
+                                 NULL))
+    _dbus_assert_not_reached ("oom");
+
+  match_args_init (&args, message);
+  _dbus_assert (match_rule_matches_args (rules[0], &args));
+  _dbus_assert (args.n_read == 1);
+  _dbus_assert (!match_rule_matches_args (rules[1], &args));
+  _dbus_assert (args.n_read == 3);
+  _dbus_assert (!match_rule_matches_args (rules[2], &args));
+  _dbus_assert (match_rule_matches_args (rules[3], &args));
+  _dbus_assert (args.n_read == 3);
+  _dbus_assert (match_args_get (&args, 2) == NULL);
+
+  dbus_message_unref (message);
+
+  match_rule_unindex (matchmaker, rules[0]);
+  _dbus_assert (count_arg0_rules (matchmaker, "com.example.Foo") == 1);
+  match_rule_unindex (matchmaker, rules[1]);
+  _dbus_assert (count_arg0_rules (matchmaker, "com.example.Foo") == 0);
+  match_rule_unindex (matchmaker, rules[2]);
+  match_rule_unindex (matchmaker, rules[3]);
+  _dbus_assert (matchmaker->rules_without_arg0 == NULL);
+
+  for (i = 0; i < (int) _DBUS_N_ELEMENTS (rules); i++)
+    bus_match_rule_unref (rules[i]);
+
+  bus_matchmaker_unref (matchmaker);
+}
+
 dbus_bool_t
 bus_signals_test (const DBusString *test_data_dir)
 {
@@ -1944,6 +2379,8 @@ bus_signals_test (const DBusString *test_data_dir)
   test_equality ();
 
   test_matching ();
+
+  test_arg0_index ();
   
   return TRUE;
 }
@@ -83,5 +83,17 @@ dbus_bool_t bus_matchmaker_get_recipients       (BusMatchmaker   *matchmaker,
                                                  DBusConnection  *addressed_recipient,
                                                  DBusMessage     *message,
                                                  DBusList       **recipients_p);
+dbus_bool_t bus_matchmaker_get_rules_matching_header (BusMatchmaker   *matchmaker,
+                                                      DBusConnection  *sender,
+                                                      DBusConnection  *addressed_recipient,
+                                                      DBusMessage     *message,
+                                                      DBusList       **rules_p);
+dbus_bool_t bus_matchmaker_get_recipients_from_rules (BusMatchmaker   *matchmaker,
+                                                      DBusList       **rules,
+                                                      BusConnections  *connections,
+                                                      DBusConnection  *sender,
+                                                      DBusConnection  *addressed_recipient,
+                                                      DBusMessage     *message,
+                                                      DBusList       **recipients_p);
 
 #endif /* BUS_SIGNALS_H */
@@ -25,6 +25,7 @@
 #include "dbus-marshal-basic.h"
 #include "dbus-signature.h"
 #include "dbus-internals.h"
+#include <string.h>
 
 /**
  * @addtogroup DBusMarshal
@@ -1068,6 +1069,189 @@ _dbus_type_reader_read_fixed_multi (const DBusTypeReader  *reader,
 #endif
 }
 
+/** Most fields a struct of fixed-length types can have; every field
+ * takes one typecode and the parens take two more.
+ */
+#define FIXED_STRUCT_MAX_FIELDS (DBUS_MAXIMUM_SIGNATURE_LENGTH - 2)
+
+/**
+ * Wire layout of one element in an array of structs whose fields are
+ * all fixed-length basic types, such as "(iid)". Since struct
+ * elements always start on an 8-boundary, the padding inside an
+ * element never changes, so the layout can be computed once and the
+ * whole array copied without walking the signature per element.
+ */
+typedef struct
+{
+  int n_fields;                                 /**< number of fields */
+  int element_len;                              /**< bytes in one element, without trailing padding */
+  int stride;                                   /**< bytes from one element to the next */
+  unsigned char types[FIXED_STRUCT_MAX_FIELDS]; /**< typecode of each field */
+  int offsets[FIXED_STRUCT_MAX_FIELDS];         /**< offset of each field inside the element */
+} FixedStructLayout;
+
+static dbus_bool_t
+fixed_struct_layout_init (FixedStructLayout *layout,
+                          const DBusString  *type_str,
+                          int                type_pos)
+{
+  int len;
+  int pos;
+  int typecode;
+
+  len = _dbus_string_get_length (type_str);
+
+  if (type_pos >= len ||
+      _dbus_string_get_byte (type_str, type_pos) != DBUS_STRUCT_BEGIN_CHAR)
+    return FALSE;
+
+  layout->n_fields = 0;
+  pos = 0;
+
+  ++type_pos;
+  while (type_pos < len)
+    {
+      typecode = _dbus_string_get_byte (type_str, type_pos);
+
+      if (typecode == DBUS_STRUCT_END_CHAR)
+        break;
+
+      if (!dbus_type_is_basic (typecode) || !dbus_type_is_fixed (typecode) ||
+          layout->n_fields == FIXED_STRUCT_MAX_FIELDS)
+        return FALSE;
+
+      pos = _DBUS_ALIGN_VALUE (pos, _dbus_type_get_alignment (typecode));
+
+      layout->types[layout->n_fields] = typecode;
+      layout->offsets[layout->n_fields] = pos;
+      layout->n_fields += 1;
+
+      /* for fixed-length types, the size equals the alignment */
+      pos += _dbus_type_get_alignment (typecode);
+      ++type_pos;
+    }
+
+  if (type_pos == len || layout->n_fields == 0)
+    return FALSE;
+
+  layout->element_len = pos;
+  layout->stride = _DBUS_ALIGN_VALUE (pos, 8);
+
+  return TRUE;
+}
+
+/**
+ * Checks whether the complete type at type_pos is a struct whose
+ * fields are all fixed-length basic types, i.e. something that
+ * can be written with _dbus_type_writer_write_fixed_struct_multi().
+ * Returns the number of bytes from one such struct to the next
+ * in an array of them, or 0 if the type is not such a struct.
+ *
+ * @param type_str the signature
+ * @param type_pos position of the struct in the signature
+ * @returns the array stride of the struct, or 0
+ */
+int
+_dbus_type_get_fixed_struct_stride (const DBusString *type_str,
+                                    int               type_pos)
+{
+  FixedStructLayout layout;
+
+  if (!fixed_struct_layout_init (&layout, type_str, type_pos))
+    return 0;
+
+  return layout.stride;
+}
+
+/**
+ * Reads a block of structs of fixed-length basic values, from the
+ * current point in an array to the end of the array, into a strided
+ * C buffer. The array elements must be structs containing only types
+ * where dbus_type_is_fixed() is #TRUE, such as "(iid)".
+ *
+ * Element i's field j is stored at value + i * stride +
+ * field_offsets[j]. Unlike _dbus_type_reader_read_fixed_multi() this
+ * makes a copy, since the wire layout need not match the C layout;
+ * bytes are swapped if needed.
+ *
+ * If value is #NULL nothing is copied and the number of remaining
+ * elements is returned, so the caller can size its buffer.
+ *
+ * @param reader the reader to read from
+ * @param value buffer to store elements in, or #NULL
+ * @param stride bytes from one element to the next in the buffer
+ * @param field_offsets offset of each struct field in a buffer element
+ * @param max_elements number of elements the buffer has room for
+ * @returns number of elements copied, or remaining if value is #NULL
+ */
+int
+_dbus_type_reader_read_fixed_struct_multi (const DBusTypeReader  *reader,
+                                           void                  *value,
+                                           int                    stride,
+                                           const int             *field_offsets,
+                                           int                    max_elements)
+{
+  FixedStructLayout layout;
+  const unsigned char *wire;
+  unsigned char *element;
+  DBusBasicValue tmp;
+  int start_pos;
+  int end_pos;
+  int n_elements;
+  int size;
+  int i, j;
+
+  _dbus_assert (!reader->klass->types_only);
+  _dbus_assert (reader->klass == &array_reader_class);
+
+  if (!fixed_struct_layout_init (&layout, reader->type_str, reader->type_pos))
+    _dbus_assert_not_reached ("array element type is not a struct of fixed-length types");
+
+  _dbus_assert (reader->value_pos >= reader->u.array.start_pos);
+
+  end_pos = reader->u.array.start_pos + array_reader_get_array_len (reader);
+  start_pos = _DBUS_ALIGN_VALUE (reader->value_pos, 8);
+
+  if (start_pos >= end_pos)
+    n_elements = 0;
+  else
+    n_elements = (end_pos - start_pos + layout.stride - layout.element_len) / layout.stride;
+
+  if (value == NULL)
+    return n_elements;
+
+  n_elements = MIN (n_elements, max_elements);
+  if (n_elements <= 0)
+    return 0;
+
+  wire = (const unsigned char *)
+    _dbus_string_get_const_data_len (reader->value_str, start_pos,
+                                     (n_elements - 1) * layout.stride + layout.element_len);
+  element = value;
+
+  for (i = 0; i < n_elements; i++)
+    {
+      for (j = 0; j < layout.n_fields; j++)
+        {
+          size = _dbus_type_get_alignment (layout.types[j]);
+
+          if (reader->byte_order == DBUS_COMPILER_BYTE_ORDER || size == 1)
+            memcpy (element + field_offsets[j], wire + layout.offsets[j], size);
+          else
+            {
+              memcpy (&tmp, wire + layout.offsets[j], size);
+              _dbus_swap_array ((unsigned char *) &tmp, 1, size);
+              memcpy (element + field_offsets[j], &tmp, size);
+            }
+        }
+
+      wire += layout.stride;
+      element += stride;
+    }
+
+  return n_elements;
+}
+
 /**
  * Initialize a new reader pointing to the first type and
  * corresponding value that's a child of the current container. It's
@@ -2470,6 +2654,110 @@ _dbus_type_writer_write_fixed_multi (DBusTypeWriter        *writer,
   return TRUE;
 }
 
+/**
+ * Writes a block of structs of fixed-length basic values from a
+ * strided C buffer. The block must be written inside an array whose
+ * element type is a struct containing only types where
+ * dbus_type_is_fixed() is #TRUE, such as "(iid)".
+ *
+ * Element i's field j is read from value + i * stride +
+ * field_offsets[j]. The array space is allocated once and the fields
+ * copied straight into it, so this is much cheaper than recursing
+ * into each struct and writing its fields one at a time.
+ *
+ * @param writer the writer
+ * @param value start of the buffer
+ * @param stride bytes from one element to the next in the buffer
+ * @param field_offsets offset of each struct field in a buffer element
+ * @param n_elements number of elements in the buffer
+ * @returns #FALSE if no memory
+ */
+dbus_bool_t
+_dbus_type_writer_write_fixed_struct_multi (DBusTypeWriter *writer,
+                                            const void     *value,
+                                            int             stride,
+                                            const int      *field_offsets,
+                                            int             n_elements)
+{
+  FixedStructLayout layout;
+  const unsigned char *element;
+  unsigned char *wire;
+  int start_pos;
+  int total_len;
+  int size;
+  int i, j;
+
+  _dbus_assert (writer->container_type == DBUS_TYPE_ARRAY);
+  _dbus_assert (writer->type_pos_is_expectation);
+  _dbus_assert (writer->type_str != NULL);
+  _dbus_assert (n_elements >= 0);
+
+  if (!fixed_struct_layout_init (&layout, writer->type_str, writer->type_pos))
+    _dbus_assert_not_reached ("array element type is not a struct of fixed-length types");
+
+  _dbus_assert (n_elements <= DBUS_MAXIMUM_ARRAY_LENGTH / layout.stride);
+
+#if RECURSIVE_MARSHAL_WRITE_TRACE
+  _dbus_verbose ("  type writer %p entering fixed struct multi type_pos = %d value_pos = %d n_elements %d\n",
+                 writer, writer->type_pos, writer->value_pos, n_elements);
+#endif
+
+  if (!write_or_verify_typecode (writer, DBUS_STRUCT_BEGIN_CHAR))
+    _dbus_assert_not_reached ("OOM should not happen if only verifying typecode");
+
+  if (!writer->enabled || n_elements == 0)
+    return TRUE;
+
+  start_pos = _DBUS_ALIGN_VALUE (writer->value_pos, 8);
+  total_len = (n_elements - 1) * layout.stride + layout.element_len;
+
+  /* zero-filled, so the padding between fields and elements is done */
+  if (!_dbus_string_insert_bytes (writer->value_str,
+                                  writer->value_pos,
+                                  start_pos - writer->value_pos + total_len,
+                                  '\0'))
+    return FALSE;
+
+  wire = (unsigned char *) _dbus_string_get_data_len (writer->value_str,
+                                                      start_pos, total_len);
+  element = value;
+
+  for (i = 0; i < n_elements; i++)
+    {
+      for (j = 0; j < layout.n_fields; j++)
+        {
+          size = _dbus_type_get_alignment (layout.types[j]);
+
+          memcpy (wire + layout.offsets[j], element + field_offsets[j], size);
+
+          if (layout.types[j] == DBUS_TYPE_BOOLEAN)
+            {
+              dbus_uint32_t b;
+
+              /* only 0 and 1 are valid on the wire */
+              memcpy (&b, wire + layout.offsets[j], 4);
+              b = (b != 0);
+              memcpy (wire + layout.offsets[j], &b, 4);
+            }
+
+          if (writer->byte_order != DBUS_COMPILER_BYTE_ORDER && size > 1)
+            _dbus_swap_array (wire + layout.offsets[j], 1, size);
+        }
+
+      wire += layout.stride;
+      element += stride;
+    }
+
+  writer->value_pos = start_pos + total_len;
+
+#if RECURSIVE_MARSHAL_WRITE_TRACE
+  _dbus_verbose ("  type writer %p fixed struct multi written new type_pos = %d new value_pos = %d n_elements %d\n",
+                 writer, writer->type_pos, writer->value_pos, n_elements);
+#endif
+
+  return TRUE;
+}
+
 static void
 enable_if_after (DBusTypeWriter       *writer,
                  DBusTypeReader       *reader,
@@ -150,6 +150,11 @@ int         _dbus_type_reader_get_array_length          (const DBusTypeReader  *
 void        _dbus_type_reader_read_fixed_multi          (const DBusTypeReader  *reader,
                                                          void                  *value,
                                                          int                   *n_elements);
+int         _dbus_type_reader_read_fixed_struct_multi   (const DBusTypeReader  *reader,
+                                                         void                  *value,
+                                                         int                    stride,
+                                                         const int             *field_offsets,
+                                                         int                    max_elements);
 void        _dbus_type_reader_read_raw                  (const DBusTypeReader  *reader,
                                                          const unsigned char  **value_location);
 void        _dbus_type_reader_recurse                   (DBusTypeReader        *reader,
@@ -171,6 +176,8 @@ dbus_bool_t _dbus_type_reader_greater_than              (const DBusTypeReader  *
 dbus_bool_t _dbus_type_reader_equal_values              (const DBusTypeReader *lhs,
                                                          const DBusTypeReader *rhs);
 
+int         _dbus_type_get_fixed_struct_stride          (const DBusString      *type_str,
+                                                         int                    type_pos);
 void        _dbus_type_signature_next                   (const char            *signature,
 							 int                   *type_pos);
 
@@ -201,6 +208,11 @@ dbus_bool_t _dbus_type_writer_write_fixed_multi    (DBusTypeWriter        *write
                                                     int                    element_type,
                                                     const void            *value,
                                                     int                    n_elements);
+dbus_bool_t _dbus_type_writer_write_fixed_struct_multi (DBusTypeWriter  *writer,
+                                                        const void      *value,
+                                                        int              stride,
+                                                        const int       *field_offsets,
+                                                        int              n_elements);
 dbus_bool_t _dbus_type_writer_recurse              (DBusTypeWriter        *writer,
                                                     int                    container_type,
                                                     const DBusString      *contained_type,
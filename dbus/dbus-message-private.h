@@ -75,6 +75,24 @@ struct DBusMessageLoader
 };
 
 
+/**
+ * A message body shared by a message and the copies made of it with
+ * dbus_message_copy(). The data never changes while it's shared; a
+ * message that needs to modify its body takes a private copy first.
+ */
+typedef struct DBusMessageSharedBody DBusMessageSharedBody;
+
+/**
+ * Implementation details of DBusMessageSharedBody.
+ * All members are private.
+ */
+struct DBusMessageSharedBody
+{
+  DBusAtomic refcount; /**< Number of messages using the body */
+
+  DBusString data;     /**< Body network data */
+};
+
 /** How many bits are in the changed_stamp used to validate iterators */
 #define CHANGED_STAMP_BITS 21
 
@@ -93,6 +111,8 @@ struct DBusMessage
 
   DBusString body;   /**< Body network data. */
 
+  DBusMessageSharedBody *shared_body; /**< If non-#NULL, body is a constant string pointing into this */
+
   char byte_order; /**< Message byte order. */
 
   unsigned int locked : 1; /**< Message being sent, no modifications allowed. */
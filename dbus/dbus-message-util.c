@@ -893,6 +893,260 @@ verify_test_message (DBusMessage *message)
     _dbus_assert_not_reached ("Didn't reach end of arguments");
 }
 
+typedef struct
+{
+  unsigned char y;
+  double d;
+  dbus_int16_t n;
+  dbus_bool_t b;
+  dbus_int32_t i;
+  char unused[3];
+} FixedStructSample;
+
+static void
+check_fixed_struct_array (void)
+{
+  static const int offsets[] = {
+    _DBUS_STRUCT_OFFSET (FixedStructSample, y),
+    _DBUS_STRUCT_OFFSET (FixedStructSample, d),
+    _DBUS_STRUCT_OFFSET (FixedStructSample, n),
+    _DBUS_STRUCT_OFFSET (FixedStructSample, b),
+    _DBUS_STRUCT_OFFSET (FixedStructSample, i)
+  };
+  FixedStructSample samples[7];
+  FixedStructSample read_back[7];
+  DBusMessage *bulk;
+  DBusMessage *slow;
+  DBusMessageIter iter, array, element;
+  unsigned char v_BYTE;
+  int i, n;
+
+  _DBUS_ZERO (read_back);
+
+  for (i = 0; i < (int) _DBUS_N_ELEMENTS (samples); i++)
+    {
+      samples[i].y = 0xf0 + i;
+      samples[i].d = i * 1.5;
+      samples[i].n = -i;
+      samples[i].b = i % 3; /* non-canonical booleans get normalized */
+      samples[i].i = 0x12345678 * i;
+    }
+
+  bulk = dbus_message_new_signal ("/a/b", "a.b", "c");
+  slow = dbus_message_new_signal ("/a/b", "a.b", "c");
+  if (bulk == NULL || slow == NULL)
+    _dbus_assert_not_reached ("out of memory");
+
+  /* leading byte so the array start isn't 8-aligned */
+  v_BYTE = 42;
+
+  /* Append in two chunks, which leaves the write position unaligned
+   * in between, then do the same thing the slow way
+   */
+  dbus_message_iter_init_append (bulk, &iter);
+  if (!dbus_message_iter_append_basic (&iter, DBUS_TYPE_BYTE, &v_BYTE) ||
+      !dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(ydnbi)", &array) ||
+      !dbus_message_iter_append_fixed_struct_array (&array, samples, sizeof (samples[0]),
+                                                    offsets, 3) ||
+      !dbus_message_iter_append_fixed_struct_array (&array, &samples[3], sizeof (samples[0]),
+                                                    offsets, 4) ||
+      !dbus_message_iter_close_container (&iter, &array) ||
+      !dbus_message_iter_append_basic (&iter, DBUS_TYPE_BYTE, &v_BYTE))
+    _dbus_assert_not_reached ("out of memory");
+
+  dbus_message_iter_init_append (slow, &iter);
+  if (!dbus_message_iter_append_basic (&iter, DBUS_TYPE_BYTE, &v_BYTE) ||
+      !dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(ydnbi)", &array))
+    _dbus_assert_not_reached ("out of memory");
+
+  for (i = 0; i < (int) _DBUS_N_ELEMENTS (samples); i++)
+    {
+      dbus_bool_t v_BOOLEAN = samples[i].b != FALSE;
+
+      if (!dbus_message_iter_open_container (&array, DBUS_TYPE_STRUCT, NULL, &element) ||
+          !dbus_message_iter_append_basic (&element, DBUS_TYPE_BYTE, &samples[i].y) ||
+          !dbus_message_iter_append_basic (&element, DBUS_TYPE_DOUBLE, &samples[i].d) ||
+          !dbus_message_iter_append_basic (&element, DBUS_TYPE_INT16, &samples[i].n) ||
+          !dbus_message_iter_append_basic (&element, DBUS_TYPE_BOOLEAN, &v_BOOLEAN) ||
+          !dbus_message_iter_append_basic (&element, DBUS_TYPE_INT32, &samples[i].i) ||
+          !dbus_message_iter_close_container (&array, &element))
+        _dbus_assert_not_reached ("out of memory");
+    }
+
+  if (!dbus_message_iter_close_container (&iter, &array) ||
+      !dbus_message_iter_append_basic (&iter, DBUS_TYPE_BYTE, &v_BYTE))
+    _dbus_assert_not_reached ("out of memory");
+
+  _dbus_assert (strcmp (dbus_message_get_signature (bulk), "ya(ydnbi)y") == 0);
+  _dbus_assert (strcmp (dbus_message_get_signature (bulk),
+                        dbus_message_get_signature (slow)) == 0);
+  _dbus_assert (_dbus_string_equal (&bulk->body, &slow->body));
+
+  /* Now read it back */
+  dbus_message_iter_init (bulk, &iter);
+  if (!dbus_message_iter_next (&iter))
+    _dbus_assert_not_reached ("Reached end of arguments");
+  dbus_message_iter_recurse (&iter, &array);
+
+  n = dbus_message_iter_get_fixed_struct_array (&array, NULL, 0, offsets, 0);
+  _dbus_assert (n == _DBUS_N_ELEMENTS (samples));
+
+  n = dbus_message_iter_get_fixed_struct_array (&array, read_back, sizeof (read_back[0]),
+                                                offsets, _DBUS_N_ELEMENTS (read_back));
+  _dbus_assert (n == _DBUS_N_ELEMENTS (read_back));
+
+  for (i = 0; i < n; i++)
+    {
+      _dbus_assert (read_back[i].y == samples[i].y);
+      _dbus_assert (_DBUS_DOUBLES_BITWISE_EQUAL (read_back[i].d, samples[i].d));
+      _dbus_assert (read_back[i].n == samples[i].n);
+      _dbus_assert (read_back[i].b == (samples[i].b != FALSE));
+      _dbus_assert (read_back[i].i == samples[i].i);
+    }
+
+  /* Reading from the middle of the array only returns what's left */
+  dbus_message_iter_next (&array);
+  dbus_message_iter_next (&array);
+  n = dbus_message_iter_get_fixed_struct_array (&array, read_back, sizeof (read_back[0]),
+                                                offsets, 2);
+  _dbus_assert (n == 2);
+  _dbus_assert (read_back[0].i == samples[2].i);
+  _dbus_assert (read_back[1].i == samples[3].i);
+  _dbus_assert (dbus_message_iter_get_fixed_struct_array (&array, NULL, 0, offsets, 0) == 5);
+
+  dbus_message_unref (bulk);
+  dbus_message_unref (slow);
+
+  check_memleaks ();
+}
+
+static void
+check_shared_body_copy (void)
+{
+  DBusMessage *message;
+  DBusMessage *copy1;
+  DBusMessage *copy2;
+  DBusMessage *loaded;
+  DBusMessageLoader *loader;
+  DBusString *buffer;
+  unsigned char bytes[4096];
+  const unsigned char *v_ARRAY;
+  unsigned char v_BYTE;
+  int i;
+
+  for (i = 0; i < (int) _DBUS_N_ELEMENTS (bytes); i++)
+    bytes[i] = i & 0xff;
+
+  message = dbus_message_new_method_call ("org.freedesktop.DBus.TestService",
+                                          "/org/freedesktop/TestPath",
+                                          "Foo.TestInterface",
+                                          "TestMethod");
+  _dbus_assert (message != NULL);
+
+  v_ARRAY = bytes;
+  if (!dbus_message_append_args (message,
+                                 DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &v_ARRAY,
+                                 _DBUS_N_ELEMENTS (bytes),
+                                 DBUS_TYPE_INVALID))
+    _dbus_assert_not_reached ("out of memory");
+
+  /* The message can still change, so copying it copies the body */
+  copy1 = dbus_message_copy (message);
+  _dbus_assert (copy1 != NULL);
+  _dbus_assert (message->shared_body == NULL);
+  _dbus_assert (copy1->shared_body == NULL);
+  dbus_message_unref (copy1);
+
+  /* Once locked, the body is shared */
+  _dbus_message_set_serial (message, 1);
+  _dbus_message_lock (message);
+  _dbus_assert (message->shared_body != NULL);
+
+  copy1 = dbus_message_copy (message);
+  copy2 = dbus_message_copy (message);
+  _dbus_assert (copy1 != NULL && copy2 != NULL);
+  _dbus_assert (copy1->shared_body == message->shared_body);
+  _dbus_assert (copy2->shared_body == message->shared_body);
+  _dbus_assert (message->shared_body->refcount.value == 3);
+  _dbus_assert (_dbus_string_get_const_data (&message->body) ==
+                _dbus_string_get_const_data (&copy1->body));
+
+  /* Appending gives the copy its own body */
+  v_BYTE = 0x42;
+  if (!dbus_message_append_args (copy1,
+                                 DBUS_TYPE_BYTE, &v_BYTE,
+                                 DBUS_TYPE_INVALID))
+    _dbus_assert_not_reached ("out of memory");
+
+  _dbus_assert (copy1->shared_body == NULL);
+  _dbus_assert (message->shared_body->refcount.value == 2);
+  _dbus_assert (_dbus_string_get_length (&message->body) + 1 ==
+                _dbus_string_get_length (&copy1->body));
+
+  /* A received message shares its body too */
+  loader = _dbus_message_loader_new ();
+  _dbus_assert (loader != NULL);
+
+  _dbus_message_loader_get_buffer (loader, &buffer);
+  if (!_dbus_string_copy (&message->header.data, 0, buffer,
+                          _dbus_string_get_length (buffer)) ||
+      !_dbus_string_copy (&message->body, 0, buffer,
+                          _dbus_string_get_length (buffer)))
+    _dbus_assert_not_reached ("out of memory");
+  _dbus_message_loader_return_buffer (loader, buffer,
+                                      _dbus_string_get_length (buffer));
+
+  if (!_dbus_message_loader_queue_messages (loader))
+    _dbus_assert_not_reached ("no memory to queue messages");
+
+  loaded = _dbus_message_loader_pop_message (loader);
+  _dbus_assert (loaded != NULL);
+  _dbus_assert (loaded->shared_body != NULL);
+  _dbus_assert (loaded->shared_body->refcount.value == 1);
+  _dbus_message_loader_unref (loader);
+
+  /* The last message using the body frees it */
+  dbus_message_unref (message);
+  _dbus_assert (copy2->shared_body->refcount.value == 1);
+  _dbus_assert (_dbus_string_equal (&copy2->body, &loaded->body));
+
+  dbus_message_unref (copy2);
+  dbus_message_unref (copy1);
+  dbus_message_unref (loaded);
+
+  /* A signal emitted on several paths: the application locks it and
+   * sends a copy with another path for each object */
+  message = dbus_message_new_signal ("/", "Foo.TestInterface", "TestSignal");
+  _dbus_assert (message != NULL);
+
+  v_ARRAY = bytes;
+  if (!dbus_message_append_args (message,
+                                 DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &v_ARRAY,
+                                 _DBUS_N_ELEMENTS (bytes),
+                                 DBUS_TYPE_INVALID))
+    _dbus_assert_not_reached ("out of memory");
+
+  dbus_message_lock (message);
+  _dbus_assert (message->shared_body != NULL);
+
+  copy1 = dbus_message_copy (message);
+  _dbus_assert (copy1 != NULL);
+  if (!dbus_message_set_path (copy1, "/org/freedesktop/TestPath"))
+    _dbus_assert_not_reached ("out of memory");
+
+  _dbus_assert (!copy1->locked);
+  _dbus_assert (copy1->shared_body == message->shared_body);
+  _dbus_assert (_dbus_string_get_const_data (&message->body) ==
+                _dbus_string_get_const_data (&copy1->body));
+  _dbus_assert (strcmp (dbus_message_get_path (copy1),
+                        "/org/freedesktop/TestPath") == 0);
+
+  dbus_message_unref (message);
+  dbus_message_unref (copy1);
+
+  check_memleaks ();
+}
+
 /**
  * @ingroup DBusMessageInternals
  * Unit test for DBusMessage.
@@ -1176,6 +1430,10 @@ _dbus_message_test (const char *test_data_dir)
 
   _dbus_assert (strcmp (name1, name2) == 0);
 
+  /* The body is small and the message isn't locked, so it was copied */
+  _dbus_assert (copy->shared_body == NULL);
+  _dbus_assert (message->shared_body == NULL);
+
   dbus_message_unref (copy);
 
   /* Message loader test */
@@ -1231,6 +1489,10 @@ _dbus_message_test (const char *test_data_dir)
 
   check_memleaks ();
 
+  check_fixed_struct_array ();
+
+  check_shared_body_copy ();
+
   /* Load all the sample messages from the message factory */
   {
     DBusMessageDataIter diter;
@@ -113,6 +113,9 @@ _dbus_message_byteswap (DBusMessage *message)
     return;
 
   _dbus_verbose ("Swapping message into compiler byte order\n");
+
+  /* only messages in compiler byte order share their body */
+  _dbus_assert (message->shared_body == NULL);
   
   get_const_signature (&message->header, &type_str, &type_pos);
   
@@ -130,6 +133,148 @@ _dbus_message_byteswap (DBusMessage *message)
  if (message->byte_order != DBUS_COMPILER_BYTE_ORDER)   \
    _dbus_message_byteswap (message)
 
+static void
+_dbus_message_shared_body_unref (DBusMessageSharedBody *shared)
+{
+  if (_dbus_atomic_dec (&shared->refcount) == 1)
+    {
+      _dbus_string_free (&shared->data);
+      dbus_free (shared);
+    }
+}
+
+/**
+ * Bodies smaller than this are copied by dbus_message_copy(), since
+ * that is cheaper than allocating a #DBusMessageSharedBody for every
+ * message that is loaded or locked.
+ */
+#define MIN_BODY_SIZE_TO_SHARE 1024
+
+/**
+ * Makes the message body shareable with copies of the message, by
+ * moving the body data into a #DBusMessageSharedBody and turning
+ * message->body into a constant string pointing at it. The data
+ * itself does not move.
+ *
+ * This is only done when a message is loaded or locked, before
+ * other threads can see it; dbus_message_copy() never changes the
+ * message it copies. Failing to share the body is not an error, the
+ * copies just get their own body.
+ *
+ * @param message the message
+ */
+static void
+_dbus_message_share_body (DBusMessage *message)
+{
+  DBusMessageSharedBody *shared;
+
+  /* a body in the other byte order is swapped in place later */
+  if (message->shared_body != NULL ||
+      message->byte_order != DBUS_COMPILER_BYTE_ORDER ||
+      _dbus_string_get_length (&message->body) < MIN_BODY_SIZE_TO_SHARE)
+    return;
+
+  shared = dbus_new (DBusMessageSharedBody, 1);
+  if (shared == NULL)
+    return;
+
+  shared->refcount.value = 1;
+  shared->data = message->body;
+
+  _dbus_string_init_const_len (&message->body,
+                               _dbus_string_get_const_data (&shared->data),
+                               _dbus_string_get_length (&shared->data));
+  message->shared_body = shared;
+}
+
+/**
+ * Gives the message back its body string if no other message shares
+ * it anymore.
+ *
+ * @param message the message
+ * @returns #TRUE if the message owns its body now
+ */
+static dbus_bool_t
+_dbus_message_reclaim_body (DBusMessage *message)
+{
+  DBusMessageSharedBody *shared;
+
+  shared = message->shared_body;
+  if (shared == NULL)
+    return TRUE;
+
+  /* only copies of this message could add a reference, and
+   * copying a message while modifying or freeing it isn't allowed
+   */
+  if (shared->refcount.value != 1)
+    return FALSE;
+
+  message->body = shared->data;
+  message->shared_body = NULL;
+  dbus_free (shared);
+
+  return TRUE;
+}
+
+/**
+ * Gives the message a private, modifiable copy of its body if the
+ * body is currently shared with other messages. Must be called
+ * before anything writes to message->body.
+ *
+ * @param message the message
+ * @returns #FALSE if no memory
+ */
+static dbus_bool_t
+_dbus_message_unshare_body (DBusMessage *message)
+{
+  DBusString body;
+
+  if (_dbus_message_reclaim_body (message))
+    return TRUE;
+
+  if (!_dbus_string_init_preallocated (&body,
+                                       _dbus_string_get_length (&message->body)))
+    return FALSE;
+
+  if (!_dbus_string_copy (&message->body, 0, &body, 0))
+    {
+      _dbus_string_free (&body);
+      return FALSE;
+    }
+
+  _dbus_message_shared_body_unref (message->shared_body);
+  message->shared_body = NULL;
+  message->body = body;
+
+  return TRUE;
+}
+
+/**
+ * Gives the message a body string of its own, so that the message
+ * cache can recycle it. The contents are dropped if other messages
+ * still share them.
+ *
+ * @param message the message
+ * @returns #FALSE if no memory
+ */
+static dbus_bool_t
+_dbus_message_own_body (DBusMessage *message)
+{
+  DBusString body;
+
+  if (_dbus_message_reclaim_body (message))
+    return TRUE;
+
+  if (!_dbus_string_init (&body))
+    return FALSE;
+
+  _dbus_message_shared_body_unref (message->shared_body);
+  message->shared_body = NULL;
+  message->body = body;
+
+  return TRUE;
+}
+
 /**
  * Gets the data to be sent over the network for this message.
  * The header and then the body should be written out.
@@ -286,6 +431,9 @@ _dbus_message_lock (DBusMessage  *message)
                     dbus_message_get_signature (message) != NULL);
 
       message->locked = TRUE;
+
+      /* the body can't change anymore, so copies can share it */
+      _dbus_message_share_body (message);
     }
 }
 
@@ -458,6 +606,8 @@ dbus_message_finalize (DBusMessage *message)
 
   _dbus_header_free (&message->header);
   _dbus_string_free (&message->body);
+  if (message->shared_body != NULL)
+    _dbus_message_shared_body_unref (message->shared_body);
 
   _dbus_assert (message->refcount.value == 0);
   
@@ -648,6 +798,10 @@ dbus_message_cache_or_finalize (DBusMessage *message)
       MAX_MESSAGE_SIZE_TO_CACHE)
     goto out;
 
+  /* the cache reuses the body string */
+  if (!_dbus_message_own_body (message))
+    goto out;
+
   if (message_cache_count >= MAX_MESSAGE_CACHE_SIZE)
     goto out;
 
@@ -711,6 +865,8 @@ dbus_message_new_empty_header (void)
   if (!from_cache)
     _dbus_data_slot_list_init (&message->slot_list);
 
+  message->shared_body = NULL;
+
   if (from_cache)
     {
       _dbus_header_reinit (&message->header, message->byte_order);
@@ -1016,6 +1172,12 @@ dbus_message_new_error_printf (DBusMessage *reply_to,
  * outgoing message queue and thus not modifiable) the new message
  * will not be locked.
  *
+ * The header is copied. If the original message was received or
+ * locked, a large body is shared with it until the copy appends to
+ * it, so copying a message to change a header field such as the path
+ * or destination does not duplicate the body. The original message
+ * itself is not modified, so it can be copied from several threads.
+ *
  * @param message the message.
  * @returns the new message.
  */
@@ -1043,6 +1205,20 @@ dbus_message_copy (const DBusMessage *message)
       return NULL;
     }
 
+  /* Loaded and locked messages can't change their body, so they
+   * share it (see _dbus_message_share_body()).
+   */
+  if (message->shared_body != NULL)
+    {
+      _dbus_atomic_inc (&message->shared_body->refcount);
+      retval->shared_body = message->shared_body;
+      _dbus_string_init_const_len (&retval->body,
+                                   _dbus_string_get_const_data (&message->body),
+                                   _dbus_string_get_length (&message->body));
+
+      return retval;
+    }
+
   if (!_dbus_string_init_preallocated (&retval->body,
                                        _dbus_string_get_length (&message->body)))
     {
@@ -1065,6 +1241,26 @@ dbus_message_copy (const DBusMessage *message)
   return NULL;
 }
 
+/**
+ * Locks a message, so that it can no longer be modified. Copies of a
+ * locked message share its body, so an application that sends the
+ * same arguments in several messages, changing only header fields,
+ * can build the first message, lock it and copy it for each message
+ * it sends. The copies are not locked.
+ *
+ * Messages are locked anyway when they are sent; locking a message
+ * that is already locked does nothing.
+ *
+ * @param message the message to lock
+ */
+void
+dbus_message_lock (DBusMessage *message)
+{
+  _dbus_return_if_fail (message != NULL);
+
+  _dbus_message_lock (message);
+}
+
 
 /**
  * Increments the reference count of a DBusMessage.
@@ -1746,6 +1942,62 @@ dbus_message_iter_get_fixed_array (DBusMessageIter  *iter,
                                       value, n_elements);
 }
 
+/**
+ * Reads a block of structs of fixed-length values from the message
+ * iterator into a strided C buffer. The block read will be from the
+ * current position in the array until the end of the array, or until
+ * max_elements elements have been read. The array elements must be
+ * structs whose fields all have types for which #dbus_type_is_fixed
+ * returns #TRUE, such as "(iid)".
+ *
+ * The C buffer holds one element every stride bytes; field_offsets
+ * gives the offset of each struct field inside a buffer element, in
+ * signature order, typically computed with offsetof(). The values are
+ * copied, since the C layout need not match the message layout.
+ *
+ * If value is #NULL, nothing is copied and the number of elements
+ * remaining in the array is returned, so a buffer can be sized.
+ *
+ * @code
+ * typedef struct { dbus_int32_t x; dbus_int32_t y; double v; } Sample;
+ * static const int offsets[] = { offsetof (Sample, x), offsetof (Sample, y), offsetof (Sample, v) };
+ * n = dbus_message_iter_get_fixed_struct_array (&array, NULL, 0, offsets, 0);
+ * samples = dbus_new (Sample, n);
+ * dbus_message_iter_get_fixed_struct_array (&array, samples, sizeof (Sample), offsets, n);
+ * @endcode
+ *
+ * @param iter the iterator, recursed into the array
+ * @param value buffer to store elements in, or #NULL
+ * @param stride number of bytes from one buffer element to the next
+ * @param field_offsets offset of each struct field in a buffer element
+ * @param max_elements number of elements the buffer has room for
+ * @returns number of elements copied, or remaining if value is #NULL
+ */
+int
+dbus_message_iter_get_fixed_struct_array (DBusMessageIter  *iter,
+                                          void             *value,
+                                          int               stride,
+                                          const int        *field_offsets,
+                                          int               max_elements)
+{
+  DBusMessageRealIter *real = (DBusMessageRealIter *)iter;
+  int subtype = _dbus_type_reader_get_current_type(&real->u.reader);
+
+  _dbus_return_val_if_fail (_dbus_message_iter_check (real), 0);
+  _dbus_return_val_if_fail (real->iter_type == DBUS_MESSAGE_ITER_TYPE_READER, 0);
+  _dbus_return_val_if_fail ((subtype == DBUS_TYPE_INVALID) ||
+                            (subtype == DBUS_TYPE_STRUCT), 0);
+  _dbus_return_val_if_fail (_dbus_type_get_fixed_struct_stride (real->u.reader.type_str,
+                                                                real->u.reader.type_pos) > 0, 0);
+  _dbus_return_val_if_fail (value == NULL || stride > 0, 0);
+  _dbus_return_val_if_fail (value == NULL || field_offsets != NULL, 0);
+  _dbus_return_val_if_fail (max_elements >= 0, 0);
+
+  return _dbus_type_reader_read_fixed_struct_multi (&real->u.reader, value,
+                                                    stride, field_offsets,
+                                                    max_elements);
+}
+
 /**
  * This function takes a va_list for use by language bindings and is
  * otherwise the same as dbus_message_iter_get_args().
@@ -1986,6 +2238,9 @@ _dbus_message_iter_open_signature (DBusMessageRealIter *real)
 
   _dbus_assert (real->iter_type == DBUS_MESSAGE_ITER_TYPE_WRITER);
 
+  if (!_dbus_message_unshare_body (real->message))
+    return FALSE;
+
   if (real->u.writer.type_str != NULL)
     {
       _dbus_assert (real->sig_refcount > 0);
@@ -2193,11 +2448,81 @@ dbus_message_iter_append_fixed_array (DBusMessageIter *iter,
                             DBUS_MAXIMUM_ARRAY_LENGTH / _dbus_type_get_alignment (element_type),
                             FALSE);
 
+  if (!_dbus_message_unshare_body (real->message))
+    return FALSE;
+
   ret = _dbus_type_writer_write_fixed_multi (&real->u.writer, element_type, value, n_elements);
 
   return ret;
 }
 
+/**
+ * Appends a block of structs of fixed-length values to an array, from
+ * a strided C buffer. You must call dbus_message_iter_open_container()
+ * to open an array whose element type is a struct of fixed-length
+ * types, such as "(iid)", before calling this function. This is
+ * equivalent to opening, filling and closing one struct container per
+ * element, but the array space is allocated once and no per-value
+ * signature bookkeeping is done, so large sample sets can be
+ * marshaled at close to memory bandwidth.
+ *
+ * The C buffer holds one element every stride bytes; field_offsets
+ * gives the offset of each struct field inside a buffer element, in
+ * signature order, typically computed with offsetof(). Boolean
+ * fields are read as #dbus_bool_t.
+ *
+ * @code
+ * typedef struct { dbus_int32_t x; dbus_int32_t y; double v; } Sample;
+ * static const int offsets[] = { offsetof (Sample, x), offsetof (Sample, y), offsetof (Sample, v) };
+ * dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(iid)", &array);
+ * if (!dbus_message_iter_append_fixed_struct_array (&array, samples, sizeof (Sample), offsets, n_samples))
+ *   fprintf (stderr, "No memory!\n");
+ * dbus_message_iter_close_container (&iter, &array);
+ * @endcode
+ *
+ * @todo If this fails due to lack of memory, the message is hosed and
+ * you have to start over building the whole message.
+ *
+ * @param iter the append iterator, opened on the array
+ * @param value the start of the C buffer
+ * @param stride number of bytes from one buffer element to the next
+ * @param field_offsets offset of each struct field in a buffer element
+ * @param n_elements the number of elements to append
+ * @returns #FALSE if not enough memory
+ */
+dbus_bool_t
+dbus_message_iter_append_fixed_struct_array (DBusMessageIter *iter,
+                                             const void      *value,
+                                             int              stride,
+                                             const int       *field_offsets,
+                                             int              n_elements)
+{
+  DBusMessageRealIter *real = (DBusMessageRealIter *)iter;
+
+  _dbus_return_val_if_fail (_dbus_message_iter_append_check (real), FALSE);
+  _dbus_return_val_if_fail (real->iter_type == DBUS_MESSAGE_ITER_TYPE_WRITER, FALSE);
+  _dbus_return_val_if_fail (real->u.writer.container_type == DBUS_TYPE_ARRAY, FALSE);
+  _dbus_return_val_if_fail (_dbus_type_get_fixed_struct_stride (real->u.writer.type_str,
+                                                                real->u.writer.type_pos) > 0,
+                            FALSE);
+  _dbus_return_val_if_fail (value != NULL || n_elements == 0, FALSE);
+  _dbus_return_val_if_fail (field_offsets != NULL, FALSE);
+  _dbus_return_val_if_fail (stride > 0, FALSE);
+  _dbus_return_val_if_fail (n_elements >= 0, FALSE);
+  _dbus_return_val_if_fail (n_elements <=
+                            DBUS_MAXIMUM_ARRAY_LENGTH /
+                            _dbus_type_get_fixed_struct_stride (real->u.writer.type_str,
+                                                                real->u.writer.type_pos),
+                            FALSE);
+
+  if (!_dbus_message_unshare_body (real->message))
+    return FALSE;
+
+  return _dbus_type_writer_write_fixed_struct_multi (&real->u.writer, value,
+                                                     stride, field_offsets,
+                                                     n_elements);
+}
+
 /**
  * Appends a container-typed value to the message; you are required to
  * append the contents of the container using the returned
@@ -2298,6 +2623,9 @@ dbus_message_iter_close_container (DBusMessageIter *iter,
   _dbus_return_val_if_fail (_dbus_message_iter_append_check (real_sub), FALSE);
   _dbus_return_val_if_fail (real_sub->iter_type == DBUS_MESSAGE_ITER_TYPE_WRITER, FALSE);
 
+  if (!_dbus_message_unshare_body (real->message))
+    return FALSE;
+
   ret = _dbus_type_writer_unrecurse (&real->u.writer,
                                      &real_sub->u.writer);
 
@@ -3370,6 +3698,8 @@ load_message (DBusMessageLoader *loader,
 
   _dbus_string_delete (&loader->data, 0, header_len + body_len);
 
+  _dbus_message_share_body (message);
+
   _dbus_assert (_dbus_string_get_length (&message->header.data) == header_len);
   _dbus_assert (_dbus_string_get_length (&message->body) == body_len);
 
@@ -78,6 +78,7 @@ DBusMessage* dbus_message_new_error_printf  (DBusMessage *reply_to,
 					     ...);
 
 DBusMessage* dbus_message_copy              (const DBusMessage *message);
+void         dbus_message_lock              (DBusMessage       *message);
 
 DBusMessage*  dbus_message_ref              (DBusMessage   *message);
 void          dbus_message_unref            (DBusMessage   *message);
@@ -167,6 +168,11 @@ int         dbus_message_iter_get_array_len    (DBusMessageIter *iter);
 void        dbus_message_iter_get_fixed_array  (DBusMessageIter *iter,
                                                 void            *value,
                                                 int             *n_elements);
+int         dbus_message_iter_get_fixed_struct_array (DBusMessageIter *iter,
+                                                      void            *value,
+                                                      int              stride,
+                                                      const int       *field_offsets,
+                                                      int              max_elements);
 
 
 void        dbus_message_iter_init_append        (DBusMessage     *message,
@@ -178,6 +184,11 @@ dbus_bool_t dbus_message_iter_append_fixed_array (DBusMessageIter *iter,
                                                   int              element_type,
                                                   const void      *value,
                                                   int              n_elements);
+dbus_bool_t dbus_message_iter_append_fixed_struct_array (DBusMessageIter *iter,
+                                                         const void      *value,
+                                                         int              stride,
+                                                         const int       *field_offsets,
+                                                         int              n_elements);
 dbus_bool_t dbus_message_iter_open_container     (DBusMessageIter *iter,
                                                   int              type,
                                                   const char      *contained_signature,
@@ -49,6 +49,38 @@ struct QDBusAdaptorInit
 
 Q_GLOBAL_STATIC(QDBusAdaptorInit, qAdaptorInit)
 
+struct QDBusAdaptorDispatcherList
+{
+    QReadWriteLock lock;
+    QHash<const QMetaObject *, QDBusAdaptorDispatcher> dispatchers; // protected by lock
+};
+
+Q_GLOBAL_STATIC(QDBusAdaptorDispatcherList, qDBusAdaptorDispatcherList)
+
+/*!
+    \internal
+    Registers \a dispatcher as the static dispatch function for the adaptor class whose meta
+    object is \a metaObject. This is called by the code generated by dbusidl2cpp when run with
+    the -s option.
+
+    The dispatcher is called with a null adaptor to find out if it handles the method call
+    without placing it. Otherwise, it is called in the thread the adaptor lives in and returns
+    the reply to be sent.
+*/
+void qDBusAddAdaptorDispatcher(const QMetaObject *metaObject, QDBusAdaptorDispatcher dispatcher)
+{
+    QDBusAdaptorDispatcherList *list = qDBusAdaptorDispatcherList();
+    QWriteLocker locker(&list->lock);
+    list->dispatchers.insert(metaObject, dispatcher);
+}
+
+QDBusAdaptorDispatcher qDBusFindAdaptorDispatcher(const QMetaObject *metaObject)
+{
+    QDBusAdaptorDispatcherList *list = qDBusAdaptorDispatcherList();
+    QReadLocker locker(&list->lock);
+    return list->dispatchers.value(metaObject, 0);
+}
+
 QDBusAdaptorConnector *qDBusFindAdaptorConnector(QObject *obj)
 {
     (void)qAdaptorInit();
@@ -181,7 +213,7 @@ void QDBusAbstractAdaptor::setAutoRelaySignals(bool enable)
 }
 
 QDBusAdaptorConnector::QDBusAdaptorConnector(QObject *obj)
-    : QObject(obj), waitingForPolish(false), lastSignalIdx(0), argv(0)
+    : QObject(obj), revision(0), waitingForPolish(false), lastSignalIdx(0), argv(0)
 {
 }
 
@@ -205,12 +237,14 @@ void QDBusAdaptorConnector::addAdaptor(QDBusAbstractAdaptor *adaptor)
                     // exists. Replace it (though it's probably the same)
                     it->adaptor = adaptor;
                     it->metaObject = mo;
+                    it->dispatcher = qDBusFindAdaptorDispatcher(mo);
                 } else {
                     // create a new one
                     AdaptorData entry;
                     entry.interface = interface;
                     entry.adaptor = adaptor;
                     entry.metaObject = mo;
+                    entry.dispatcher = qDBusFindAdaptorDispatcher(mo);
                     adaptors << entry;
                 }
             }
@@ -250,6 +284,7 @@ void QDBusAdaptorConnector::polish()
 
     // sort the adaptor list
     qSort(adaptors);
+    ++revision;
 }
 
 void QDBusAdaptorConnector::relaySlot()
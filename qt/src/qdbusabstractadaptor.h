@@ -27,6 +27,7 @@
 #include <QtCore/qobject.h>
 #include "qdbusmacros.h"
 
+struct DBusMessage;
 class QDBusAbstractAdaptorPrivate;
 class QDBUS_EXPORT QDBusAbstractAdaptor: public QObject
 {
@@ -47,4 +48,9 @@ private:
     QDBusAbstractAdaptorPrivate *d;
 };
 
+typedef DBusMessage *(*QDBusAdaptorDispatcher)(QDBusAbstractAdaptor *adaptor, DBusMessage *call,
+                                               bool *handled);
+QDBUS_EXPORT void qDBusAddAdaptorDispatcher(const QMetaObject *metaObject,
+                                            QDBusAdaptorDispatcher dispatcher);
+
 #endif
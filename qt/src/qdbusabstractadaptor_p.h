@@ -42,6 +42,7 @@
 #include <QtCore/qreadwritelock.h>
 #include <QtCore/qvariant.h>
 #include <QtCore/qvector.h>
+#include "qdbusabstractadaptor.h"
 
 #define QCLASSINFO_DBUS_INTERFACE       "D-Bus Interface"
 #define QCLASSINFO_DBUS_INTROSPECTION   "D-Bus Introspection"
@@ -85,6 +86,7 @@ public: // typedefs
         QString interface;
         QDBusAbstractAdaptor *adaptor;
         const QMetaObject *metaObject;
+        QDBusAdaptorDispatcher dispatcher;
 
         inline bool operator<(const AdaptorData &other) const
         { return interface < other.interface; }
@@ -109,6 +111,7 @@ signals:
 
 public: // member variables
     AdaptorMap adaptors;
+    int revision;               // changes every time the adaptor list does
     bool waitingForPolish : 1;
 
     int lastSignalIdx;
@@ -123,5 +126,6 @@ public: // static members
 
 extern QDBusAdaptorConnector *qDBusFindAdaptorConnector(QObject *object);
 extern QDBusAdaptorConnector *qDBusCreateAdaptorConnector(QObject *object);
+extern QDBusAdaptorDispatcher qDBusFindAdaptorDispatcher(const QMetaObject *metaObject);
 
 #endif // QDBUSABSTRACTADAPTORPRIVATE_H
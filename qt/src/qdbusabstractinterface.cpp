@@ -28,13 +28,36 @@
 #include "qdbusmetaobject_p.h"
 #include "qdbusconnection_p.h"
 
+// Checks that a value received through org.freedesktop.DBus.Properties has the type of the
+// property mp, and unwraps it if the property is itself a QVariant.
+static bool fixPropertyValue(const QMetaProperty &mp, QVariant &value)
+{
+    if (qstrcmp(mp.typeName(), value.typeName()) != 0)
+        return false;
+
+    if (mp.type() == QVariant::LastType)
+        // QVariant is special in this context
+        value = QDBusTypeHelper<QVariant>::fromVariant(value);
+    return true;
+}
+
 QVariant QDBusAbstractInterfacePrivate::property(const QMetaProperty &mp) const
 {
+    QString name = QString::fromUtf8(mp.name());
+    if (propertyCacheEnabled) {
+        QVariantMap::ConstIterator it = propertyCache.constFind(name);
+        if (it != propertyCache.constEnd()) {
+            ++propertyCacheHits;
+            return it.value();
+        }
+        ++propertyCacheMisses;
+    }
+
     // try to read this property
     QDBusMessage msg = QDBusMessage::methodCall(service, path,
                                                 QLatin1String(DBUS_INTERFACE_PROPERTIES),
                                                 QLatin1String("Get"));
-    msg << interface << QString::fromUtf8(mp.name());
+    msg << interface << name;
     QDBusMessage reply = connp->sendWithReply(msg, QDBusConnection::NoUseEventLoop);
 
     if (reply.type() == QDBusMessage::ReplyMessage && reply.count() == 1 &&
@@ -42,11 +65,9 @@ QVariant QDBusAbstractInterfacePrivate::property(const QMetaProperty &mp) const
         QVariant value = QDBusTypeHelper<QVariant>::fromVariant(reply.at(0));
 
         // make sure the type is right
-        if (qstrcmp(mp.typeName(), value.typeName()) == 0) {
-            if (mp.type() == QVariant::LastType)
-                // QVariant is special in this context
-                return QDBusTypeHelper<QVariant>::fromVariant(value);
-
+        if (fixPropertyValue(mp, value)) {
+            if (propertyCacheEnabled)
+                propertyCache.insert(name, value);
             return value;
         }
     }
@@ -64,12 +85,53 @@ QVariant QDBusAbstractInterfacePrivate::property(const QMetaProperty &mp) const
         lastError = QDBusError(QDBusError::InvalidSignature,
                                errmsg.arg(QLatin1String(reply.at(0).typeName()),
                                           QLatin1String(mp.typeName()),
-                                          interface, QString::fromUtf8(mp.name())));
+                                          interface, name));
     }
 
     return QVariant();
 }
 
+QVariantMap QDBusAbstractInterfacePrivate::properties(const QMetaObject *mo, int sendMode) const
+{
+    // read all the properties in one call
+    QDBusMessage msg = QDBusMessage::methodCall(service, path,
+                                                QLatin1String(DBUS_INTERFACE_PROPERTIES),
+                                                QLatin1String("GetAll"));
+    msg << interface;
+    QDBusMessage reply = connp->sendWithReply(msg, sendMode);
+
+    QVariantMap retval;
+    if (reply.type() != QDBusMessage::ReplyMessage) {
+        lastError = reply;
+        return retval;
+    }
+    if (reply.signature() != QLatin1String("a{sv}")) {
+        QString errmsg = QLatin1String("Invalid signature `%1' in return from call to "
+                                       DBUS_INTERFACE_PROPERTIES);
+        lastError = QDBusError(QDBusError::InvalidSignature, errmsg.arg(reply.signature()));
+        return retval;
+    }
+
+    const QVariantMap values = reply.at(0).toMap();
+    QVariantMap::ConstIterator it = values.constBegin();
+    for ( ; it != values.constEnd(); ++it) {
+        QVariant value = QDBusTypeHelper<QVariant>::fromVariant(it.value());
+
+        // properties we know must have the right type; the others are taken as they come
+        int idx = mo->indexOfProperty(it.key().toUtf8());
+        if (idx == -1 || fixPropertyValue(mo->property(idx), value))
+            retval.insert(it.key(), value);
+    }
+
+    if (propertyCacheEnabled) {
+        // refresh the cache with the snapshot
+        for (it = retval.constBegin(); it != retval.constEnd(); ++it)
+            propertyCache.insert(it.key(), it.value());
+    }
+
+    return retval;
+}
+
 void QDBusAbstractInterfacePrivate::setProperty(const QMetaProperty &mp, const QVariant &value)
 {
     // send the value
@@ -80,10 +142,30 @@ void QDBusAbstractInterfacePrivate::setProperty(const QMetaProperty &mp, const Q
     msg << interface << QString::fromUtf8(mp.name()) << value;
     QDBusMessage reply = connp->sendWithReply(msg, QDBusConnection::NoUseEventLoop);
 
+    // the remote object may have adjusted the value; read it again next time
+    propertyCache.remove(QString::fromUtf8(mp.name()));
+
     if (reply.type() != QDBusMessage::ReplyMessage)
         lastError = reply;
 }    
 
+void QDBusAbstractInterfacePrivate::_q_propertyChanged(const QDBusMessage &msg)
+{
+    if (msg.name() != propertyChangeSignal)
+        return;
+
+    // if the signal carries the name of one of our properties, drop only that entry
+    if (!msg.isEmpty() && msg.at(0).type() == QVariant::String) {
+        QString name = msg.at(0).toString();
+        if (q_ptr->metaObject()->indexOfProperty(name.toUtf8()) != -1) {
+            propertyCache.remove(name);
+            return;
+        }
+    }
+
+    propertyCache.clear();
+}
+
 /*!
     \class QDBusAbstractInterface
     \brief Base class for all D-Bus interfaces in the QtDBus binding, allowing access to remote interfaces.
@@ -139,6 +221,9 @@ QDBusAbstractInterface::~QDBusAbstractInterface()
 
     Note: when dealing with remote objects, it is not always possible to determine if it
     exists when creating a QDBusInterface or QDBusInterfacePtr object.
+
+    An interface created by QDBusConnection::findInterfaceAsync() is not valid until it has
+    emitted interfaceReady().
 */
 bool QDBusAbstractInterface::isValid() const
 {
@@ -186,6 +271,123 @@ QDBusError QDBusAbstractInterface::lastError() const
     return d_func()->lastError;
 }
 
+/*!
+    Reads all the properties of this interface from the remote object in a single call and
+    returns a snapshot of their values, indexed by the property names. The \a mode parameter
+    specifies how the call should be placed; NoWaitForReply and AutoDetect are treated like
+    NoUseEventLoop.
+
+    Values of properties known to this interface that don't have the expected type are left out.
+    If the call failed, this function returns an empty map and lastError() is set to the error.
+
+    This is much faster than reading the properties one by one if you need more than a few of
+    them, since reading each property is a separate call.
+*/
+QVariantMap QDBusAbstractInterface::allProperties(CallMode mode) const
+{
+    return d_func()->properties(metaObject(), mode == UseEventLoop ?
+                                QDBusConnection::UseEventLoop : QDBusConnection::NoUseEventLoop);
+}
+
+/*!
+    Enables the client-side property cache if \a enable is true and disables it otherwise.
+
+    With the cache enabled, the first read of a property places the call to the remote object
+    and later reads return the value received then, without any D-Bus traffic. allProperties()
+    fills the cache with all the values it reads. Writing a property drops its entry, so the next
+    read fetches it again.
+
+    Cached values become stale when the remote object changes them. Use
+    setPropertyChangeSignal() to have the cache cleared automatically or call
+    invalidatePropertyCache() when you know the values changed.
+
+    The cache is disabled by default. Disabling it discards its contents.
+
+    \sa isPropertyCacheEnabled(), propertyCacheHits(), propertyCacheMisses()
+*/
+void QDBusAbstractInterface::setPropertyCacheEnabled(bool enable)
+{
+    Q_D(QDBusAbstractInterface);
+    d->propertyCacheEnabled = enable;
+    if (!enable)
+        d->propertyCache.clear();
+}
+
+/*!
+    Returns true if the client-side property cache is enabled.
+
+    \sa setPropertyCacheEnabled()
+*/
+bool QDBusAbstractInterface::isPropertyCacheEnabled() const
+{
+    return d_func()->propertyCacheEnabled;
+}
+
+/*!
+    Sets the signal of this interface that the remote object emits when its properties change to
+    \a name. Whenever the signal arrives, the cached property values are discarded. If the first
+    argument of the signal is a string naming a property of this interface, only the value of
+    that property is discarded.
+
+    Pass an empty string to stop listening. This function has no effect on the cache unless it is
+    enabled.
+
+    \sa propertyChangeSignal(), setPropertyCacheEnabled()
+*/
+void QDBusAbstractInterface::setPropertyChangeSignal(const QString &name)
+{
+    Q_D(QDBusAbstractInterface);
+    if (d->propertyChangeSignal == name)
+        return;
+
+    d->connp->replaceSignalHook(d->service, d->path, d->interface, d->propertyChangeSignal, name,
+                                this, SLOT(_q_propertyChanged(QDBusMessage)));
+    d->propertyChangeSignal = name;
+}
+
+/*!
+    Returns the name of the signal that invalidates the property cache, or an empty string if
+    none was set.
+
+    \sa setPropertyChangeSignal()
+*/
+QString QDBusAbstractInterface::propertyChangeSignal() const
+{
+    return d_func()->propertyChangeSignal;
+}
+
+/*!
+    Discards all the values in the property cache, so that the next read of each property places
+    a call to the remote object again.
+
+    \sa setPropertyCacheEnabled()
+*/
+void QDBusAbstractInterface::invalidatePropertyCache()
+{
+    d_func()->propertyCache.clear();
+}
+
+/*!
+    Returns the number of property reads that were answered from the property cache.
+
+    \sa propertyCacheMisses(), setPropertyCacheEnabled()
+*/
+int QDBusAbstractInterface::propertyCacheHits() const
+{
+    return d_func()->propertyCacheHits;
+}
+
+/*!
+    Returns the number of property reads that had to place a call to the remote object while the
+    property cache was enabled.
+
+    \sa propertyCacheHits(), setPropertyCacheEnabled()
+*/
+int QDBusAbstractInterface::propertyCacheMisses() const
+{
+    return d_func()->propertyCacheMisses;
+}
+
 /*!
     Places a call to the remote method specified by \a method on this interface, using \a args as
     arguments. This function returns the message that was received as a reply, which can be a normal
@@ -284,14 +486,42 @@ bool QDBusAbstractInterface::callWithArgs(const QString &method, QObject *receiv
         sig = method.mid(pos + 1);
     }
 
+    d->lastError = 0;           // clear
+    if (d->isPending) {
+        // wait until we know where to send it
+        QDBusAbstractInterfacePrivate::QueuedCall call;
+        call.method = m;
+        call.signature = sig;
+        call.args = args;
+        call.receiver = receiver;
+        call.slot = slot;
+        d->queuedCalls << call;
+        return true;
+    }
+
     QDBusMessage msg = QDBusMessage::methodCall(service(), path(), interface(), m);
     msg.setSignature(sig);
     msg.QList<QVariant>::operator=(args);
 
-    d->lastError = 0;           // clear
     return d->conn.sendWithReplyAsync(msg, receiver, slot);
 }
 
+void QDBusAbstractInterfacePrivate::sendQueuedCalls()
+{
+    // called once the interface has been looked up, valid or not:
+    // an invalid interface gets the errors from the bus
+    isPending = false;
+
+    QList<QueuedCall> calls = queuedCalls;
+    queuedCalls.clear();
+    foreach (const QueuedCall &call, calls) {
+        QDBusMessage msg = QDBusMessage::methodCall(service, path, interface, call.method);
+        msg.setSignature(call.signature);
+        msg.QList<QVariant>::operator=(call.args);
+        conn.sendWithReplyAsync(msg, call.receiver, call.slot.constData());
+    }
+}
+
 /*!
     \internal
     Catch signal connections.
@@ -350,6 +580,80 @@ void QDBusAbstractInterface::internalPropSet(const char *propname, const QVarian
         qWarning("QDBusAbstractInterface::internalPropGet called with unknown property '%s'", propname);
 }
 
+/*!
+    \internal
+    Returns a new method call message for the method \a method on this interface. The caller
+    appends the arguments and passes the message to internalCallWithReply() or internalSend().
+
+    This is used by the code generated by dbusidl2cpp -s, which marshalls the arguments itself.
+*/
+DBusMessage *QDBusAbstractInterface::internalMethodCall(const char *method) const
+{
+    Q_D(const QDBusAbstractInterface);
+
+    QByteArray service = d->service.toUtf8();
+    QByteArray path = d->path.toUtf8();
+    QByteArray interface = d->interface.toUtf8();
+    return dbus_message_new_method_call(service.isEmpty() ? 0 : service.constData(),
+                                        path.constData(),
+                                        interface.isEmpty() ? 0 : interface.constData(),
+                                        method);
+}
+
+/*!
+    \internal
+    Sends the method call \a message, which must have been created by internalMethodCall(), and
+    blocks waiting for the reply. This function takes ownership of \a message.
+
+    Returns the reply, which the caller must unref, or 0 if the call failed. In that case,
+    lastError() is set to the error.
+*/
+DBusMessage *QDBusAbstractInterface::internalCallWithReply(DBusMessage *message)
+{
+    Q_D(QDBusAbstractInterface);
+
+    if (!message)
+        return 0;
+    if (!d->connp || !d->connp->connection) {
+        dbus_message_unref(message);
+        d->lastError = QDBusError(QDBusError::Disconnected,
+                                  QLatin1String("Not connected to D-Bus server"));
+        return 0;
+    }
+
+    DBusMessage *reply = d->connp->sendWithReply(message, QDBusConnection::NoUseEventLoop);
+    dbus_message_unref(message);
+
+    if (!reply) {
+        d->lastError = d->connp->lastError;
+    } else if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+        d->lastError = QDBusMessage::fromDBusMessage(reply, d->conn);
+        dbus_message_unref(reply);
+        reply = 0;
+    } else {
+        d->lastError = QDBusError();
+    }
+    return reply;
+}
+
+/*!
+    \internal
+    Sends the method call \a message, which must have been created by internalMethodCall(), without
+    waiting for a reply. This function takes ownership of \a message.
+*/
+void QDBusAbstractInterface::internalSend(DBusMessage *message)
+{
+    Q_D(QDBusAbstractInterface);
+
+    if (!message)
+        return;
+    if (d->connp && d->connp->connection) {
+        dbus_message_set_no_reply(message, true);
+        dbus_connection_send(d->connp->connection, message, 0);
+    }
+    dbus_message_unref(message);
+}
+
 /*!
     \overload
     \fn QDBusMessage QDBusAbstractInterface::call(const QString &method)
@@ -389,4 +693,12 @@ void QDBusAbstractInterface::internalPropSet(const char *propname, const QVarian
              placed with call().
 */
 
+/*!
+    \fn void QDBusAbstractInterface::interfaceReady()
+
+    This signal is emitted when an interface created by QDBusConnection::findInterfaceAsync() has
+    finished looking up the remote object. Check isValid() and lastError() to find out if it
+    succeeded. Asynchronous calls placed before this signal are sent just before it is emitted.
+*/
+
 #include "qdbusabstractinterface.moc"
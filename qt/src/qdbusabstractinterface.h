@@ -61,6 +61,16 @@ public:
 
     QDBusError lastError() const;
 
+    QVariantMap allProperties(CallMode mode = NoUseEventLoop) const;
+
+    void setPropertyCacheEnabled(bool enable);
+    bool isPropertyCacheEnabled() const;
+    void setPropertyChangeSignal(const QString &name);
+    QString propertyChangeSignal() const;
+    void invalidatePropertyCache();
+    int propertyCacheHits() const;
+    int propertyCacheMisses() const;
+
     QDBusMessage callWithArgs(const QString &method, const QList<QVariant> &args = QList<QVariant>(),
                               CallMode mode = AutoDetect);
     bool callWithArgs(const QString &method, QObject *receiver, const char *slot,
@@ -239,12 +249,18 @@ public:
     }
 #endif
 
+signals:
+    void interfaceReady();
+
 protected:
     QDBusAbstractInterface(QDBusAbstractInterfacePrivate *);
     void connectNotify(const char *signal);
     void disconnectNotify(const char *signal);
     QVariant internalPropGet(const char *propname) const;
     void internalPropSet(const char *propname, const QVariant &value);
+    DBusMessage *internalMethodCall(const char *method) const;
+    DBusMessage *internalCallWithReply(DBusMessage *message);
+    void internalSend(DBusMessage *message);
 
 private:
     friend class QDBusInterface;
@@ -252,6 +268,7 @@ private:
 
     Q_DECLARE_PRIVATE(QDBusAbstractInterface)
     Q_DISABLE_COPY(QDBusAbstractInterface)
+    Q_PRIVATE_SLOT(d_func(), void _q_propertyChanged(const QDBusMessage &))
 };
 
 #endif
@@ -37,6 +37,8 @@
 #ifndef QDBUSABSTRACTINTERFACEPRIVATE_H
 #define QDBUSABSTRACTINTERFACEPRIVATE_H
 
+#include <QtCore/qpointer.h>
+
 #include "qdbusabstractinterface.h"
 #include "qdbusconnection.h"
 #include "qdbuserror.h"
@@ -56,16 +58,42 @@ public:
     QString interface;
     mutable QDBusError lastError;
     bool isValid;
+    bool isPending;             // still being looked up, see QDBusConnection::findInterfaceAsync
+
+    // asynchronous calls placed while isPending
+    struct QueuedCall
+    {
+        QString method;
+        QString signature;
+        QList<QVariant> args;
+        QPointer<QObject> receiver;
+        QByteArray slot;
+    };
+    QList<QueuedCall> queuedCalls;
+
+    // client-side property cache, see QDBusAbstractInterface::setPropertyCacheEnabled
+    bool propertyCacheEnabled;
+    QString propertyChangeSignal;
+    mutable QVariantMap propertyCache;
+    mutable int propertyCacheHits;
+    mutable int propertyCacheMisses;
 
     inline QDBusAbstractInterfacePrivate(const QDBusConnection& con, QDBusConnectionPrivate *conp,
                                          const QString &serv, const QString &p, const QString &iface)
-        : conn(con), connp(conp), service(serv), path(p), interface(iface), isValid(true)
+        : conn(con), connp(conp), service(serv), path(p), interface(iface), isValid(true),
+          isPending(false), propertyCacheEnabled(false), propertyCacheHits(0),
+          propertyCacheMisses(0)
     { }
     virtual ~QDBusAbstractInterfacePrivate() { }
 
     // these functions do not check if the property is valid
     QVariant property(const QMetaProperty &mp) const;
+    QVariantMap properties(const QMetaObject *mo, int sendMode) const;
     void setProperty(const QMetaProperty &mp, const QVariant &value);
+
+    void sendQueuedCalls();
+
+    void _q_propertyChanged(const QDBusMessage &msg);
 };
 
 
@@ -192,6 +192,11 @@ void QDBusConnectionManager::setConnection(const QString &name, QDBusConnectionP
 
     \value ExportChildObjects                   export this object's child objects
 
+    \value ConcurrentCalls                      deliver calls to this object in a pool of worker
+                                                threads owned by the connection, instead of the
+                                                thread the object lives in; the object must be
+                                                thread-safe
+
     \warning It is currently not possible to export signals from objects. If you pass the flag
     ExportSignals or ExportAllSignals, the registerObject() function will print a warning.
 
@@ -403,6 +408,51 @@ QDBusMessage QDBusConnection::sendWithReply(const QDBusMessage &message, WaitMod
     return d->sendWithReply(message, mode);
 }
 
+/*!
+    Sends all the method calls in \a messages over this connection and blocks, waiting for the
+    replies. All the calls are queued before waiting for the first reply, so a batch of calls costs
+    about one round-trip to the bus instead of one per call.
+
+    Returns the replies in the same order as \a messages. Each reply is either of type
+    QDBusMessage::ReplyMessage or QDBusMessage::ErrorMessage; a call that could not be sent gets an
+    error reply too. lastError() is set to the first error in the batch.
+
+    \warning If \a mode is \c UseEventLoop, this function will reenter the Qt event loop in order to
+             wait for the replies, with the same consequences as sendWithReply().
+
+    \sa sendWithRepliesAsync()
+*/
+QList<QDBusMessage> QDBusConnection::sendWithReplies(const QList<QDBusMessage> &messages,
+                                                     WaitMode mode) const
+{
+    if (!d || !d->connection)
+        return QList<QDBusMessage>();
+    return d->sendWithReplies(messages, mode);
+}
+
+/*!
+    Sends all the method calls in \a messages over this connection and returns immediately after
+    queueing them. Each reply is delivered to the slot \a slot in object \a receiver as it is
+    received; use QDBusMessage::replySerialNumber() in the slot to match it with its call.
+
+    Returns the identifications of the messages that were sent, in the same order as \a messages.
+    An entry is 0 if that message could not be sent.
+
+    \sa sendWithReplyAsync(), sendWithReplies()
+*/
+QList<int> QDBusConnection::sendWithRepliesAsync(const QList<QDBusMessage> &messages,
+                                                 QObject *receiver, const char *slot) const
+{
+    if (!d || !d->connection) {
+        QList<int> serials;
+        for (int i = 0; i < messages.count(); ++i)
+            serials << 0;
+        return serials;
+    }
+
+    return d->sendWithRepliesAsync(messages, receiver, slot);
+}
+
 /*!
     Connects the signal specified by the \a service, \a path, \a interface and \a name parameters to
     the slot \a slot in object \a receiver. The arguments \a service and \a path can be empty,
@@ -443,28 +493,16 @@ bool QDBusConnection::connect(const QString &service, const QString &path, const
 
     // check the slot
     QDBusConnectionPrivate::SignalHook hook;
-    QString key;
     hook.signature = signature;
-    if (!d->prepareHook(hook, key, source, path, interface, name, receiver, slot, 0, false))
+    if (!d->prepareHook(hook, source, path, interface, name, receiver, slot, 0, false))
         return false;           // don't connect
 
     // avoid duplicating:
-    QWriteLocker locker(&d->lock);
-    QDBusConnectionPrivate::SignalHookHash::ConstIterator it = d->signalHooks.find(key);
-    for ( ; it != d->signalHooks.constEnd() && it.key() == key; ++it) {
-        const QDBusConnectionPrivate::SignalHook &entry = it.value();
-        if (entry.sender == hook.sender &&
-            entry.path == hook.path &&
-            entry.signature == hook.signature &&
-            entry.obj == hook.obj &&
-            entry.midx == hook.midx) {
-            // no need to compare the parameters if it's the same slot
-            return true;        // already there
-        }
-    }
+    QWriteLocker locker(&d->signalHooksLock);
+    if (d->hasSignalHook(hook))
+        return true;            // already there
 
-
-    d->connectSignal(key, hook);
+    d->connectSignal(hook);
     return true;
 }
 
@@ -478,6 +516,12 @@ bool QDBusConnection::connect(const QString &service, const QString &path, const
 
     You cannot register an object as a child object of an object that was registered with
     QDBusConnection::ExportChildObjects.
+
+    Calls to the object are delivered in the thread the object lives in, so that thread must be
+    running an event loop. Objects that live in different threads are served in parallel. If
+    \a options contains QDBusConnection::ConcurrentCalls, the calls are instead spread over
+    the connection's worker threads, so that several calls to the same object can run at the
+    same time.
 */
 bool QDBusConnection::registerObject(const QString &path, QObject *object, RegisterOptions options)
 {
@@ -500,6 +544,9 @@ bool QDBusConnection::registerObject(const QString &path, QObject *object, Regis
     QDBusConnectionPrivate::ObjectTreeNode *node = &d->rootNode;
     int i = 1;
     while (node) {
+        // the introspection of every node on the way may change
+        node->invalidateIntrospection();
+
         if (pathComponents.count() == i) {
             // this node exists
             // consider it free if there's no object here and the user is not trying to
@@ -566,6 +613,8 @@ void QDBusConnection::unregisterObject(const QString &path, UnregisterMode mode)
 
     // find the object
     while (node) {
+        node->invalidateIntrospection();
+
         if (pathComponents.count() == i) {
             // found it
             node->obj = 0;
@@ -618,6 +667,39 @@ QDBusInterface *QDBusConnection::findInterface(const QString& service, const QSt
     return retval;
 }
 
+/*!
+    Returns a dynamic QDBusInterface associated with the interface \a interface on object at path \a
+    path on service \a service, like findInterface(), but without blocking.
+
+    The interface is returned immediately and is not valid yet: it looks up the owner of \a service
+    and introspects the remote object in the background, and emits
+    QDBusAbstractInterface::interfaceReady() when it is done. Many interfaces can be looked up in
+    parallel this way. Asynchronous calls placed on it in the mean time are queued and sent when
+    the lookup finishes.
+
+    The same ownership rules as findInterface() apply to the returned object.
+*/
+QDBusInterface *QDBusConnection::findInterfaceAsync(const QString& service, const QString& path,
+                                                    const QString& interface)
+{
+    Q_ASSERT_X(QDBusUtil::isValidBusName(service),
+               "QDBusConnection::findInterfaceAsync", "Invalid service name");
+    Q_ASSERT_X(QDBusUtil::isValidObjectPath(path),
+               "QDBusConnection::findInterfaceAsync", "Invalid object path given");
+    Q_ASSERT_X(interface.isEmpty() || QDBusUtil::isValidInterfaceName(interface),
+               "QDBusConnection::findInterfaceAsync", "Invalid interface name");
+    if (!d)
+        return 0;
+
+    QDBusInterfacePrivate *p = d->findInterfaceAsync(service, path, interface);
+    QDBusInterface *retval = new QDBusInterface(p);
+    retval->setParent(d);
+
+    QDBusInterfaceLoader *loader = new QDBusInterfaceLoader(retval, p);
+    loader->start();
+    return retval;
+}
+
 /*!
     \fn QDBusConnection::findInterface(const QString &service, const QString &path)
     Returns an interface of type \c Interface associated with the object on path \a path at service
@@ -27,6 +27,7 @@
 
 #include "qdbusmacros.h"
 #include <QtCore/qstring.h>
+#include <QtCore/qlist.h>
 
 class QDBusAbstractInterfacePrivate;
 class QDBusInterface;
@@ -54,7 +55,9 @@ public:
         ExportAllProperties = 0x440,
         ExportAllContents = 0xff0,
 
-        ExportChildObjects = 0x1000
+        ExportChildObjects = 0x1000,
+
+        ConcurrentCalls = 0x10000
     };
     enum UnregisterMode {
         UnregisterNode,
@@ -77,6 +80,10 @@ public:
     QDBusMessage sendWithReply(const QDBusMessage &message, WaitMode mode = NoUseEventLoop) const;
     int sendWithReplyAsync(const QDBusMessage &message, QObject *receiver,
                            const char *slot) const;
+    QList<QDBusMessage> sendWithReplies(const QList<QDBusMessage> &messages,
+                                        WaitMode mode = NoUseEventLoop) const;
+    QList<int> sendWithRepliesAsync(const QList<QDBusMessage> &messages, QObject *receiver,
+                                    const char *slot) const;
 
     bool connect(const QString &service, const QString &path, const QString &interface,
                  const QString &name, QObject *receiver, const char *slot);
@@ -92,6 +99,8 @@ public:
     inline Interface *findInterface(const QString &service, const QString &path);
     QDBusInterface *findInterface(const QString& service, const QString& path,
                                   const QString& interface = QString());
+    QDBusInterface *findInterfaceAsync(const QString& service, const QString& path,
+                                       const QString& interface = QString());
 
     QDBusBusService *busService() const;
 
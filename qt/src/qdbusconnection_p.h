@@ -52,6 +52,7 @@
 #include <dbus/dbus.h>
 
 #include "qdbusmessage.h"
+#include "qdbusabstractadaptor.h"
 
 class QDBusMessage;
 class QSocketNotifier;
@@ -63,6 +64,7 @@ class QDBusInterfacePrivate;
 struct QDBusMetaObject;
 class QDBusAbstractInterface;
 class QDBusBusService;
+class QThread;
 
 class QDBusConnectionPrivate: public QObject
 {
@@ -82,10 +84,55 @@ public:
     struct SignalHook
     {
         inline SignalHook() : obj(0), midx(-1) { }
-        QString sender, path, signature;
+        QString sender, path, signature, interface, member;
         QObject* obj;
         int midx;
         QList<int> params;
+
+        // no need to compare the parameters if it's the same slot
+        inline bool operator==(const SignalHook &other) const
+        {
+            return obj == other.obj && midx == other.midx && sender == other.sender &&
+                path == other.path && signature == other.signature &&
+                interface == other.interface && member == other.member;
+        }
+    };
+    typedef QList<SignalHook> SignalHookList;
+
+    // all the hooks for one interned (interface, member) pair, indexed again
+    // by path and sender so that delivering a signal doesn't look at hooks
+    // for other objects
+    struct SignalHookBucket
+    {
+        QHash<QByteArray, SignalHookList> byPath;   // hooks with a path, with or without a sender
+        QHash<QByteArray, SignalHookList> bySender; // hooks with a sender but no path
+        SignalHookList any;                         // hooks with neither
+
+        inline bool isEmpty() const
+        { return byPath.isEmpty() && bySender.isEmpty() && any.isEmpty(); }
+    };
+
+    // an interned interface or member name, referenced once by each hook using it
+    struct SignalAtom
+    {
+        inline SignalAtom() : id(0), ref(0) { }
+        int id;
+        int ref;
+    };
+
+    // GetNameOwner calls in progress for one name; see getNameOwner
+    struct NameOwnerQuery
+    {
+        inline NameOwnerQuery() : count(0), changed(false) { }
+        int count;
+        bool changed;           // NameOwnerChanged arrived while they were running
+    };
+
+    // the children of an object exported with ExportChildObjects, by name; see exportedChild
+    struct ChildIndex
+    {
+        QObjectList children;               // the list the index was built from
+        QHash<QString, QObject *> byName;   // only valid while children is current
     };
 
     struct ObjectTreeNode
@@ -99,7 +146,7 @@ public:
             { return name < other; }
         };
 
-        inline ObjectTreeNode() : obj(0), flags(0) { }
+        inline ObjectTreeNode() : obj(0), flags(0), introspectionRevision(-1) { }
         inline ~ObjectTreeNode() { clear(); }
         inline void clear()
         {
@@ -109,18 +156,31 @@ public:
             }
             children.clear();
         }
+        inline void invalidateIntrospection()
+        {
+            introspection.clear();
+            introspectionData.clear();
+        }
 
         QObject* obj;
         int flags;
         QVector<Data> children;
+
+        // the reply to Introspect, cached by qDBusIntrospectObject
+        mutable QString introspection;
+        mutable QByteArray introspectionData;
+        mutable int introspectionRevision;
     };
 
 public:
     // typedefs
     typedef QMultiHash<int, Watcher> WatcherHash;
     typedef QHash<int, DBusTimeout *> TimeoutHash;
-    typedef QMultiHash<QString, SignalHook> SignalHookHash;
+    typedef QHash<quint64, SignalHookBucket> SignalHookHash;
+    typedef QHash<QByteArray, SignalAtom> SignalAtomHash;
     typedef QHash<QString, QDBusMetaObject* > MetaObjectHash;
+    typedef QHash<QString, QString> NameOwnerHash;
+    typedef QHash<QString, NameOwnerQuery> NameOwnerQueryHash;
     
 public:
     // public methods
@@ -137,32 +197,58 @@ public:
     QString getNameOwner(const QString &service);    
 
     int send(const QDBusMessage &message) const;
+    int sendStringReply(const QDBusMessage &message, const QByteArray &utf8) const;
     QDBusMessage sendWithReply(const QDBusMessage &message, int mode);
+    DBusMessage *sendWithReply(DBusMessage *message, int mode, int timeout = -1);
     int sendWithReplyAsync(const QDBusMessage &message, QObject *receiver,
                            const char *method);
-    void connectSignal(const QString &key, const SignalHook &hook);
+    int sendWithReplyAsync(const QDBusMessage &message, QObject *receiver,
+                           int slotIdx, const QList<int> &metaTypes);
+    QList<QDBusMessage> sendWithReplies(const QList<QDBusMessage> &messages, int mode);
+    QList<int> sendWithRepliesAsync(const QList<QDBusMessage> &messages, QObject *receiver,
+                                    const char *method);
+    void waitForReply(DBusPendingCall *pending, int sendMode);
+    bool hasSignalHook(const SignalHook &hook);
+    void connectSignal(const SignalHook &hook);
+    bool disconnectSignal(const SignalHook &hook);
     void registerObject(const ObjectTreeNode *node);
     void connectRelay(const QString &service, const QString &path, const QString &interface,
                       QDBusAbstractInterface *receiver, const char *signal);
     void disconnectRelay(const QString &service, const QString &path, const QString &interface,
                          QDBusAbstractInterface *receiver, const char *signal);
+    void retargetSignalHooks(QObject *receiver, const QString &oldSender, const QString &newSender);
+    void replaceSignalHook(const QString &service, const QString &path, const QString &interface,
+                           const QString &oldName, const QString &newName,
+                           QObject *receiver, const char *slot);
     
-    bool handleSignal(const QString &key, const QDBusMessage &msg);
-    bool handleSignal(const QDBusMessage &msg);
+    bool handleSignal(DBusMessage *message, QDBusMessage &msg);
     bool handleObjectCall(const QDBusMessage &message);
     bool handleError();
 
     bool activateSignal(const SignalHook& hook, const QDBusMessage &msg);
     bool activateCall(QObject* object, int flags, const QDBusMessage &msg);
+    bool activateStaticCall(QDBusAbstractAdaptor *adaptor, QDBusAdaptorDispatcher dispatcher,
+                            int flags, const QDBusMessage &msg);
     bool activateObject(const ObjectTreeNode *node, const QDBusMessage &msg);
     bool activateInternalFilters(const ObjectTreeNode *node, const QDBusMessage &msg);
 
     void postCallDeliveryEvent(CallDeliveryEvent *data);
+    QObject *callDeliverer(const CallDeliveryEvent *data);
     CallDeliveryEvent *postedCallDeliveryEvent();
     void deliverCall(const CallDeliveryEvent &data) const;
+    void dropCall(const QDBusMessage &msg) const;
 
     QDBusInterfacePrivate *findInterface(const QString &service, const QString &path,
                                          const QString &interface);
+    QDBusInterfacePrivate *findInterfaceAsync(const QString &service, const QString &path,
+                                              const QString &interface);
+    QDBusMetaObject *cachedMetaObject(const QString &interface);
+    QDBusMetaObject *createMetaObject(const QString &interface, const QString &xml,
+                                      QDBusError &error);
+    QObject *exportedChild(QObject *parent, const QString &name);
+    QString cachedNameOwner(const QString &service);
+    void startNameOwnerQuery(const QString &service);
+    void cacheNameOwner(const QString &service, const QString &owner);
 
 protected:
     virtual void customEvent(QEvent *event);
@@ -170,6 +256,12 @@ protected:
 private:
     QDBusMetaObject *findMetaObject(const QString &service, const QString &path,
                                     const QString &interface);        
+    int internSignalAtom(const QString &name);
+    int findSignalAtom(const char *name) const;
+    void releaseSignalAtom(const QString &name);
+    SignalHookList *signalHookList(const SignalHook &hook, bool create);
+    void removeEmptySignalHookList(const SignalHook &hook);
+    void updateNameOwner(DBusMessage *message);
 
 public slots:
     // public slots
@@ -178,6 +270,8 @@ public slots:
     void socketWrite(int);
     void objectDestroyed(QObject *o);
     void relaySignal(QObject *obj, const char *interface, const char *name, const QVariantList &args);
+    void threadFinished();
+    void childIndexOwnerDestroyed(QObject *o);
 
 public:
     // public member variables
@@ -187,7 +281,15 @@ public:
     QDBusError lastError;
 
     QAtomic ref;
+
+    // These locks are never held at the same time, so that dispatching a message never waits
+    // for an object being registered or a meta object being built:
+    //  - lock protects the connection itself and the object tree (rootNode)
+    //  - signalHooksLock protects signalHooks and signalAtoms
+    //  - metaObjectLock protects cachedMetaObjects
     QReadWriteLock lock;
+    QReadWriteLock signalHooksLock;
+    QReadWriteLock metaObjectLock;
     ConnectionMode mode;
     DBusConnection *connection;
     DBusServer *server;
@@ -196,20 +298,37 @@ public:
     WatcherHash watchers;
     TimeoutHash timeouts;
     SignalHookHash signalHooks;
+    SignalAtomHash signalAtoms;
+    int lastSignalAtom;
     QList<DBusTimeout *> pendingTimeouts;
 
     ObjectTreeNode rootNode;
     MetaObjectHash cachedMetaObjects;
 
+    // children of the objects exported with ExportChildObjects, by name; see exportedChild
+    QMutex childIndexMutex;
+    QHash<QObject *, ChildIndex> childIndexes; // protected by the childIndexMutex mutex
+
+    QMutex nameOwnerMutex;
+    NameOwnerHash nameOwners;   // protected by the nameOwnerMutex mutex
+    NameOwnerQueryHash nameOwnerQueries; // protected by the nameOwnerMutex mutex
+
     QMutex callDeliveryMutex;
     CallDeliveryEvent *callDeliveryState; // protected by the callDeliveryMutex mutex
 
+    // objects that deliver calls in threads other than ours, see callDeliverer
+    QMutex delivererMutex;
+    QHash<QThread *, QObject *> deliverers; // protected by the delivererMutex mutex
+    QList<QThread *> workerThreads;         // protected by the delivererMutex mutex
+    int nextWorkerThread;                   // protected by the delivererMutex mutex
+
 public:
     // static methods
     static int messageMetaType;
     static int registerMessageMetaType();
+    static void demarshallArguments(QDBusMessage &msg);
     static int findSlot(QObject *obj, const QByteArray &normalizedName, QList<int>& params);
-    static bool prepareHook(QDBusConnectionPrivate::SignalHook &hook, QString &key,
+    static bool prepareHook(QDBusConnectionPrivate::SignalHook &hook,
                             const QString &service, const QString &path,
                             const QString &interface, const QString &name,
                             QObject *receiver, const char *signal, int minMIdx,
@@ -218,16 +337,6 @@ public:
     static void messageResultReceived(DBusPendingCall *, void *);
 };
 
-class QDBusReplyWaiter: public QEventLoop
-{
-    Q_OBJECT
-public:
-    QDBusMessage replyMsg;
-
-public slots:
-    void reply(const QDBusMessage &msg);
-};
-
 // in qdbusmisc.cpp
 extern int qDBusParametersForMethod(const QMetaMethod &mm, QList<int>& metaTypes);
 extern int qDBusNameToTypeId(const char *name);
@@ -235,10 +344,11 @@ extern bool qDBusCheckAsyncTag(const char *tag);
 
 // in qdbusinternalfilters.cpp
 extern QString qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node);
-extern void qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node,
-                                  const QDBusMessage &msg);
+extern QByteArray qDBusIntrospectObjectData(const QDBusConnectionPrivate::ObjectTreeNode *node);
 extern void qDBusPropertyGet(const QDBusConnectionPrivate::ObjectTreeNode *node,
                              const QDBusMessage &msg);
+extern void qDBusPropertyGetAll(const QDBusConnectionPrivate::ObjectTreeNode *node,
+                                const QDBusMessage &msg);
 extern void qDBusPropertySet(const QDBusConnectionPrivate::ObjectTreeNode *node,
                              const QDBusMessage &msg);
 
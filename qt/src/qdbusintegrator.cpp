@@ -29,11 +29,14 @@
 #include <qobject.h>
 #include <qsocketnotifier.h>
 #include <qstringlist.h>
+#include <qthread.h>
 #include <qtimer.h>
 
 #include "qdbusconnection_p.h"
 #include "qdbusinterface_p.h"
+#include "qdbusmarshall_p.h"
 #include "qdbusmessage.h"
+#include "qdbusmessage_p.h"
 #include "qdbusabstractadaptor.h"
 #include "qdbusabstractadaptor_p.h"
 #include "qdbustypehelper_p.h"
@@ -63,16 +66,95 @@ class CallDeliveryEvent: public QEvent
 {
 public:
     CallDeliveryEvent()
-        : QEvent(QEvent::User), object(0), flags(0), slotIdx(-1)
+        : QEvent(QEvent::User), conn(0), object(0), dispatcher(0), flags(0), slotIdx(-1),
+          delivered(false)
         { }
 
+    ~CallDeliveryEvent()
+    {
+        // an event deleted before it was delivered was dropped from the queue of a thread that
+        // finished or of a connection being destroyed: the caller must not be left waiting
+        if (!delivered && conn)
+            conn->dropCall(message);
+    }
+
     const QDBusConnectionPrivate *conn;
     QPointer<QObject> object;
     QDBusMessage message;
     QList<int> metaTypes;
+    QDBusAdaptorDispatcher dispatcher;
 
     int flags;
     int slotIdx;
+    mutable bool delivered;
+};
+
+// Protects QDBusCallDeliverer::conn, which a connection being destroyed clears while other threads
+// may be taking events from their queues. It has to outlive the connections, so it can't be a
+// member.
+Q_GLOBAL_STATIC(QMutex, qDBusDelivererMutex)
+
+// number of threads serving the objects registered with QDBusConnection::ConcurrentCalls
+static const int WorkerThreadCount = 4;
+
+// delivers the calls posted to it in the thread it lives in
+class QDBusCallDeliverer: public QObject
+{
+public:
+    inline QDBusCallDeliverer(QDBusConnectionPrivate *c)
+        : conn(c)
+    { }
+
+    QDBusConnectionPrivate *conn; // protected by the qDBusDelivererMutex mutex
+
+protected:
+    void customEvent(QEvent *e)
+    {
+        CallDeliveryEvent *call = static_cast<CallDeliveryEvent *>(e);
+
+        // The slot may drop the last reference to the connection, for instance by closing it,
+        // so hold one while it runs. The connection is then never destroyed in the middle of
+        // a delivery and its destructor doesn't have to wait for any.
+        QMutex *mutex = qDBusDelivererMutex();
+        mutex->lock();
+        QDBusConnectionPrivate *c = conn;
+        if (!c || !refIfAlive(c)) {
+            // the connection is being destroyed: it can't send a reply anymore
+            mutex->unlock();
+            call->conn = 0;
+            return;
+        }
+        Q_ASSERT(call->conn == c);
+        mutex->unlock();
+
+        c->deliverCall(*call);
+
+        // destroy it in its own thread: this one may be a worker thread that it has to join
+        if (!c->ref.deref())
+            c->deleteLater();
+    }
+
+private:
+    // takes a reference to c unless its destructor is already running
+    static bool refIfAlive(QDBusConnectionPrivate *c)
+    {
+        for (;;) {
+            int count = c->ref;
+            if (count == 0)
+                return false;
+            if (c->ref.testAndSet(count, count + 1))
+                return true;
+        }
+    }
+};
+
+class QDBusWorkerThread: public QThread
+{
+protected:
+    void run()
+    {
+        exec();
+    }
 };
 
 static dbus_bool_t qDBusAddTimeout(DBusTimeout *timeout, void *data)
@@ -269,19 +351,30 @@ DBusHandlerResult QDBusConnectionPrivate::messageFilter(DBusConnection *connecti
     if (d->mode == QDBusConnectionPrivate::InvalidMode)
         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-    QDBusMessage amsg = QDBusMessage::fromDBusMessage(message, QDBusConnection(d->name));
-    qDebug() << "got message:" << amsg;
-
+    // signals are only converted if there's a spy hook or someone
+    // connected to them; see handleSignal
+    // the arguments are only demarshalled for the spy hooks: slots read them
+    // straight from the DBusMessage, see deliverCall
+    QDBusMessage amsg;
+    int msgType = dbus_message_get_type(message);
     const QDBusSpyHookList *list = qDBusSpyHookList();
-    for (int i = 0; i < list->size(); ++i) {
-        qDebug() << "calling the message spy hook";
-        (*(*list)[i])(amsg);
+    if (!list->isEmpty()) {
+        amsg = QDBusMessage::fromDBusMessage(message, QDBusConnection(d->name));
+        qDebug() << "got message:" << amsg;
+
+        for (int i = 0; i < list->size(); ++i) {
+            qDebug() << "calling the message spy hook";
+            (*(*list)[i])(amsg);
+        }
+    } else if (msgType != DBUS_MESSAGE_TYPE_SIGNAL) {
+        amsg = QDBusMessage::fromDBusMessageHeader(message, QDBusConnection(d->name));
+        qDebug() << "got message:" << amsg;
     }
 
     bool handled = false;
-    int msgType = dbus_message_get_type(message);
     if (msgType == DBUS_MESSAGE_TYPE_SIGNAL) {
-        handled = d->handleSignal(amsg);
+        d->updateNameOwner(message);
+        handled = d->handleSignal(message, amsg);
     } else if (msgType == DBUS_MESSAGE_TYPE_METHOD_CALL) {
         handled = d->handleObjectCall(amsg);
     }
@@ -290,15 +383,22 @@ DBusHandlerResult QDBusConnectionPrivate::messageFilter(DBusConnection *connecti
         DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
-static void huntAndDestroy(QObject *needle, QDBusConnectionPrivate::ObjectTreeNode *haystack)
+static bool huntAndDestroy(QObject *needle, QDBusConnectionPrivate::ObjectTreeNode *haystack)
 {
+    // returns true if the object was found in this sub-tree
+    bool found = false;
     foreach (const QDBusConnectionPrivate::ObjectTreeNode::Data &entry, haystack->children)
-        huntAndDestroy(needle, entry.node);
+        found |= huntAndDestroy(needle, entry.node);
 
     if (needle == haystack->obj) {
         haystack->obj = 0;
         haystack->flags = 0;
+        found = true;
     }
+
+    if (found)
+        haystack->invalidateIntrospection();
+    return found;
 }
 
 static void huntAndEmit(DBusConnection *connection, DBusMessage *msg,
@@ -433,12 +533,17 @@ static CallDeliveryEvent* prepareReply(QObject *object, int idx, const QList<int
     Q_ASSERT(object);
 
     int n = metaTypes.count() - 1;
-    if (metaTypes[n] == QDBusConnectionPrivate::messageMetaType)
+    bool takesMessage = metaTypes[n] == QDBusConnectionPrivate::messageMetaType;
+    if (takesMessage)
         --n;
 
     // check that types match
+    // the arguments haven't been demarshalled, so use the signature
+    QDBusTypeList types(msg.signature().toUtf8());
+    if (types.count() < n)
+        return 0;               // not enough arguments
     for (int i = 0; i < n; ++i)
-        if (!typesMatch(metaTypes.at(i + 1), msg.at(i).type()))
+        if (!typesMatch(metaTypes.at(i + 1), types.at(i).qvariantType()))
             return 0;           // no match
 
     // we can deliver
@@ -449,6 +554,8 @@ static CallDeliveryEvent* prepareReply(QObject *object, int idx, const QList<int
     data->message = msg;
     data->metaTypes = metaTypes;
     data->slotIdx = idx;
+    if (takesMessage)
+        QDBusConnectionPrivate::demarshallArguments(data->message);
 
     return data;
 }
@@ -471,6 +578,25 @@ bool QDBusConnectionPrivate::activateSignal(const QDBusConnectionPrivate::Signal
     return false;
 }
 
+static int findCallSlot(QObject *object, int flags, const QDBusMessage &msg,
+                        QList<int> &metaTypes)
+{
+    const QMetaObject *mo = object->metaObject();
+    QDBusTypeList typeList(msg.signature().toUtf8());
+    QByteArray memberName = msg.name().toUtf8();
+
+    // find a slot that matches according to the rules in activateCall
+    int idx = ::findSlot(mo, memberName, flags, typeList, metaTypes);
+    if (idx == -1) {
+        // try with no parameters, but with a QDBusMessage
+        idx = ::findSlot(mo, memberName, flags, QDBusTypeList(), metaTypes);
+        if (metaTypes.count() != 2 ||
+            metaTypes.at(1) != QDBusConnectionPrivate::messageMetaType)
+            return -1;
+    }
+    return idx;
+}
+
 bool QDBusConnectionPrivate::activateCall(QObject* object, int flags,
                                           const QDBusMessage &msg)
 {
@@ -502,22 +628,9 @@ bool QDBusConnectionPrivate::activateCall(QObject* object, int flags,
         return false;
 
     QList<int> metaTypes;
-    int idx;
-
-    {
-        const QMetaObject *mo = object->metaObject();
-        QDBusTypeList typeList(msg.signature().toUtf8());
-        QByteArray memberName = msg.name().toUtf8();
-
-        // find a slot that matches according to the rules above
-        idx = ::findSlot(mo, memberName, flags, typeList, metaTypes);
-        if (idx == -1) {
-            // try with no parameters, but with a QDBusMessage
-            idx = ::findSlot(mo, memberName, flags, QDBusTypeList(), metaTypes);
-            if (metaTypes.count() != 2 || metaTypes.at(1) != messageMetaType)
-                return false;
-        }
-    }
+    int idx = findCallSlot(object, flags, msg, metaTypes);
+    if (idx == -1)
+        return false;
 
     // found the slot to be called
     // prepare for the call:
@@ -532,12 +645,45 @@ bool QDBusConnectionPrivate::activateCall(QObject* object, int flags,
     call->metaTypes = metaTypes;
     call->slotIdx = idx;
 
+    // the slot gets the QDBusMessage with the arguments in it
+    if (metaTypes.contains(messageMetaType))
+        demarshallArguments(call->message);
+
     postCallDeliveryEvent(call);
 
     // ready
     return true;
 }
 
+bool QDBusConnectionPrivate::activateStaticCall(QDBusAbstractAdaptor *adaptor,
+                                                QDBusAdaptorDispatcher dispatcher,
+                                                int flags, const QDBusMessage &msg)
+{
+    // This is called by QDBusConnectionPrivate::activateObject for adaptors that were generated
+    // with static dispatch code. The generated dispatcher matches the member name and signature
+    // itself, so we don't need to look for a slot.
+    //
+    // Called with a null adaptor, the dispatcher only tells us if it would handle the call. The
+    // call itself is placed in deliverCall, in the thread the adaptor lives in.
+
+    if (!msg.d_ptr->msg)
+        return false;
+
+    bool handled = false;
+    dispatcher(0, msg.d_ptr->msg, &handled);
+    if (!handled)
+        return false;
+
+    CallDeliveryEvent *call = new CallDeliveryEvent;
+    call->object = adaptor;
+    call->flags = flags;
+    call->message = msg;
+    call->dispatcher = dispatcher;
+
+    postCallDeliveryEvent(call);
+    return true;
+}
+
 void QDBusConnectionPrivate::postCallDeliveryEvent(CallDeliveryEvent *data)
 {
     Q_ASSERT(data);
@@ -546,10 +692,70 @@ void QDBusConnectionPrivate::postCallDeliveryEvent(CallDeliveryEvent *data)
     callDeliveryMutex.lock();
     callDeliveryState = data;
 #else
-    QCoreApplication::postEvent( this, data );
+    QCoreApplication::postEvent( callDeliverer(data), data );
 #endif
 }
 
+QObject *QDBusConnectionPrivate::callDeliverer(const CallDeliveryEvent *data)
+{
+    // calls are delivered in the thread the target object lives in, or in one of our worker
+    // threads if the object asked for concurrent calls
+    QMutexLocker locker(&delivererMutex);
+
+    QThread *target;
+    if (data->flags & QDBusConnection::ConcurrentCalls) {
+        if (workerThreads.isEmpty()) {
+            for (int i = 0; i < WorkerThreadCount; ++i) {
+                QThread *worker = new QDBusWorkerThread;
+                worker->start();
+                workerThreads << worker;
+            }
+        }
+
+        nextWorkerThread = (nextWorkerThread + 1) % workerThreads.count();
+        target = workerThreads.at(nextWorkerThread);
+    } else {
+        QObject *object = data->object;
+        if (!object || object->thread() == thread())
+            return this;
+        target = object->thread();
+    }
+
+    QObject *&deliverer = deliverers[target];
+    if (!deliverer) {
+        deliverer = new QDBusCallDeliverer(this);
+        deliverer->moveToThread(target);
+        connect(target, SIGNAL(finished()), SLOT(threadFinished()), Qt::DirectConnection);
+    }
+    return deliverer;
+}
+
+void QDBusConnectionPrivate::threadFinished()
+{
+    // called in the thread that finished
+    // the calls that were still queued for it are answered with an error when their events are
+    // deleted
+    QThread *finished = qobject_cast<QThread *>(sender());
+    QMutexLocker locker(&delivererMutex);
+    QObject *deliverer = deliverers.take(finished);
+    if (deliverer) {
+        QCoreApplication::removePostedEvents(deliverer);
+        delete deliverer;
+    }
+}
+
+void QDBusConnectionPrivate::dropCall(const QDBusMessage &msg) const
+{
+    // called for a call whose event was deleted without being delivered
+    if (msg.type() != QDBusMessage::MethodCallMessage || msg.noReply() || msg.wasRepliedTo() ||
+        !connection)
+        return;
+
+    QDBusMessage reply = QDBusMessage::error(msg, QDBusError(QDBusError::Failed,
+            QLatin1String("The object's thread stopped before the call could be delivered")));
+    send(reply);
+}
+
 CallDeliveryEvent *QDBusConnectionPrivate::postedCallDeliveryEvent()
 {
     CallDeliveryEvent *e = callDeliveryState;
@@ -565,85 +771,79 @@ CallDeliveryEvent *QDBusConnectionPrivate::postedCallDeliveryEvent()
 void QDBusConnectionPrivate::deliverCall(const CallDeliveryEvent& data) const
 {
     // resume state:
-    const QList<int>& metaTypes = data.metaTypes;
-    const QDBusMessage& msg = data.message;
+    QList<int> metaTypes = data.metaTypes;
+    int slotIdx = data.slotIdx;
+    QDBusMessage msg = data.message;
+    data.delivered = true;
+
+    if (data.dispatcher) {
+        // the generated code reads the arguments and writes the reply itself
+        QObject *object = data.object;
+        DBusMessage *reply = 0;
+        bool handled = false;
+        if (object)
+            reply = data.dispatcher(static_cast<QDBusAbstractAdaptor *>(object),
+                                    msg.d_ptr->msg, &handled);
+
+        if (reply) {
+            if (!msg.noReply())
+                dbus_connection_send(connection, reply, 0);
+            dbus_message_unref(reply);
+            return;
+        }
 
-    QVarLengthArray<void *, 10> params;
-    params.reserve(metaTypes.count());
+        if (handled) {
+            // the dispatcher made the call but could not allocate the reply
+            if (!msg.noReply()) {
+                QDBusMessage error = QDBusMessage::error(msg, QDBusError(QDBusError::NoMemory,
+                        QLatin1String("Out of memory while replying to the call")));
+                send(error);
+            }
+            return;
+        }
+
+        // the dispatcher doesn't know this member and signature: look for a slot instead
+        if (object)
+            slotIdx = findCallSlot(object, data.flags, msg, metaTypes);
+        if (slotIdx == -1) {
+            if (!msg.noReply()) {
+                QDBusMessage error = QDBusMessage::error(msg, QDBusError(QDBusError::InternalError,
+                        QLatin1String("Failed to deliver message")));
+                qWarning("Internal error: Failed to deliver message");
+                send(error);
+            }
+            return;
+        }
+
+        if (metaTypes.contains(messageMetaType))
+            demarshallArguments(msg);
+    }
+
+    // the input parameters come first, up to the QDBusMessage parameter if there is one
+    int inputCount = metaTypes.indexOf(QDBusConnectionPrivate::messageMetaType, 1);
+    if (inputCount == -1)
+        inputCount = metaTypes.count();
+    --inputCount;               // the return type
 
-    QVariantList auxParameters;
     // let's create the parameter list
+    // read the arguments straight from the message into storage of the slot's types
+    QDBusSlotArguments inputArgs(inputCount);
+    int inputsRead = QDBusMarshall::messageToArguments(msg.d_ptr->msg, metaTypes, inputCount,
+                                                       inputArgs);
+    if (inputsRead == -1)
+        qFatal("Internal error: could not convert the arguments of '%s' to the slot's types",
+               qPrintable(msg.signature()));
+
+    QVarLengthArray<void *, 10> params;
+    params.reserve(metaTypes.count());
 
     // first one is the return type -- add it below
     params.append(0);
 
     // add the input parameters
-    int i;
-    for (i = 1; i <= msg.count(); ++i) {
-        int id = metaTypes[i];
-        if (id == QDBusConnectionPrivate::messageMetaType)
-            break;
-
-        if (id == int(msg.at(i - 1).userType()))
-            // no conversion needed
-            params.append(const_cast<void *>( msg.at(i - 1).constData() ));
-        else {
-            // convert to what the function expects
-            auxParameters.append(QVariant());
-            
-            const QVariant &in = msg.at(i - 1);
-            QVariant &out = auxParameters[auxParameters.count() - 1];
-
-            bool isOk = true;
-            if (id == QVariant::List) {
-                int mid = in.userType();
-                // the only conversion possible here is from a specialised QList<T> to QVariantList
-                if (mid == QDBusTypeHelper<bool>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<bool>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<short>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<short>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<ushort>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<ushort>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<int>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<int>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<uint>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<uint>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<qlonglong>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<qlonglong>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<qulonglong>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<qulonglong>::toVariantList(in));
-                else if (mid == QDBusTypeHelper<double>::listId())
-                    out = qVariantFromValue(QDBusTypeHelper<double>::toVariantList(in));
-                else
-                    isOk = false;
-            } else if (in.type() == QVariant::UInt) {
-                if (id == QMetaType::UChar) {
-                    uchar uc = in.toUInt();
-                    out = qVariantFromValue(uc);
-                } else if (id == QMetaType::UShort) {
-                    ushort us = in.toUInt();
-                    out = qVariantFromValue(us);
-                } else {
-                    isOk = false;
-                }
-            } else if (in.type() == QVariant::Int) {
-                if (id == QMetaType::Short) {
-                    short s = in.toInt();
-                    out = qVariantFromValue(s);
-                } else {
-                    isOk = false;
-                }
-            } else {
-                isOk = false;
-            }
-
-            if (!isOk)
-                qFatal("Internal error: got invalid meta type %d when trying to convert to meta type %d",
-                       in.userType(), id);
-
-            params.append( const_cast<void *>(out.constData()) );
-        }
-    }
+    for (int k = 0; k < inputsRead; ++k)
+        params.append(inputArgs.pointers[k]);
+    int i = inputsRead + 1;
 
     bool takesMessage = false;
     if (metaTypes.count() > i && metaTypes[i] == QDBusConnectionPrivate::messageMetaType) {
@@ -672,7 +872,7 @@ void QDBusConnectionPrivate::deliverCall(const CallDeliveryEvent& data) const
         fail = true;
     else
         fail = data.object->qt_metacall(QMetaObject::InvokeMetaMethod,
-                                        data.slotIdx, params.data()) >= 0;
+                                        slotIdx, params.data()) >= 0;
 
     // do we create a reply? Only if the caller is waiting for a reply and one hasn't been sent
     // yet.
@@ -709,7 +909,8 @@ void QDBusConnectionPrivate::customEvent(QEvent *e)
 }
 
 QDBusConnectionPrivate::QDBusConnectionPrivate(QObject *p)
-    : QObject(p), ref(1), mode(InvalidMode), connection(0), server(0), busService(0)
+    : QObject(p), ref(1), mode(InvalidMode), connection(0), server(0), busService(0),
+      lastSignalAtom(0), nextWorkerThread(0)
 {
     extern bool qDBusInitThreads();
     static const int msgType = registerMessageMetaType();
@@ -730,6 +931,30 @@ QDBusConnectionPrivate::~QDBusConnectionPrivate()
     if (dbus_error_is_set(&error))
         dbus_error_free(&error);
 
+    // stop delivering calls; the calls still queued are answered with an error, so that must be
+    // done before the connection is closed
+    // the worker threads drop their deliverers in threadFinished
+    foreach (QThread *worker, workerThreads) {
+        worker->quit();
+        worker->wait();
+        delete worker;
+    }
+    workerThreads.clear();
+
+    // the threads of the objects keep running: detach their deliverers. No call is being
+    // delivered by them, since each delivery holds a reference to us.
+    {
+        QMutexLocker locker(&delivererMutex);
+        QMutexLocker connLocker(qDBusDelivererMutex());
+        foreach (QObject *deliverer, deliverers) {
+            static_cast<QDBusCallDeliverer *>(deliverer)->conn = 0;
+            QCoreApplication::removePostedEvents(deliverer);
+            deliverer->deleteLater();
+        }
+        deliverers.clear();
+    }
+    QCoreApplication::removePostedEvents(this);
+
     closeConnection();
     rootNode.clear();        // free resources
     qDeleteAll(cachedMetaObjects);
@@ -756,6 +981,10 @@ void QDBusConnectionPrivate::closeConnection()
             connection = 0;
         }
     }
+
+    QMutexLocker nameOwnerLocker(&nameOwnerMutex);
+    nameOwners.clear();
+    nameOwnerQueries.clear();
 }
 
 bool QDBusConnectionPrivate::handleError()
@@ -829,22 +1058,115 @@ void QDBusConnectionPrivate::socketWrite(int fd)
     }
 }
 
+static void removeHooksForObject(QDBusConnectionPrivate::SignalHookList &list, QObject *obj,
+                                 QDBusConnectionPrivate::SignalHookList &removed)
+{
+    QDBusConnectionPrivate::SignalHookList::Iterator it = list.begin();
+    while (it != list.end()) {
+        if (it->obj == obj) {
+            removed.append(*it);
+            it = list.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static void removeHooksForObject(QHash<QByteArray, QDBusConnectionPrivate::SignalHookList> &hash,
+                                 QObject *obj, QDBusConnectionPrivate::SignalHookList &removed)
+{
+    QHash<QByteArray, QDBusConnectionPrivate::SignalHookList>::Iterator it = hash.begin();
+    while (it != hash.end()) {
+        removeHooksForObject(it.value(), obj, removed);
+        if (it.value().isEmpty())
+            it = hash.erase(it);
+        else
+            ++it;
+    }
+}
+
 void QDBusConnectionPrivate::objectDestroyed(QObject *obj)
 {
-    QWriteLocker locker(&lock);
-    huntAndDestroy(obj, &rootNode);
+    {
+        QWriteLocker locker(&lock);
+        huntAndDestroy(obj, &rootNode);
+    }
 
-    SignalHookHash::iterator sit = signalHooks.begin();
+    QWriteLocker locker(&signalHooksLock);
+    SignalHookList removed;
+    SignalHookHash::Iterator sit = signalHooks.begin();
     while (sit != signalHooks.end()) {
-        if (static_cast<QObject *>(sit.value().obj) == obj)
+        SignalHookBucket &bucket = sit.value();
+        removeHooksForObject(bucket.byPath, obj, removed);
+        removeHooksForObject(bucket.bySender, obj, removed);
+        removeHooksForObject(bucket.any, obj, removed);
+        if (bucket.isEmpty())
             sit = signalHooks.erase(sit);
         else
             ++sit;
     }
 
+    // the buckets are gone, so the atoms can go too
+    for (int i = 0; i < removed.count(); ++i) {
+        releaseSignalAtom(removed.at(i).interface);
+        releaseSignalAtom(removed.at(i).member);
+    }
+
     obj->disconnect(this);
 }
 
+QObject *QDBusConnectionPrivate::exportedChild(QObject *parent, const QString &name)
+{
+    // finds the child of parent called name, for objects registered with ExportChildObjects
+    QMutexLocker locker(&childIndexMutex);
+
+    QHash<QObject *, ChildIndex>::Iterator it = childIndexes.find(parent);
+    if (it == childIndexes.end()) {
+        it = childIndexes.insert(parent, ChildIndex());
+        connect(parent, SIGNAL(destroyed(QObject*)), SLOT(childIndexOwnerDestroyed(QObject*)),
+                Qt::DirectConnection);
+    }
+
+    ChildIndex &index = *it;
+    const QObjectList &children = parent->children();
+    if (index.children == children) {
+        // no child was added or removed, so every object in the index is still alive and ours;
+        // only their names may have changed, which QObject doesn't tell anyone about
+        QObject *child = index.byName.value(name);
+        if (child && child->objectName() == name)
+            return child;
+
+        // a miss or a renamed child: look for it like before there was an index
+        foreach (QObject *other, children)
+            if (other->objectName() == name) {
+                index.byName.insert(name, other);
+                return other;
+            }
+        return 0;
+    }
+
+    // the children changed: rebuild the index
+    index.children = children;
+    index.byName.clear();
+    QObject *found = 0;
+    foreach (QObject *child, children) {
+        QString childName = child->objectName();
+        if (childName.isEmpty() || index.byName.contains(childName))
+            continue;           // the first child with a name wins
+
+        index.byName.insert(childName, child);
+        if (childName == name)
+            found = child;
+    }
+    return found;
+}
+
+void QDBusConnectionPrivate::childIndexOwnerDestroyed(QObject *obj)
+{
+    QMutexLocker locker(&childIndexMutex);
+    childIndexes.remove(obj);
+}
+
 void QDBusConnectionPrivate::relaySignal(QObject *obj, const char *interface, const char *memberName,
                                          const QVariantList &args)
 {
@@ -861,10 +1183,24 @@ void QDBusConnectionPrivate::relaySignal(QObject *obj, const char *interface, co
     //qDebug() << "Emitting signal" << message;
     //qDebug() << "for paths:";
     dbus_message_set_no_reply(msg, true); // the reply would not be delivered to anything
+
+    // huntAndEmit sends a copy for each path; the copies of a locked message share its body
+    dbus_message_lock(msg);
     huntAndEmit(connection, msg, obj, &rootNode);
     dbus_message_unref(msg);
 }
 
+void QDBusConnectionPrivate::demarshallArguments(QDBusMessage &msg)
+{
+    // messages received from D-Bus are created without their arguments;
+    // this fills them in for the code that wants the QDBusMessage itself
+    if (msg.isEmpty() && msg.d_ptr->msg && !msg.signature().isEmpty()) {
+        QDBusMarshall::messageToList(msg, msg.d_ptr->msg);
+        qAtomicDetach(msg.d_ptr);       // other copies of msg must not see the new arguments
+        msg.d_ptr->arguments = msg;     // lets toDBusMessage tell if they were changed
+    }
+}
+
 int QDBusConnectionPrivate::registerMessageMetaType()
 {
     int tp = messageMetaType = qRegisterMetaType<QDBusMessage>("QDBusMessage");
@@ -887,7 +1223,7 @@ int QDBusConnectionPrivate::findSlot(QObject* obj, const QByteArray &normalizedN
     return midx;
 }
 
-bool QDBusConnectionPrivate::prepareHook(QDBusConnectionPrivate::SignalHook &hook, QString &key,
+bool QDBusConnectionPrivate::prepareHook(QDBusConnectionPrivate::SignalHook &hook,
                                          const QString &service, const QString &path,
                                          const QString &interface, const QString &name,
                                          QObject *receiver, const char *signal, int minMIdx,
@@ -903,15 +1239,12 @@ bool QDBusConnectionPrivate::prepareHook(QDBusConnectionPrivate::SignalHook &hoo
     hook.obj = receiver;
 
     // build the D-Bus signal name and signature
-    QString mname = name;
-    if (mname.isEmpty()) {
+    hook.interface = interface;
+    hook.member = name;
+    if (hook.member.isEmpty()) {
         normalizedName.truncate(normalizedName.indexOf('('));        
-        mname = QString::fromUtf8(normalizedName);
+        hook.member = QString::fromUtf8(normalizedName);
     }
-    key = mname;
-    key.reserve(interface.length() + 1 + mname.length());
-    key += QLatin1Char(':');
-    key += interface;
 
     if (buildSignature) {
         hook.signature.clear();
@@ -929,17 +1262,26 @@ bool QDBusConnectionPrivate::activateInternalFilters(const ObjectTreeNode *node,
 
     if (msg.interface().isEmpty() || msg.interface() == QLatin1String(DBUS_INTERFACE_INTROSPECTABLE)) {
         if (msg.method() == QLatin1String("Introspect") && msg.signature().isEmpty())
-            qDBusIntrospectObject(node, msg);
+            sendStringReply(msg, qDBusIntrospectObjectData(node));
         if (msg.interface() == QLatin1String(DBUS_INTERFACE_INTROSPECTABLE))
             return true;
     }
 
     if (node->obj && (msg.interface().isEmpty() ||
                       msg.interface() == QLatin1String(DBUS_INTERFACE_PROPERTIES))) {
-        if (msg.method() == QLatin1String("Get") && msg.signature() == QLatin1String("ss"))
-            qDBusPropertyGet(node, msg);
-        else if (msg.method() == QLatin1String("Set") && msg.signature() == QLatin1String("ssv"))
-            qDBusPropertySet(node, msg);
+        if (msg.method() == QLatin1String("Get") && msg.signature() == QLatin1String("ss")) {
+            QDBusMessage call = msg;
+            demarshallArguments(call);
+            qDBusPropertyGet(node, call);
+        } else if (msg.method() == QLatin1String("GetAll") && msg.signature() == QLatin1String("s")) {
+            QDBusMessage call = msg;
+            demarshallArguments(call);
+            qDBusPropertyGetAll(node, call);
+        } else if (msg.method() == QLatin1String("Set") && msg.signature() == QLatin1String("ssv")) {
+            QDBusMessage call = msg;
+            demarshallArguments(call);
+            qDBusPropertySet(node, call);
+        }
 
         if (msg.interface() == QLatin1String(DBUS_INTERFACE_PROPERTIES))
             return true;
@@ -966,7 +1308,9 @@ bool QDBusConnectionPrivate::activateObject(const ObjectTreeNode *node, const QD
             // place the call in all interfaces
             // let the first one that handles it to work
             foreach (const QDBusAdaptorConnector::AdaptorData &entry, connector->adaptors)
-                if (activateCall(entry.adaptor, newflags, msg))
+                if ((entry.dispatcher &&
+                     activateStaticCall(entry.adaptor, entry.dispatcher, newflags, msg)) ||
+                    activateCall(entry.adaptor, newflags, msg))
                     return true;
         } else {
             // check if we have an interface matching the name that was asked:
@@ -974,8 +1318,10 @@ bool QDBusConnectionPrivate::activateObject(const ObjectTreeNode *node, const QD
             it = qLowerBound(connector->adaptors.constBegin(), connector->adaptors.constEnd(),
                              msg.interface());
             if (it != connector->adaptors.constEnd() && it->interface == msg.interface())
-                if (activateCall(it->adaptor, newflags, msg))
-                return true;
+                if ((it->dispatcher &&
+                     activateStaticCall(it->adaptor, it->dispatcher, newflags, msg)) ||
+                    activateCall(it->adaptor, newflags, msg))
+                    return true;
         }
     }
 
@@ -998,33 +1344,37 @@ bool QDBusConnectionPrivate::activateObject(const ObjectTreeNode *node, const QD
 }
 
 template<typename Func>
-static bool applyForObject(QDBusConnectionPrivate::ObjectTreeNode *root, const QString &fullpath,
+static bool applyForObject(QDBusConnectionPrivate *conn,
+                           QDBusConnectionPrivate::ObjectTreeNode *root, const QString &fullpath,
                            Func& functor)
 {
-    // walk the object tree
-    QStringList path = fullpath.split(QLatin1Char('/'));
-    if (path.last().isEmpty())
-        path.removeLast();      // happens if path is "/"
-    int i = 1;
+    // walk the object tree, reading the path one component at a time
+    int len = fullpath.length();
+    int start = 1;              // skip the leading slash
     QDBusConnectionPrivate::ObjectTreeNode *node = root;
 
     // try our own tree first
     while (node && !(node->flags & QDBusConnection::ExportChildObjects) ) {
-        if (i == path.count()) {
+        if (start >= len) {
             // found our object
             functor(node);
             return true;
         }
 
+        int end = fullpath.indexOf(QLatin1Char('/'), start);
+        if (end == -1)
+            end = len;
+        QString name = fullpath.mid(start, end - start);
+
         QVector<QDBusConnectionPrivate::ObjectTreeNode::Data>::ConstIterator it =
-            qLowerBound(node->children.constBegin(), node->children.constEnd(), path.at(i));
-        if (it != node->children.constEnd() && it->name == path.at(i))
+            qLowerBound(node->children.constBegin(), node->children.constEnd(), name);
+        if (it != node->children.constEnd() && it->name == name)
             // match
             node = it->node;
         else
             node = 0;
 
-        ++i;
+        start = end + 1;
     }
 
     // any object in the tree can tell us to switch to its own object tree:
@@ -1032,7 +1382,7 @@ static bool applyForObject(QDBusConnectionPrivate::ObjectTreeNode *root, const Q
         QObject *obj = node->obj;
 
         while (obj) {
-            if (i == path.count()) {
+            if (start >= len) {
                 // we're at the correct level
                 QDBusConnectionPrivate::ObjectTreeNode fakenode(*node);
                 fakenode.obj = obj;
@@ -1040,21 +1390,13 @@ static bool applyForObject(QDBusConnectionPrivate::ObjectTreeNode *root, const Q
                 return true;
             }
 
-            const QObjectList children = obj->children();
+            int end = fullpath.indexOf(QLatin1Char('/'), start);
+            if (end == -1)
+                end = len;
 
             // find a child with the proper name
-            QObject *next = 0;
-            foreach (QObject *child, children)
-                if (child->objectName() == path.at(i)) {
-                    next = child;
-                    break;
-                }
-
-            if (!next)
-                break;
-
-            ++i;
-            obj = next;
+            obj = conn->exportedChild(obj, fullpath.mid(start, end - start));
+            start = end + 1;
         }
     }
 
@@ -1080,48 +1422,197 @@ bool QDBusConnectionPrivate::handleObjectCall(const QDBusMessage &msg)
     QReadLocker locker(&lock);
 
     qdbus_activateObject apply(this, msg);
-    if (applyForObject(&rootNode, msg.path(), apply))
+    if (applyForObject(this, &rootNode, msg.path(), apply))
         return apply.returnVal;
 
     qDebug("Call failed: no object found at %s", qPrintable(msg.path()));
     return false;
 }
 
-bool QDBusConnectionPrivate::handleSignal(const QString &key, const QDBusMessage& msg)
+static inline bool signatureMatches(const QString &hookSignature, const char *signature)
 {
-    bool result = false;
-    SignalHookHash::const_iterator it = signalHooks.find(key);
-    //qDebug("looking for: %s", path.toLocal8Bit().constData());
-    //qDebug() << signalHooks.keys();
-    for ( ; it != signalHooks.constEnd() && it.key() == key; ++it) {
-        const SignalHook &hook = it.value();
-        if ( !hook.sender.isEmpty() && hook.sender != msg.sender() )
-            continue;
-        if ( !hook.path.isEmpty() && hook.path != msg.path() )
-            continue;
-        if ( !hook.signature.isEmpty() && hook.signature != msg.signature() )
+    // a null signature matches anything, an empty one only signals without arguments
+    return hookSignature.isNull() || hookSignature == QLatin1String(signature);
+}
+
+typedef QVarLengthArray<const QDBusConnectionPrivate::SignalHook *, 8> SignalHookMatches;
+
+static void collectHooks(const QDBusConnectionPrivate::SignalHookList &list, const char *sender,
+                         const char *signature, bool checkSender, SignalHookMatches &matches)
+{
+    QDBusConnectionPrivate::SignalHookList::ConstIterator it = list.constBegin();
+    for ( ; it != list.constEnd(); ++it) {
+        if (checkSender && !it->sender.isEmpty() && it->sender != QLatin1String(sender))
             continue;
-        if ( hook.signature.isEmpty() && !hook.signature.isNull() && !msg.signature().isEmpty())
+        if (!signatureMatches(it->signature, signature))
             continue;
+        matches.append(&*it);
+    }
+}
 
-        // yes, |=
-        result |= activateSignal(hook, msg);
+static void collectHooks(const QDBusConnectionPrivate::SignalHookBucket &bucket,
+                         const char *path, const char *sender, const char *signature,
+                         SignalHookMatches &matches)
+{
+    // the hash lookups don't copy the strings
+    QHash<QByteArray, QDBusConnectionPrivate::SignalHookList>::ConstIterator it;
+    it = bucket.byPath.constFind(QByteArray::fromRawData(path, qstrlen(path)));
+    if (it != bucket.byPath.constEnd())
+        collectHooks(it.value(), sender, signature, true, matches);
+
+    it = bucket.bySender.constFind(QByteArray::fromRawData(sender, qstrlen(sender)));
+    if (it != bucket.bySender.constEnd())
+        collectHooks(it.value(), sender, signature, false, matches);
+
+    collectHooks(bucket.any, sender, signature, false, matches);
+}
+
+static inline quint64 signalHookKey(int interfaceAtom, int memberAtom)
+{
+    return (quint64(uint(interfaceAtom)) << 32) | uint(memberAtom);
+}
+
+int QDBusConnectionPrivate::internSignalAtom(const QString &name)
+{
+    // atom 0 is the empty name; each call takes a reference on the atom, which
+    // releaseSignalAtom drops when the hook is removed
+    if (name.isEmpty())
+        return 0;
+
+    SignalAtom &atom = signalAtoms[name.toUtf8()];
+    if (!atom.id)
+        atom.id = ++lastSignalAtom;
+    ++atom.ref;
+    return atom.id;
+}
+
+void QDBusConnectionPrivate::releaseSignalAtom(const QString &name)
+{
+    if (name.isEmpty())
+        return;
+
+    SignalAtomHash::Iterator it = signalAtoms.find(name.toUtf8());
+    if (it != signalAtoms.end() && --it->ref == 0)
+        signalAtoms.erase(it);
+}
+
+int QDBusConnectionPrivate::findSignalAtom(const char *name) const
+{
+    // returns -1 if nobody ever connected to a signal with this name
+    if (!name || !*name)
+        return 0;
+    SignalAtomHash::ConstIterator it =
+        signalAtoms.constFind(QByteArray::fromRawData(name, qstrlen(name)));
+    return it == signalAtoms.constEnd() ? -1 : it->id;
+}
+
+QDBusConnectionPrivate::SignalHookList *
+QDBusConnectionPrivate::signalHookList(const SignalHook &hook, bool create)
+{
+    // must be called with the signalHooksLock held
+    int interfaceAtom;
+    int memberAtom;
+    if (create) {
+        interfaceAtom = internSignalAtom(hook.interface);
+        memberAtom = internSignalAtom(hook.member);
+    } else {
+        interfaceAtom = findSignalAtom(hook.interface.toUtf8().constData());
+        memberAtom = findSignalAtom(hook.member.toUtf8().constData());
+        if (interfaceAtom == -1 || memberAtom == -1)
+            return 0;
     }
-    return result;
+
+    quint64 key = signalHookKey(interfaceAtom, memberAtom);
+    SignalHookHash::Iterator it = signalHooks.find(key);
+    if (it == signalHooks.end()) {
+        if (!create)
+            return 0;
+        it = signalHooks.insert(key, SignalHookBucket());
+    }
+
+    QHash<QByteArray, SignalHookList> *index;
+    QByteArray indexKey;
+    if (!hook.path.isEmpty()) {
+        index = &it->byPath;
+        indexKey = hook.path.toUtf8();
+    } else if (!hook.sender.isEmpty()) {
+        index = &it->bySender;
+        indexKey = hook.sender.toUtf8();
+    } else {
+        return &it->any;
+    }
+
+    if (!create && !index->contains(indexKey))
+        return 0;
+    return &(*index)[indexKey];
 }
 
-bool QDBusConnectionPrivate::handleSignal(const QDBusMessage& msg)
+void QDBusConnectionPrivate::removeEmptySignalHookList(const SignalHook &hook)
 {
-    QString key = msg.member();
-    key.reserve(key.length() + 1 + msg.interface().length());
-    key += QLatin1Char(':');
-    key += msg.interface();
+    // must be called with the signalHooksLock held for writing, before the hook's atoms are
+    // released; drops the hook's list, and its bucket if that is now empty too
+    int interfaceAtom = findSignalAtom(hook.interface.toUtf8().constData());
+    int memberAtom = findSignalAtom(hook.member.toUtf8().constData());
+    SignalHookHash::Iterator it = signalHooks.find(signalHookKey(interfaceAtom, memberAtom));
+    if (it == signalHooks.end())
+        return;
 
-    QReadLocker locker(&lock);
-    bool result = handleSignal(key, msg);    // one try
+    if (!hook.path.isEmpty())
+        it->byPath.remove(hook.path.toUtf8());
+    else if (!hook.sender.isEmpty())
+        it->bySender.remove(hook.sender.toUtf8());
 
-    key.truncate(msg.member().length() + 1); // keep the ':'
-    result |= handleSignal(key, msg);        // second try
+    if (it->isEmpty())
+        signalHooks.erase(it);
+}
+
+bool QDBusConnectionPrivate::handleSignal(DBusMessage *message, QDBusMessage &msg)
+{
+    // This is called by QDBusConnectionPrivate::messageFilter to find the hooks
+    // a signal should be delivered to. The lookup only uses the raw message header:
+    // the QDBusMessage is only built if a hook matched and it isn't built yet.
+    QReadLocker locker(&signalHooksLock);
+
+    int memberAtom = findSignalAtom(dbus_message_get_member(message));
+    if (memberAtom <= 0)
+        return false;           // nobody is connected to a signal of this name
+    int interfaceAtom = findSignalAtom(dbus_message_get_interface(message));
+
+    const char *path = dbus_message_get_path(message);
+    const char *sender = dbus_message_get_sender(message);
+    const char *signature = dbus_message_get_signature(message);
+    if (!path)
+        path = "";
+    if (!sender)
+        sender = "";
+
+    SignalHookMatches matches;
+    SignalHookHash::ConstIterator it;
+
+    // hooks for this interface
+    if (interfaceAtom > 0) {
+        it = signalHooks.constFind(signalHookKey(interfaceAtom, memberAtom));
+        if (it != signalHooks.constEnd())
+            collectHooks(it.value(), path, sender, signature, matches);
+    }
+
+    // hooks that didn't specify the interface
+    it = signalHooks.constFind(signalHookKey(0, memberAtom));
+    if (it != signalHooks.constEnd())
+        collectHooks(it.value(), path, sender, signature, matches);
+
+    if (matches.isEmpty())
+        return false;
+
+    if (msg.type() == QDBusMessage::InvalidMessage) {
+        msg = QDBusMessage::fromDBusMessageHeader(message, QDBusConnection(name));
+        qDebug() << "got message:" << msg;
+    }
+
+    bool result = false;
+    for (int i = 0; i < matches.count(); ++i)
+        // yes, |=
+        result |= activateSignal(*matches.at(i), msg);
     return result;
 }
 
@@ -1226,7 +1717,8 @@ void QDBusConnectionPrivate::messageResultReceived(DBusPendingCall *pending, voi
         // The slot may optionally have one final parameter that is QDBusMessage
         // The slot receives read-only copies of the message (i.e., pass by value or by const-ref)
 
-        QDBusMessage msg = QDBusMessage::fromDBusMessage(reply, QDBusConnection(connection->name));
+        QDBusMessage msg = QDBusMessage::fromDBusMessageHeader(reply,
+                                                               QDBusConnection(connection->name));
         qDebug() << "got message: " << msg;
         CallDeliveryEvent *e = prepareReply(call->receiver, call->methodIdx, call->metaTypes, msg);
         if (e)
@@ -1256,42 +1748,184 @@ int QDBusConnectionPrivate::send(const QDBusMessage& message) const
     return serial;
 }
 
+int QDBusConnectionPrivate::sendStringReply(const QDBusMessage &message,
+                                            const QByteArray &utf8) const
+{
+    // Replies to the call message with a single string that is already encoded, so the
+    // argument doesn't have to be converted and marshalled again. Used for the replies we
+    // keep cached, like the ones to Introspect.
+    Q_ASSERT(message.d_ptr->msg);
+    DBusMessage *msg = dbus_message_new_method_return(message.d_ptr->msg);
+    if (!msg)
+        return 0;
+    message.d_ptr->repliedTo = true;
+
+    const char *data = utf8.constData();
+    if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &data, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return 0;
+    }
+    dbus_message_set_no_reply(msg, true); // the reply would not be delivered to anything
+
+    qDebug() << "sending reply to:" << message;
+    bool isOk = dbus_connection_send(connection, msg, 0);
+    int serial = 0;
+    if (isOk)
+        serial = dbus_message_get_serial(msg);
+
+    dbus_message_unref(msg);
+    return serial;
+}
+
 QDBusMessage QDBusConnectionPrivate::sendWithReply(const QDBusMessage &message,
                                                    int sendMode)
 {
-    if (!QCoreApplication::instance() || sendMode == QDBusConnection::NoUseEventLoop) {
-        DBusMessage *msg = message.toDBusMessage();
-        if (!msg)
-            return QDBusMessage();
+    DBusMessage *msg = message.toDBusMessage();
+    if (!msg)
+        return QDBusMessage();
+
+    qDebug() << "sending message:" << message;
+    DBusMessage *reply = sendWithReply(msg, sendMode, message.timeout());
+    dbus_message_unref(msg);
 
-        qDebug() << "sending message:" << message;
+    if (!reply)
+        return lastError.isValid() ? QDBusMessage::fromError(lastError) : QDBusMessage();
+
+    QDBusMessage amsg = QDBusMessage::fromDBusMessage(reply, QDBusConnection(name));
+    dbus_message_unref(reply);
+    qDebug() << "got message:" << amsg;
+
+    lastError = amsg;           // set or clear error
+    return amsg;
+}
+
+DBusMessage *QDBusConnectionPrivate::sendWithReply(DBusMessage *msg, int sendMode, int timeout)
+{
+    // returns the reply, which may be an error message, or 0 if the call failed
+    if (!QCoreApplication::instance() || sendMode == QDBusConnection::NoUseEventLoop) {
         DBusMessage *reply = dbus_connection_send_with_reply_and_block(connection, msg,
-                                                                       -1, &error);
+                                                                       timeout, &error);
         handleError();
+
+        if (dbus_connection_get_dispatch_status(connection) == DBUS_DISPATCH_DATA_REMAINS)
+            QMetaObject::invokeMethod(this, "doDispatch", Qt::QueuedConnection);
+        return reply;
+    } else {                    // use the event loop
+        DBusPendingCall *pending = 0;
+        bool isOk = dbus_connection_send_with_reply(connection, msg, &pending, timeout);
+        if (!isOk || !pending) {
+            lastError = QDBusError();
+            return 0;
+        }
+
+        waitForReply(pending, sendMode);
+        DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+        dbus_pending_call_unref(pending);
+        return reply;
+    }
+}    
+
+void QDBusConnectionPrivate::waitForReply(DBusPendingCall *pending, int sendMode)
+{
+    // Only the connection's own thread may dispatch it and receive its socket notifications; any
+    // other thread would spin in processEvents() without ever seeing the reply, so it blocks in
+    // libdbus instead.
+    if (!QCoreApplication::instance() || sendMode == QDBusConnection::NoUseEventLoop ||
+        QThread::currentThread() != thread()) {
+        dbus_pending_call_block(pending);
+        return;
+    }
+
+    // Process events until the reply arrives. The pending call is completed by doDispatch() when
+    // the reply is read, or when its timeout fires, so there's no need for a nested QEventLoop or
+    // for a slot to tell us.
+    while (!dbus_pending_call_get_completed(pending)) {
+        if (mode == ClientMode &&
+            dbus_connection_get_dispatch_status(connection) == DBUS_DISPATCH_DATA_REMAINS)
+            doDispatch();       // the reply may have been read already
+        else
+            QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents |
+                                            QEventLoop::WaitForMoreEvents);
+    }
+}
+
+QList<QDBusMessage> QDBusConnectionPrivate::sendWithReplies(const QList<QDBusMessage> &messages,
+                                                            int sendMode)
+{
+    // queue all the calls before waiting for any reply, so that they all travel together
+    QVarLengthArray<DBusPendingCall *, 64> pendingCalls(messages.count());
+    for (int i = 0; i < messages.count(); ++i) {
+        pendingCalls[i] = 0;
+
+        DBusMessage *msg = messages.at(i).toDBusMessage();
+        if (!msg)
+            continue;
+
+        qDebug() << "sending message:" << messages.at(i);
+        if (!dbus_connection_send_with_reply(connection, msg, &pendingCalls[i],
+                                             messages.at(i).timeout()))
+            pendingCalls[i] = 0;
         dbus_message_unref(msg);
+    }
+    dbus_connection_flush(connection);
+
+    // collect the replies in order
+    QList<QDBusMessage> replies;
+    lastError = QDBusError();
+    for (int i = 0; i < pendingCalls.count(); ++i) {
+        DBusPendingCall *pending = pendingCalls.at(i);
+        if (!pending) {
+            // this one was never sent: give it an error reply, so it can't pass for a real one
+            QDBusError err = connection ?
+                             QDBusError(QDBusError::Failed,
+                                        QLatin1String("The message could not be sent")) :
+                             QDBusError(QDBusError::Disconnected,
+                                        QLatin1String("Not connected to D-Bus server"));
+            if (!lastError.isValid())
+                lastError = err;
+            replies << QDBusMessage::fromError(err);
+            continue;
+        }
 
-        if (lastError.isValid())
-            return QDBusMessage::fromError(lastError);
+        waitForReply(pending, sendMode);
+        DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+        dbus_pending_call_unref(pending);
 
         QDBusMessage amsg = QDBusMessage::fromDBusMessage(reply, QDBusConnection(name));
+        dbus_message_unref(reply);
         qDebug() << "got message:" << amsg;
 
-        if (dbus_connection_get_dispatch_status(connection) == DBUS_DISPATCH_DATA_REMAINS)
-            QMetaObject::invokeMethod(this, "doDispatch", Qt::QueuedConnection);
-        return amsg;
-    } else {                    // use the event loop
-        QDBusReplyWaiter waiter;
-        if (sendWithReplyAsync(message, &waiter, SLOT(reply(const QDBusMessage&))) > 0) {
-            // enter the event loop and wait for a reply
-            waiter.exec(QEventLoop::ExcludeUserInputEvents | QEventLoop::WaitForMoreEvents);
+        if (amsg.type() == QDBusMessage::ErrorMessage && !lastError.isValid())
+            lastError = amsg;   // report the first error
+        replies << amsg;
+    }
 
-            lastError = waiter.replyMsg; // set or clear error
-            return waiter.replyMsg;
-        }
+    if (dbus_connection_get_dispatch_status(connection) == DBUS_DISPATCH_DATA_REMAINS)
+        QMetaObject::invokeMethod(this, "doDispatch", Qt::QueuedConnection);
+    return replies;
+}
 
-        return QDBusMessage();
+QList<int> QDBusConnectionPrivate::sendWithRepliesAsync(const QList<QDBusMessage> &messages,
+                                                        QObject *receiver, const char *method)
+{
+    QList<int> serials;
+    if (!receiver || !method || !*method) {
+        // would not be able to deliver the replies
+        foreach (const QDBusMessage &message, messages)
+            serials << send(message);
+        return serials;
     }
-}    
+
+    // look the slot up only once
+    QList<int> metaTypes;
+    QByteArray normalizedName = QMetaObject::normalizedSignature(method + 1);
+    int slotIdx = findSlot(receiver, normalizedName, metaTypes);
+
+    foreach (const QDBusMessage &message, messages)
+        serials << sendWithReplyAsync(message, receiver, slotIdx, metaTypes);
+    dbus_connection_flush(connection);
+    return serials;
+}
 
 int QDBusConnectionPrivate::sendWithReplyAsync(const QDBusMessage &message, QObject *receiver,
                                                const char *method)
@@ -1304,6 +1938,12 @@ int QDBusConnectionPrivate::sendWithReplyAsync(const QDBusMessage &message, QObj
     QList<int> metaTypes;
     QByteArray normalizedName = QMetaObject::normalizedSignature(method + 1);
     slotIdx = findSlot(receiver, normalizedName, metaTypes);
+    return sendWithReplyAsync(message, receiver, slotIdx, metaTypes);
+}
+
+int QDBusConnectionPrivate::sendWithReplyAsync(const QDBusMessage &message, QObject *receiver,
+                                               int slotIdx, const QList<int> &metaTypes)
+{
     if (slotIdx == -1)
         // would not be able to deliver a reply
         return send(message);
@@ -1331,12 +1971,39 @@ int QDBusConnectionPrivate::sendWithReplyAsync(const QDBusMessage &message, QObj
     return 0;
 }
 
-void QDBusConnectionPrivate::connectSignal(const QString &key, const SignalHook &hook)
+bool QDBusConnectionPrivate::hasSignalHook(const SignalHook &hook)
 {
-    signalHooks.insertMulti(key, hook);
+    // must be called with the signalHooksLock held
+    const SignalHookList *list = signalHookList(hook, false);
+    return list && list->contains(hook);
+}
+
+void QDBusConnectionPrivate::connectSignal(const SignalHook &hook)
+{
+    // must be called with the signalHooksLock held for writing
+    signalHookList(hook, true)->append(hook);
     connect(hook.obj, SIGNAL(destroyed(QObject*)), SLOT(objectDestroyed(QObject*)));
 }
 
+bool QDBusConnectionPrivate::disconnectSignal(const SignalHook &hook)
+{
+    // must be called with the signalHooksLock held for writing
+    SignalHookList *list = signalHookList(hook, false);
+    if (!list)
+        return false;
+
+    int idx = list->indexOf(hook);
+    if (idx == -1)
+        return false;
+
+    list->removeAt(idx);
+    if (list->isEmpty())
+        removeEmptySignalHookList(hook);
+    releaseSignalAtom(hook.interface);
+    releaseSignalAtom(hook.member);
+    return true;
+}
+
 void QDBusConnectionPrivate::registerObject(const ObjectTreeNode *node)
 {
     connect(node->obj, SIGNAL(destroyed(QObject*)), SLOT(objectDestroyed(QObject*)));
@@ -1360,26 +2027,16 @@ void QDBusConnectionPrivate::connectRelay(const QString &service, const QString
     // this function is called by QDBusAbstractInterface when one of its signals is connected
     // we set up a relay from D-Bus into it
     SignalHook hook;
-    QString key;
-    if (!prepareHook(hook, key, service, path, interface, QString(), receiver, signal,
+    if (!prepareHook(hook, service, path, interface, QString(), receiver, signal,
                      QDBusAbstractInterface::staticMetaObject.methodCount(), true))
         return;                 // don't connect
 
     // add it to our list:
-    QWriteLocker locker(&lock);
-    SignalHookHash::ConstIterator it = signalHooks.find(key);
-    SignalHookHash::ConstIterator end = signalHooks.constEnd();
-    for ( ; it != end && it.key() == key; ++it) {
-        const SignalHook &entry = it.value();
-        if (entry.sender == hook.sender &&
-            entry.path == hook.path &&
-            entry.signature == hook.signature &&
-            entry.obj == hook.obj &&
-            entry.midx == hook.midx)
-            return;             // already there, no need to re-add
-    }
+    QWriteLocker locker(&signalHooksLock);
+    if (hasSignalHook(hook))
+        return;                 // already there, no need to re-add
 
-    connectSignal(key, hook);
+    connectSignal(hook);
 }
 
 void QDBusConnectionPrivate::disconnectRelay(const QString &service, const QString &path,
@@ -1390,31 +2047,77 @@ void QDBusConnectionPrivate::disconnectRelay(const QString &service, const QStri
     // this function is called by QDBusAbstractInterface when one of its signals is disconnected
     // we remove relay from D-Bus into it
     SignalHook hook;
-    QString key;
-    if (!prepareHook(hook, key, service, path, interface, QString(), receiver, signal,
+    if (!prepareHook(hook, service, path, interface, QString(), receiver, signal,
                      QDBusAbstractInterface::staticMetaObject.methodCount(), true))
         return;                 // don't connect
 
     // remove it from our list:
-    QWriteLocker locker(&lock);
-    SignalHookHash::Iterator it = signalHooks.find(key);
-    SignalHookHash::Iterator end = signalHooks.end();
-    for ( ; it != end && it.key() == key; ++it) {
-        const SignalHook &entry = it.value();
-        if (entry.sender == hook.sender &&
-            entry.path == hook.path &&
-            entry.signature == hook.signature &&
-            entry.obj == hook.obj &&
-            entry.midx == hook.midx) {
-            // found it
-            signalHooks.erase(it);
-            return;
-        }
-    }
+    QWriteLocker locker(&signalHooksLock);
+    if (disconnectSignal(hook))
+        return;
 
     qWarning("QDBusConnectionPrivate::disconnectRelay called for a signal that was not found");
 }
 
+void QDBusConnectionPrivate::replaceSignalHook(const QString &service, const QString &path,
+                                               const QString &interface, const QString &oldName,
+                                               const QString &newName, QObject *receiver,
+                                               const char *slot)
+{
+    // this function is called by QDBusAbstractInterface when its property change signal changes
+    // the old hook is removed and the new one installed under one lock, so no signal is
+    // delivered to both or to neither
+    SignalHook oldHook;
+    SignalHook newHook;
+    bool hasOld = !oldName.isEmpty() &&
+                  prepareHook(oldHook, service, path, interface, oldName, receiver, slot, 0, false);
+    bool hasNew = !newName.isEmpty() &&
+                  prepareHook(newHook, service, path, interface, newName, receiver, slot, 0, false);
+
+    QWriteLocker locker(&signalHooksLock);
+    if (hasOld)
+        disconnectSignal(oldHook);
+    if (hasNew && !hasSignalHook(newHook))
+        connectSignal(newHook);
+}
+
+static void collectSignalHooks(const QDBusConnectionPrivate::SignalHookList &list, QObject *obj,
+                               const QString &sender,
+                               QDBusConnectionPrivate::SignalHookList &result)
+{
+    foreach (const QDBusConnectionPrivate::SignalHook &hook, list)
+        if (hook.obj == obj && hook.sender == sender)
+            result.append(hook);
+}
+
+void QDBusConnectionPrivate::retargetSignalHooks(QObject *receiver, const QString &oldSender,
+                                                 const QString &newSender)
+{
+    // this function is called by QDBusInterfaceLoader when it has found the owner of the
+    // service: the hooks connected while the interface was being looked up still use the
+    // well-known name, and signals always carry the unique name of their sender
+    QWriteLocker locker(&signalHooksLock);
+
+    SignalHookList moved;
+    SignalHookHash::ConstIterator it = signalHooks.constBegin();
+    for ( ; it != signalHooks.constEnd(); ++it) {
+        const SignalHookBucket &bucket = it.value();
+        foreach (const SignalHookList &list, bucket.byPath)
+            collectSignalHooks(list, receiver, oldSender, moved);
+        foreach (const SignalHookList &list, bucket.bySender)
+            collectSignalHooks(list, receiver, oldSender, moved);
+        collectSignalHooks(bucket.any, receiver, oldSender, moved);
+    }
+
+    for (int i = 0; i < moved.count(); ++i) {
+        SignalHook hook = moved.at(i);
+        disconnectSignal(hook);
+        hook.sender = newSender;
+        if (!hasSignalHook(hook))
+            connectSignal(hook);
+    }
+}
+
 QString QDBusConnectionPrivate::getNameOwner(const QString& serviceName)
 {
     if (QDBusUtil::isValidUniqueConnectionName(serviceName))
@@ -1422,14 +2125,138 @@ QString QDBusConnectionPrivate::getNameOwner(const QString& serviceName)
     if (!connection || !QDBusUtil::isValidBusName(serviceName))
         return QString();
 
+    QString owner = cachedNameOwner(serviceName);
+    if (!owner.isEmpty()) {
+        lastError = QDBusError(); // as if we had asked
+        return owner;
+    }
+
+    // When we're not in the connection thread, the NameOwnerChanged for this name may be
+    // dispatched there before the reply reaches us. Register the call first, so that
+    // updateNameOwner can tell cacheNameOwner not to keep an owner that already changed.
+    startNameOwnerQuery(serviceName);
+
     QDBusMessage msg = QDBusMessage::methodCall(QLatin1String(DBUS_SERVICE_DBUS),
             QLatin1String(DBUS_PATH_DBUS), QLatin1String(DBUS_INTERFACE_DBUS),
             QLatin1String("GetNameOwner"));
     msg << serviceName;
     QDBusMessage reply = sendWithReply(msg, QDBusConnection::NoUseEventLoop);
-    if (!lastError.isValid() && reply.type() == QDBusMessage::ReplyMessage)
-        return reply.first().toString();
-    return QString();
+    if (lastError.isValid() || reply.type() != QDBusMessage::ReplyMessage) {
+        cacheNameOwner(serviceName, QString());
+        return QString();
+    }
+
+    owner = reply.first().toString();
+    cacheNameOwner(serviceName, owner);
+    return owner;
+}
+
+QString QDBusConnectionPrivate::cachedNameOwner(const QString &serviceName)
+{
+    if (QDBusUtil::isValidUniqueConnectionName(serviceName))
+        return serviceName;
+
+    QMutexLocker locker(&nameOwnerMutex);
+    return nameOwners.value(serviceName);
+}
+
+void QDBusConnectionPrivate::startNameOwnerQuery(const QString &serviceName)
+{
+    // must be matched by a call to cacheNameOwner, with an empty owner if the call failed
+    QMutexLocker locker(&nameOwnerMutex);
+    ++nameOwnerQueries[serviceName].count;
+}
+
+void QDBusConnectionPrivate::cacheNameOwner(const QString &serviceName, const QString &owner)
+{
+    // Ends the GetNameOwner call that startNameOwnerQuery registered. From here on we get all
+    // signals (see setConnection), so updateNameOwner keeps the entry current. A
+    // NameOwnerChanged that arrived during the call means the reply may be stale already:
+    // don't cache it, the next caller will ask again.
+    QMutexLocker locker(&nameOwnerMutex);
+    NameOwnerQueryHash::Iterator it = nameOwnerQueries.find(serviceName);
+    if (it == nameOwnerQueries.end())
+        return;                 // the connection was closed in the meantime
+
+    bool changed = it.value().changed;
+    if (--it.value().count == 0)
+        nameOwnerQueries.erase(it);
+
+    if (changed || owner.isEmpty() || serviceName == owner)
+        return;
+
+    nameOwners.insert(serviceName, owner);
+}
+
+void QDBusConnectionPrivate::updateNameOwner(DBusMessage *message)
+{
+    if (!dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, "NameOwnerChanged") ||
+        qstrcmp(dbus_message_get_sender(message), DBUS_SERVICE_DBUS) != 0)
+        return;
+
+    const char *service, *oldOwner, *newOwner;
+    if (!dbus_message_get_args(message, 0,
+                               DBUS_TYPE_STRING, &service,
+                               DBUS_TYPE_STRING, &oldOwner,
+                               DBUS_TYPE_STRING, &newOwner,
+                               DBUS_TYPE_INVALID))
+        return;
+
+    QMutexLocker locker(&nameOwnerMutex);
+    if (nameOwners.isEmpty() && nameOwnerQueries.isEmpty())
+        return;
+
+    QString name = QString::fromUtf8(service);
+    NameOwnerQueryHash::Iterator query = nameOwnerQueries.find(name);
+    if (query != nameOwnerQueries.end())
+        query.value().changed = true;
+
+    // we only keep the names that someone asked about
+    NameOwnerHash::Iterator it = nameOwners.find(name);
+    if (it == nameOwners.end())
+        return;
+
+    if (*newOwner)
+        it.value() = QString::fromUtf8(newOwner);
+    else
+        nameOwners.erase(it);
+}
+
+QDBusInterfacePrivate *
+QDBusConnectionPrivate::findInterfaceAsync(const QString &service, const QString &path,
+                                           const QString &interface)
+{
+    // QDBusInterfaceLoader does the rest
+    QDBusInterfacePrivate *p = new QDBusInterfacePrivate(QDBusConnection(name), this, service,
+                                                         path, interface);
+    p->isValid = false;
+    p->isPending = true;
+    return p;
+}
+
+QDBusMetaObject *QDBusConnectionPrivate::createMetaObject(const QString &interface,
+                                                          const QString &xml, QDBusError &error)
+{
+    QWriteLocker locker(&metaObjectLock);
+    QDBusMetaObject *mo = 0;
+    if (!interface.isEmpty())
+        mo = cachedMetaObjects.value(interface, 0);
+    if (mo)
+        // someone else introspected it while we were waiting
+        return mo;
+
+    return QDBusMetaObject::createMetaObject(interface, xml, cachedMetaObjects, error);
+}
+
+QDBusMetaObject *QDBusConnectionPrivate::cachedMetaObject(const QString &interface)
+{
+    if (interface.isEmpty())
+        return 0;               // depends on the object
+
+    // the meta objects saved by other processes aren't used until the remote object has been
+    // introspected again: createMetaObject loads them if its description hasn't changed
+    QReadLocker locker(&metaObjectLock);
+    return cachedMetaObjects.value(interface, 0);
 }
 
 QDBusInterfacePrivate *
@@ -1488,33 +2315,28 @@ QDBusConnectionPrivate::findMetaObject(const QString &service, const QString &pa
 {
     // service must be a unique connection name
     if (!interface.isEmpty()) {
-        QReadLocker locker(&lock);
+        QReadLocker locker(&metaObjectLock);
         QDBusMetaObject *mo = cachedMetaObjects.value(interface, 0);
         if (mo)
             return mo;
     }
     if (service == QString::fromUtf8(dbus_bus_get_unique_name(connection))) {
         // it's one of our own
-        QWriteLocker locker(&lock);
-        QDBusMetaObject *mo = 0;
-        if (!interface.isEmpty())
-            mo = cachedMetaObjects.value(interface, 0);
-        if (mo)
-            // maybe it got created when we switched from read to write lock
-            return mo;
-
         qdbus_Introspect apply;
-        if (!applyForObject(&rootNode, path, apply)) {
-            lastError = QDBusError(QDBusError::InvalidArgs,
-                                   QString(QLatin1String("No object at %1")).arg(path));
-            return 0;           // no object at path
+        {
+            QReadLocker locker(&lock);
+            if (!applyForObject(this, &rootNode, path, apply)) {
+                lastError = QDBusError(QDBusError::InvalidArgs,
+                                       QString(QLatin1String("No object at %1")).arg(path));
+                return 0;           // no object at path
+            }
         }
 
-        // release the lock and return
-        return QDBusMetaObject::createMetaObject(interface, apply.xml, cachedMetaObjects, lastError);
+        // the object tree isn't locked while the meta object is built
+        return createMetaObject(interface, apply.xml, lastError);
     }
 
-    // not local: introspect the target object:
+    // introspect the target object:
     QDBusMessage msg = QDBusMessage::methodCall(service, path,
                                                 QLatin1String(DBUS_INTERFACE_INTROSPECTABLE),
                                                 QLatin1String("Introspect"));
@@ -1522,15 +2344,6 @@ QDBusConnectionPrivate::findMetaObject(const QString &service, const QString &pa
 
     QDBusMessage reply = sendWithReply(msg, QDBusConnection::NoUseEventLoop);
 
-    // it doesn't exist yet, we have to create it
-    QWriteLocker locker(&lock);
-    QDBusMetaObject *mo = 0;
-    if (!interface.isEmpty())
-        mo = cachedMetaObjects.value(interface, 0);
-    if (mo)
-        // maybe it got created when we switched from read to write lock
-        return mo;
-
     QString xml;
     if (reply.type() == QDBusMessage::ReplyMessage)
         // fetch the XML description
@@ -1541,14 +2354,8 @@ QDBusConnectionPrivate::findMetaObject(const QString &service, const QString &pa
             return 0;           // error
     }
 
-    // release the lock and return
-    return QDBusMetaObject::createMetaObject(interface, xml, cachedMetaObjects, lastError);
-}
-
-void QDBusReplyWaiter::reply(const QDBusMessage &msg)
-{
-    replyMsg = msg;
-    QTimer::singleShot(0, this, SLOT(quit()));
+    // it doesn't exist yet, we have to create it
+    return createMetaObject(interface, xml, lastError);
 }
 
 #include "qdbusconnection_p.moc"
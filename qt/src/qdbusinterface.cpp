@@ -92,6 +92,105 @@ int QDBusInterface::qt_metacall(QMetaObject::Call _c, int _id, void **_a)
     return d_func()->metacall(_c, _id, _a);
 }
 
+QDBusInterfaceLoader::QDBusInterfaceLoader(QDBusInterface *parent, QDBusInterfacePrivate *p)
+    : QObject(parent), d(p), pendingReplies(0)
+{
+}
+
+void QDBusInterfaceLoader::start()
+{
+    // ask for the owner and the introspection data at the same time:
+    // the bus routes the Introspect call by the well-known name
+    owner = d->connp->cachedNameOwner(d->service);
+    if (owner.isEmpty()) {
+        QDBusMessage msg = QDBusMessage::methodCall(QLatin1String(DBUS_SERVICE_DBUS),
+                QLatin1String(DBUS_PATH_DBUS), QLatin1String(DBUS_INTERFACE_DBUS),
+                QLatin1String("GetNameOwner"));
+        msg << d->service;
+        d->connp->startNameOwnerQuery(d->service);
+        if (d->conn.sendWithReplyAsync(msg, this, SLOT(ownerReply(QDBusMessage))))
+            ++pendingReplies;
+        else
+            d->connp->cacheNameOwner(d->service, QString());
+    }
+
+    d->metaObject = d->connp->cachedMetaObject(d->interface);
+    if (!d->metaObject) {
+        QDBusMessage msg = QDBusMessage::methodCall(d->service, d->path,
+                                                    QLatin1String(DBUS_INTERFACE_INTROSPECTABLE),
+                                                    QLatin1String("Introspect"));
+        if (d->conn.sendWithReplyAsync(msg, this, SLOT(introspectReply(QDBusMessage))))
+            ++pendingReplies;
+    }
+
+    if (!pendingReplies)
+        // everything was cached, but our creator hasn't had the chance to connect yet
+        QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+}
+
+void QDBusInterfaceLoader::ownerReply(const QDBusMessage &reply)
+{
+    if (reply.type() == QDBusMessage::ReplyMessage) {
+        owner = reply.first().toString();
+        d->connp->cacheNameOwner(d->service, owner);
+    } else {
+        d->connp->cacheNameOwner(d->service, QString());
+        if (!error.isValid())
+            error = reply;
+    }
+
+    if (--pendingReplies == 0)
+        finish();
+}
+
+void QDBusInterfaceLoader::introspectReply(const QDBusMessage &reply)
+{
+    if (reply.type() == QDBusMessage::ReplyMessage) {
+        // fetch the XML description
+        xml = reply.first().toString();
+    } else if (!error.isValid()) {
+        // objects that can't be introspected get an empty meta object,
+        // like in QDBusConnectionPrivate::findMetaObject
+        QDBusError err = reply;
+        if (reply.type() != QDBusMessage::ErrorMessage || err != QDBusError::UnknownMethod)
+            error = err;
+    }
+
+    if (--pendingReplies == 0)
+        finish();
+}
+
+void QDBusInterfaceLoader::finish()
+{
+    if (!error.isValid() && !owner.isEmpty() && !d->metaObject)
+        d->metaObject = d->connp->createMetaObject(d->interface, xml, error);
+
+    if (!error.isValid() && !owner.isEmpty() && d->metaObject) {
+        // always use the unique connection name from now on, also for the signals that were
+        // connected in the mean time
+        if (d->service != owner)
+            d->connp->retargetSignalHooks(parent(), d->service, owner);
+        d->service = owner;
+        d->isValid = true;
+        d->lastError = QDBusError();
+    } else {
+        d->isValid = false;
+        if (error.isValid())
+            d->lastError = error;
+        else if (owner.isEmpty())
+            d->lastError = QDBusError(QDBusError::ServiceUnknown,
+                                      QString(QLatin1String("Service %1 is unknown")).arg(d->service));
+        else
+            d->lastError = QDBusError(QDBusError::Other, QLatin1String("Unknown error"));
+    }
+
+    d->sendQueuedCalls();
+
+    QObject *iface = parent();
+    deleteLater();
+    QMetaObject::invokeMethod(iface, "interfaceReady");
+}
+
 int QDBusInterfacePrivate::metacall(QMetaObject::Call c, int id, void **argv)
 {
     Q_Q(QDBusInterface);
@@ -201,3 +300,4 @@ QDBusInterfacePtr::QDBusInterfacePtr(const QString &service, const QString &path
 {
 }
 
+#include "qdbusinterface_p.moc"
@@ -62,4 +62,27 @@ public:
     int metacall(QMetaObject::Call c, int id, void **argv);
 };
 
+// looks up the owner and the meta object of an interface created by
+// QDBusConnection::findInterfaceAsync, without blocking
+class QDBusInterfaceLoader: public QObject
+{
+    Q_OBJECT
+public:
+    QDBusInterfaceLoader(QDBusInterface *parent, QDBusInterfacePrivate *p);
+
+    void start();
+
+public slots:
+    void ownerReply(const QDBusMessage &reply);
+    void introspectReply(const QDBusMessage &reply);
+    void finish();
+
+private:
+    QDBusInterfacePrivate *d;
+    QString owner;
+    QString xml;
+    QDBusError error;
+    int pendingReplies;
+};
+
 #endif
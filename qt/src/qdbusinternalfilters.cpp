@@ -26,6 +26,7 @@
 #include <dbus/dbus.h>
 #include <QtCore/qcoreapplication.h>
 #include <QtCore/qmetaobject.h>
+#include <QtCore/qmutex.h>
 #include <QtCore/qstringlist.h>
 
 #include "qdbusabstractadaptor.h"
@@ -58,21 +59,31 @@ static const char propertiesInterfaceXml[] =
     "      <arg name=\"property_name\" type=\"s\" direction=\"in\"/>\n"
     "      <arg name=\"value\" type=\"v\" direction=\"in\"/>\n"
     "    </method>\n"
+    "    <method name=\"GetAll\">\n"
+    "      <arg name=\"interface_name\" type=\"s\" direction=\"in\"/>\n"
+    "      <arg name=\"values\" type=\"a{sv}\" direction=\"out\"/>\n"
+    "    </method>\n"
     "  </interface>\n";
 
+static void appendSubObjectXml(QString &xml, const QString &name)
+{
+    xml += QLatin1String("  <node name=\"");
+    xml += name;
+    xml += QLatin1String("\"/>\n");
+}
+
 static QString generateSubObjectXml(QObject *object)
 {
     QString retval;
     foreach (QObject *child, object->children()) {
         QString name = child->objectName();
         if (!name.isEmpty())
-            retval += QString(QLatin1String("  <node name=\"%1\"/>\n"))
-                      .arg(name);
+            appendSubObjectXml(retval, name);
     }
     return retval;
 }
 
-QString qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node)
+static QString generateIntrospectionXml(const QDBusConnectionPrivate::ObjectTreeNode *node)
 {
     // object may be null
 
@@ -121,8 +132,7 @@ QString qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node
         // generate from the object tree
         foreach (const QDBusConnectionPrivate::ObjectTreeNode::Data &entry, node->children) {
             if (entry.node && (entry.node->obj || !entry.node->children.isEmpty()))
-                xml_data += QString(QLatin1String("  <node name=\"%1\"/>\n"))
-                            .arg(entry.name);
+                appendSubObjectXml(xml_data, entry.name);
         }
     }
 
@@ -130,13 +140,62 @@ QString qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node
     return xml_data;
 }
 
-void qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node,
-                           const QDBusMessage &msg)
+// The Introspect reply of each node in the object tree is generated only once and kept in
+// the node, both as a string and UTF-8 encoded, ready to be sent. QDBusConnection clears it
+// when objects are registered or unregistered below the node and when a registered object
+// is destroyed; the adaptor connector's revision tells us when adaptors were added.
+//
+// Objects that export their children aren't cached, since any of their QObject children
+// can change without telling us.
+
+Q_GLOBAL_STATIC(QMutex, qDBusIntrospectionMutex)
+
+static inline bool isIntrospectionCacheable(const QDBusConnectionPrivate::ObjectTreeNode *node)
+{
+    return !(node->flags & QDBusConnection::ExportChildObjects);
+}
+
+static int adaptorRevision(const QDBusConnectionPrivate::ObjectTreeNode *node)
 {
-    // now send it
-    QDBusMessage reply = QDBusMessage::methodReply(msg);
-    reply << qDBusIntrospectObject(node);
-    msg.connection().send(reply);
+    QDBusAdaptorConnector *connector;
+    if (node->obj && node->flags & QDBusConnection::ExportAdaptors &&
+        (connector = qDBusFindAdaptorConnector(node->obj)))
+        return connector->revision;
+    return -1;
+}
+
+static void updateIntrospection(const QDBusConnectionPrivate::ObjectTreeNode *node)
+{
+    // must be called with qDBusIntrospectionMutex held
+    int revision = adaptorRevision(node);
+    if (!node->introspection.isNull() && node->introspectionRevision == revision)
+        return;                 // still valid
+
+    node->introspection = generateIntrospectionXml(node);
+    node->introspectionData.clear();       // encoded when first needed
+    node->introspectionRevision = revision;
+}
+
+QString qDBusIntrospectObject(const QDBusConnectionPrivate::ObjectTreeNode *node)
+{
+    if (!isIntrospectionCacheable(node))
+        return generateIntrospectionXml(node);
+
+    QMutexLocker locker(qDBusIntrospectionMutex());
+    updateIntrospection(node);
+    return node->introspection;
+}
+
+QByteArray qDBusIntrospectObjectData(const QDBusConnectionPrivate::ObjectTreeNode *node)
+{
+    if (!isIntrospectionCacheable(node))
+        return generateIntrospectionXml(node).toUtf8();
+
+    QMutexLocker locker(qDBusIntrospectionMutex());
+    updateIntrospection(node);
+    if (node->introspectionData.isNull())
+        node->introspectionData = node->introspection.toUtf8();
+    return node->introspectionData;
 }
 
 // implement the D-Bus interface org.freedesktop.DBus.Properties
@@ -192,6 +251,68 @@ void qDBusPropertyGet(const QDBusConnectionPrivate::ObjectTreeNode *node, const
     msg.connection().send(reply);
 }
 
+static void appendProperties(QVariantMap &values, QObject *object, const QMetaObject *mo,
+                             int offset, bool scriptableOnly)
+{
+    for (int i = offset; i < mo->propertyCount(); ++i) {
+        QMetaProperty mp = mo->property(i);
+        if (!mp.isReadable() || (scriptableOnly && !mp.isScriptable()))
+            continue;
+
+        // same check as qDBusGenerateMetaObjectXml: properties without a D-Bus type aren't
+        // exported
+        if (!qDBusNameToTypeId(mp.typeName()))
+            continue;
+
+        QVariant value = mp.read(object);
+        if (value.isValid())
+            values.insert(QString::fromUtf8(mp.name()), value);
+    }
+}
+
+void qDBusPropertyGetAll(const QDBusConnectionPrivate::ObjectTreeNode *node, const QDBusMessage &msg)
+{
+    Q_ASSERT(msg.count() == 1);
+    QString interface_name = msg.at(0).toString();
+
+    QVariantMap values;
+    bool found = false;
+
+    QDBusAdaptorConnector *connector;
+    if (node->flags & QDBusConnection::ExportAdaptors &&
+        (connector = qDBusFindAdaptorConnector(node->obj))) {
+
+        // find the class that implements interface_name
+        QDBusAdaptorConnector::AdaptorMap::ConstIterator it;
+        it = qLowerBound(connector->adaptors.constBegin(), connector->adaptors.constEnd(),
+                         interface_name);
+        if (it != connector->adaptors.constEnd() && it->interface == interface_name) {
+            appendProperties(values, it->adaptor, it->metaObject,
+                             QDBusAbstractAdaptor::staticMetaObject.propertyCount(), false);
+            found = true;
+        }
+    }
+
+    if (!found && node->flags & QDBusConnection::ExportProperties) {
+        // the object's own properties, as exported by qDBusGenerateMetaObjectXml
+        bool scriptableOnly = (node->flags & QDBusConnection::ExportAllProperties) !=
+                              QDBusConnection::ExportAllProperties;
+        appendProperties(values, node->obj, node->obj->metaObject(),
+                         QObject::staticMetaObject.propertyCount(), scriptableOnly);
+        found = true;
+    }
+
+    if (!found) {
+        sendPropertyError(msg, interface_name);
+        return;
+    }
+
+    QDBusMessage reply = QDBusMessage::methodReply(msg);
+    reply.setSignature(QLatin1String("a{sv}"));
+    reply << values;
+    msg.connection().send(reply);
+}
+
 void qDBusPropertySet(const QDBusConnectionPrivate::ObjectTreeNode *node, const QDBusMessage &msg)
 {
     Q_ASSERT(msg.count() == 3);
@@ -27,9 +27,11 @@
 #include "qdbustypehelper_p.h"
 
 #include <qdebug.h>
+#include <qhash.h>
 #include <qvariant.h>
 #include <qlist.h>
 #include <qmap.h>
+#include <qreadwritelock.h>
 #include <qstringlist.h>
 #include <qvarlengtharray.h>
 #include <qvector.h>
@@ -71,6 +73,24 @@ inline QVariant qFetchList(DBusMessageIter *arrayIt)
     return QDBusTypeHelper<QList<QtType> >::toVariant(list);
 }
 
+template <typename DBusType, typename QtType>
+inline QVariant qFetchFixedList(DBusMessageIter *arrayIt)
+{
+    // arrays of fixed-size types are read in one go, not element by element
+    DBusMessageIter it;
+    dbus_message_iter_recurse(arrayIt, &it);
+
+    DBusType *data = 0;
+    int len = 0;
+    dbus_message_iter_get_fixed_array(&it, &data, &len);
+
+    QList<QtType> list;
+    for (int i = 0; i < len; ++i)
+        list.append( static_cast<QtType>( data[i] ) );
+
+    return QDBusTypeHelper<QList<QtType> >::toVariant(list);
+}
+
 static QStringList qFetchStringList(DBusMessageIter *arrayIt)
 {
     QStringList list;
@@ -119,30 +139,30 @@ static QVariant qFetchParameter(DBusMessageIter *it)
         switch (arrayType)
         {
         case DBUS_TYPE_BYTE: {
-            // QByteArray
+            // QByteArray: a single copy out of the message buffer
             DBusMessageIter sub;
-	    dbus_message_iter_recurse(it, &sub);
-	    int len = dbus_message_iter_get_array_len(&sub);
-	    char* data;
-	    dbus_message_iter_get_fixed_array(&sub,&data,&len);
-	    return QByteArray(data,len);
+            dbus_message_iter_recurse(it, &sub);
+            const char *data = 0;
+            int len = 0;
+            dbus_message_iter_get_fixed_array(&sub, &data, &len);
+            return QByteArray(data, len);
         }
         case DBUS_TYPE_INT16:
-            return qFetchList<dbus_int16_t, short>(it);
+            return qFetchFixedList<dbus_int16_t, short>(it);
         case DBUS_TYPE_UINT16:
-            return qFetchList<dbus_uint16_t, ushort>(it);
+            return qFetchFixedList<dbus_uint16_t, ushort>(it);
         case DBUS_TYPE_INT32:
-            return qFetchList<dbus_int32_t, int>(it);
+            return qFetchFixedList<dbus_int32_t, int>(it);
         case DBUS_TYPE_UINT32:
-            return qFetchList<dbus_uint32_t, uint>(it);
+            return qFetchFixedList<dbus_uint32_t, uint>(it);
         case DBUS_TYPE_BOOLEAN:
-            return qFetchList<dbus_bool_t, bool>(it);
+            return qFetchFixedList<dbus_bool_t, bool>(it);
         case DBUS_TYPE_DOUBLE:
-            return qFetchList<double, double>(it);
+            return qFetchFixedList<double, double>(it);
         case DBUS_TYPE_INT64:
-            return qFetchList<dbus_int64_t, qlonglong>(it);
+            return qFetchFixedList<dbus_int64_t, qlonglong>(it);
         case DBUS_TYPE_UINT64:
-            return qFetchList<dbus_uint64_t, qulonglong>(it);
+            return qFetchFixedList<dbus_uint64_t, qulonglong>(it);
         case DBUS_TYPE_STRING:
         case DBUS_TYPE_OBJECT_PATH:
         case DBUS_TYPE_SIGNATURE:
@@ -205,6 +225,167 @@ void QDBusMarshall::messageToList(QList<QVariant> &list, DBusMessage *message)
     } while (dbus_message_iter_next(&it));
 }
 
+static bool qFetchBasicArgument(DBusMessageIter *it, int metaType,
+                                QDBusSlotArguments::Basic &value)
+{
+    // the caller has already checked the message signature against the slot,
+    // this only allows the conversions that the check in qdbusintegrator.cpp allows
+    int type = dbus_message_iter_get_arg_type(it);
+    switch (metaType) {
+    case QVariant::Bool:
+        if (type != DBUS_TYPE_BOOLEAN)
+            return false;
+        value.b = qIterGet<dbus_bool_t>(it);
+        return true;
+    case QMetaType::UChar:
+        if (type == DBUS_TYPE_BYTE)
+            value.y = qIterGet<unsigned char>(it);
+        else if (type == DBUS_TYPE_UINT32)
+            value.y = qIterGet<dbus_uint32_t>(it);
+        else
+            return false;
+        return true;
+    case QMetaType::Short:
+        if (type == DBUS_TYPE_INT16)
+            value.n = qIterGet<dbus_int16_t>(it);
+        else if (type == DBUS_TYPE_INT32)
+            value.n = qIterGet<dbus_int32_t>(it);
+        else
+            return false;
+        return true;
+    case QMetaType::UShort:
+        if (type == DBUS_TYPE_UINT16)
+            value.q = qIterGet<dbus_uint16_t>(it);
+        else if (type == DBUS_TYPE_UINT32)
+            value.q = qIterGet<dbus_uint32_t>(it);
+        else
+            return false;
+        return true;
+    case QVariant::Int:
+        if (type != DBUS_TYPE_INT32)
+            return false;
+        value.i = qIterGet<dbus_int32_t>(it);
+        return true;
+    case QVariant::UInt:
+        if (type != DBUS_TYPE_UINT32)
+            return false;
+        value.u = qIterGet<dbus_uint32_t>(it);
+        return true;
+    case QVariant::LongLong:
+        if (type != DBUS_TYPE_INT64)
+            return false;
+        value.x = qIterGet<dbus_int64_t>(it);
+        return true;
+    case QVariant::ULongLong:
+        if (type != DBUS_TYPE_UINT64)
+            return false;
+        value.t = qIterGet<dbus_uint64_t>(it);
+        return true;
+    case QVariant::Double:
+        if (type != DBUS_TYPE_DOUBLE)
+            return false;
+        value.d = qIterGet<double>(it);
+        return true;
+    }
+
+    return false;
+}
+
+// converts a specialised QList<T> to QVariantList
+static bool qConvertToVariantList(const QVariant &in, QVariant &out)
+{
+    int mid = in.userType();
+    if (mid == QDBusTypeHelper<bool>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<bool>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<short>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<short>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<ushort>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<ushort>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<int>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<int>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<uint>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<uint>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<qlonglong>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<qlonglong>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<qulonglong>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<qulonglong>::toVariantList(in));
+    else if (mid == QDBusTypeHelper<double>::listId())
+        out = qVariantFromValue(QDBusTypeHelper<double>::toVariantList(in));
+    else
+        return false;
+    return true;
+}
+
+static bool qFetchArgument(DBusMessageIter *it, int metaType, QDBusSlotArguments &arguments,
+                           int i)
+{
+    switch (metaType) {
+    case QVariant::Bool:
+    case QMetaType::UChar:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+        arguments.pointers[i] = &arguments.basics[i];
+        return qFetchBasicArgument(it, metaType, arguments.basics[i]);
+
+    case QVariant::String:
+        switch (dbus_message_iter_get_arg_type(it)) {
+        case DBUS_TYPE_STRING:
+        case DBUS_TYPE_OBJECT_PATH:
+        case DBUS_TYPE_SIGNATURE:
+            arguments.strings[i] = QString::fromUtf8(qIterGet<char *>(it));
+            arguments.pointers[i] = &arguments.strings[i];
+            return true;
+        }
+        return false;
+    }
+
+    // everything else: variants, containers and lists
+    QVariant &out = arguments.variants[i];
+    out = qFetchParameter(it);
+    if (out.userType() != metaType) {
+        if (metaType != QVariant::List)
+            return false;
+
+        QVariant in = out;
+        if (!qConvertToVariantList(in, out))
+            return false;
+    }
+
+    arguments.pointers[i] = const_cast<void *>(out.constData());
+    return true;
+}
+
+/*!
+    \internal
+    Reads the arguments of \a message straight into \a arguments, converting them to the slot
+    parameter types \a metaTypes[1] to \a metaTypes[count]. Stops early if the message has fewer
+    arguments. Returns the number of arguments read or -1 if one of them could not be converted.
+*/
+int QDBusMarshall::messageToArguments(DBusMessage *message, const QList<int> &metaTypes,
+                                      int count, QDBusSlotArguments &arguments)
+{
+    Q_ASSERT(message);
+    Q_ASSERT(arguments.pointers.count() >= count);
+
+    DBusMessageIter it;
+    if (count == 0 || !dbus_message_iter_init(message, &it))
+        return 0;
+
+    int i = 0;
+    do {
+        if (!qFetchArgument(&it, metaTypes.at(i + 1), arguments, i))
+            return -1;
+        ++i;
+    } while (i < count && dbus_message_iter_next(&it));
+
+    return i;
+}
+
 // convert the variant to the given type and return true if it worked.
 // if the type is not known, guess it from the variant and set.
 // return false if conversion failed.
@@ -568,6 +749,387 @@ bool qListToIterator(DBusMessageIter *it, const QList<QVariant> &list, const QDB
     return true;
 }
     
+// Marshalling plans
+//
+// A plan is the list of steps that append the arguments of an outgoing message. It is compiled
+// once per signature (or, for messages without a signature, once per list of argument
+// metatypes) and cached, so that sending the same kind of message again doesn't parse the
+// signature or guess the types from the QVariants. Each step has a fast path for the metatype
+// that matches its D-Bus type exactly; anything else goes through qVariantToIterator with the
+// QDBusType that was parsed when compiling the plan.
+
+enum QDBusMarshallOp {
+    AppendGeneric,
+    AppendBool,
+    AppendByte,
+    AppendInt16,
+    AppendUInt16,
+    AppendInt32,
+    AppendUInt32,
+    AppendInt64,
+    AppendUInt64,
+    AppendDouble,
+    AppendString,
+    AppendStringList,
+    AppendByteArray,
+    AppendBoolList,
+    AppendInt16List,
+    AppendUInt16List,
+    AppendInt32List,
+    AppendUInt32List,
+    AppendInt64List,
+    AppendUInt64List,
+    AppendDoubleList
+};
+
+struct QDBusMarshallStep
+{
+    int op;
+    QDBusType type;
+};
+typedef QVector<QDBusMarshallStep> QDBusMarshallPlan;
+
+struct QDBusMarshallPlanCache
+{
+    // emptied when full, like the intern table in qdbustype.cpp
+    enum { MaxPlans = 512 };
+
+    QReadWriteLock lock;
+    QHash<QString, QDBusMarshallPlan> bySignature;
+    QHash<QByteArray, QDBusMarshallPlan> byMetaTypes;
+};
+Q_GLOBAL_STATIC(QDBusMarshallPlanCache, qDBusMarshallPlanCache)
+
+static int qMarshallOp(const QDBusType &type)
+{
+    switch (type.dbusType()) {
+    case DBUS_TYPE_BOOLEAN:
+        return AppendBool;
+    case DBUS_TYPE_BYTE:
+        return AppendByte;
+    case DBUS_TYPE_INT16:
+        return AppendInt16;
+    case DBUS_TYPE_UINT16:
+        return AppendUInt16;
+    case DBUS_TYPE_INT32:
+        return AppendInt32;
+    case DBUS_TYPE_UINT32:
+        return AppendUInt32;
+    case DBUS_TYPE_INT64:
+        return AppendInt64;
+    case DBUS_TYPE_UINT64:
+        return AppendUInt64;
+    case DBUS_TYPE_DOUBLE:
+        return AppendDouble;
+    case DBUS_TYPE_STRING:
+    case DBUS_TYPE_OBJECT_PATH:
+    case DBUS_TYPE_SIGNATURE:
+        return AppendString;
+
+    case DBUS_TYPE_ARRAY:
+        if (type.isMap())
+            return AppendGeneric;
+
+        switch (type.arrayElement().dbusType()) {
+        case DBUS_TYPE_STRING:
+            return AppendStringList;
+        case DBUS_TYPE_BYTE:
+            return AppendByteArray;
+        case DBUS_TYPE_BOOLEAN:
+            return AppendBoolList;
+        case DBUS_TYPE_INT16:
+            return AppendInt16List;
+        case DBUS_TYPE_UINT16:
+            return AppendUInt16List;
+        case DBUS_TYPE_INT32:
+            return AppendInt32List;
+        case DBUS_TYPE_UINT32:
+            return AppendUInt32List;
+        case DBUS_TYPE_INT64:
+            return AppendInt64List;
+        case DBUS_TYPE_UINT64:
+            return AppendUInt64List;
+        case DBUS_TYPE_DOUBLE:
+            return AppendDoubleList;
+        }
+        return AppendGeneric;
+    }
+
+    // variants and structs
+    return AppendGeneric;
+}
+
+static QDBusMarshallStep qCompileStep(const QDBusType &type)
+{
+    QDBusMarshallStep step;
+    step.op = qMarshallOp(type);
+    step.type = type;
+    qDBusPrepareType(step.type);    // it is shared between threads through the cache
+    return step;
+}
+
+static QDBusMarshallPlan qPlanForSignature(const QString &signature)
+{
+    QDBusMarshallPlanCache *cache = qDBusMarshallPlanCache();
+    {
+        QReadLocker locker(&cache->lock);
+        QHash<QString, QDBusMarshallPlan>::ConstIterator it = cache->bySignature.constFind(signature);
+        if (it != cache->bySignature.constEnd())
+            return it.value();
+    }
+
+    QDBusTypeList types(signature.toUtf8());
+    QDBusMarshallPlan plan;
+    plan.reserve(types.count());
+    foreach (const QDBusType &type, types)
+        plan.append(qCompileStep(type));
+
+    QWriteLocker locker(&cache->lock);
+    if (cache->bySignature.count() >= QDBusMarshallPlanCache::MaxPlans)
+        cache->bySignature.clear();
+    cache->bySignature.insert(signature, plan);
+    return plan;
+}
+
+// returns true if the D-Bus type guessed for a QVariant of this metatype
+// doesn't depend on the value
+static bool qIsSelfDescribing(int id)
+{
+    switch (id) {
+    case QVariant::Bool:
+    case QMetaType::UChar:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+    case QVariant::Double:
+    case QVariant::String:
+    case QVariant::StringList:
+    case QVariant::ByteArray:
+        return true;
+    }
+
+    return id == QDBusTypeHelper<bool>::listId() ||
+        id == QDBusTypeHelper<short>::listId() ||
+        id == QDBusTypeHelper<ushort>::listId() ||
+        id == QDBusTypeHelper<int>::listId() ||
+        id == QDBusTypeHelper<uint>::listId() ||
+        id == QDBusTypeHelper<qlonglong>::listId() ||
+        id == QDBusTypeHelper<qulonglong>::listId() ||
+        id == QDBusTypeHelper<double>::listId();
+}
+
+// finds the plan for a message without a signature
+// returns false if the types have to be guessed from the values
+static bool qPlanForVariants(const QList<QVariant> &list, QDBusMarshallPlan &plan)
+{
+    QVarLengthArray<int, 16> ids(list.count());
+    for (int i = 0; i < list.count(); ++i) {
+        ids[i] = list.at(i).userType();
+        if (!qIsSelfDescribing(ids[i]))
+            return false;
+    }
+
+    QByteArray key = QByteArray::fromRawData(reinterpret_cast<const char *>(ids.constData()),
+                                             ids.count() * sizeof(int));
+    QDBusMarshallPlanCache *cache = qDBusMarshallPlanCache();
+    {
+        QReadLocker locker(&cache->lock);
+        QHash<QByteArray, QDBusMarshallPlan>::ConstIterator it = cache->byMetaTypes.constFind(key);
+        if (it != cache->byMetaTypes.constEnd()) {
+            plan = it.value();
+            return true;
+        }
+    }
+
+    plan.clear();
+    plan.reserve(list.count());
+    foreach (const QVariant &var, list)
+        plan.append(qCompileStep(QDBusType::guessFromVariant(var)));
+
+    QWriteLocker locker(&cache->lock);
+    if (cache->byMetaTypes.count() >= QDBusMarshallPlanCache::MaxPlans)
+        cache->byMetaTypes.clear();
+    // deep copy the key, it points to our stack
+    cache->byMetaTypes.insert(QByteArray(key.constData(), key.size()), plan);
+    return true;
+}
+
+template<typename T>
+static inline const T &qVariantData(const QVariant &var)
+{
+    return *reinterpret_cast<const T *>(var.constData());
+}
+
+template<typename DBusType, typename QtType>
+static void qAppendFixedArray(DBusMessageIter *it, int dbusType, const QVariant &var)
+{
+    // QList doesn't store the items contiguously, copy them first
+    const QList<QtType> &list = qVariantData<QList<QtType> >(var);
+    QVarLengthArray<DBusType, 64> data(list.count());
+    for (int i = 0; i < list.count(); ++i)
+        data[i] = static_cast<DBusType>(list.at(i));
+
+    char signature[2] = { char(dbusType), 0 };
+    const DBusType *ptr = data.constData();
+    DBusMessageIter sub;
+    dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, signature, &sub);
+    dbus_message_iter_append_fixed_array(&sub, dbusType, &ptr, data.count());
+    dbus_message_iter_close_container(it, &sub);
+}
+
+static bool qAppendStep(DBusMessageIter *it, const QDBusMarshallStep &step, const QVariant &var)
+{
+    int id = var.userType();
+    int dbusType = step.type.dbusType();
+
+    switch (step.op) {
+    case AppendBool:
+        if (id == QVariant::Bool) {
+            dbus_bool_t value = qVariantData<bool>(var);
+            dbus_message_iter_append_basic(it, dbusType, &value);
+            return true;
+        }
+        break;
+    case AppendByte:
+        if (id == QMetaType::UChar) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendInt16:
+        if (id == QMetaType::Short) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendUInt16:
+        if (id == QMetaType::UShort) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendInt32:
+        if (id == QVariant::Int) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendUInt32:
+        if (id == QVariant::UInt) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendInt64:
+        if (id == QVariant::LongLong) {
+            dbus_int64_t value = qVariantData<qlonglong>(var);
+            dbus_message_iter_append_basic(it, dbusType, &value);
+            return true;
+        }
+        break;
+    case AppendUInt64:
+        if (id == QVariant::ULongLong) {
+            dbus_uint64_t value = qVariantData<qulonglong>(var);
+            dbus_message_iter_append_basic(it, dbusType, &value);
+            return true;
+        }
+        break;
+    case AppendDouble:
+        if (id == QVariant::Double) {
+            dbus_message_iter_append_basic(it, dbusType, var.constData());
+            return true;
+        }
+        break;
+    case AppendString:
+        if (id == QVariant::String) {
+            QByteArray utf8 = qVariantData<QString>(var).toUtf8();
+            const char *data = utf8.constData();
+            dbus_message_iter_append_basic(it, dbusType, &data);
+            return true;
+        }
+        break;
+    case AppendStringList:
+        if (id == QVariant::StringList) {
+            const QStringList &list = qVariantData<QStringList>(var);
+            DBusMessageIter sub;
+            dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING_AS_STRING, &sub);
+            foreach (const QString &str, list) {
+                QByteArray utf8 = str.toUtf8();
+                const char *data = utf8.constData();
+                dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &data);
+            }
+            dbus_message_iter_close_container(it, &sub);
+            return true;
+        }
+        break;
+    case AppendByteArray:
+        if (id == QVariant::ByteArray) {
+            const QByteArray &array = qVariantData<QByteArray>(var);
+            const char *data = array.constData();
+            DBusMessageIter sub;
+            dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE_AS_STRING, &sub);
+            dbus_message_iter_append_fixed_array(&sub, DBUS_TYPE_BYTE, &data, array.length());
+            dbus_message_iter_close_container(it, &sub);
+            return true;
+        }
+        break;
+    case AppendBoolList:
+        if (id == QDBusTypeHelper<bool>::listId()) {
+            qAppendFixedArray<dbus_bool_t, bool>(it, DBUS_TYPE_BOOLEAN, var);
+            return true;
+        }
+        break;
+    case AppendInt16List:
+        if (id == QDBusTypeHelper<short>::listId()) {
+            qAppendFixedArray<dbus_int16_t, short>(it, DBUS_TYPE_INT16, var);
+            return true;
+        }
+        break;
+    case AppendUInt16List:
+        if (id == QDBusTypeHelper<ushort>::listId()) {
+            qAppendFixedArray<dbus_uint16_t, ushort>(it, DBUS_TYPE_UINT16, var);
+            return true;
+        }
+        break;
+    case AppendInt32List:
+        if (id == QDBusTypeHelper<int>::listId()) {
+            qAppendFixedArray<dbus_int32_t, int>(it, DBUS_TYPE_INT32, var);
+            return true;
+        }
+        break;
+    case AppendUInt32List:
+        if (id == QDBusTypeHelper<uint>::listId()) {
+            qAppendFixedArray<dbus_uint32_t, uint>(it, DBUS_TYPE_UINT32, var);
+            return true;
+        }
+        break;
+    case AppendInt64List:
+        if (id == QDBusTypeHelper<qlonglong>::listId()) {
+            qAppendFixedArray<dbus_int64_t, qlonglong>(it, DBUS_TYPE_INT64, var);
+            return true;
+        }
+        break;
+    case AppendUInt64List:
+        if (id == QDBusTypeHelper<qulonglong>::listId()) {
+            qAppendFixedArray<dbus_uint64_t, qulonglong>(it, DBUS_TYPE_UINT64, var);
+            return true;
+        }
+        break;
+    case AppendDoubleList:
+        if (id == QDBusTypeHelper<double>::listId()) {
+            qAppendFixedArray<double, double>(it, DBUS_TYPE_DOUBLE, var);
+            return true;
+        }
+        break;
+    }
+
+    // conversions, containers and variants
+    return qVariantToIterator(it, var, step.type);
+}
+
 void QDBusMarshall::listToMessage(const QList<QVariant> &list, DBusMessage *msg,
                                   const QString &signature)
 {
@@ -575,8 +1137,22 @@ void QDBusMarshall::listToMessage(const QList<QVariant> &list, DBusMessage *msg,
     DBusMessageIter it;
     dbus_message_iter_init_append(msg, &it);
 
-    if (signature.isEmpty())
-        (void) qListToIterator(&it, list);
-    else
-        (void) qListToIterator(&it, list, QDBusTypeList(signature.toUtf8()));
+    QDBusMarshallPlan plan;
+    if (signature.isEmpty()) {
+        if (!qPlanForVariants(list, plan)) {
+            // the types depend on the values
+            (void) qListToIterator(&it, list);
+            return;
+        }
+    } else {
+        plan = qPlanForSignature(signature);
+        if (list.count() < plan.count()) {
+            qWarning("QDBusMarshall: too few parameters");
+            return;
+        }
+    }
+
+    for (int i = 0; i < plan.count(); ++i)
+        if (!qAppendStep(&it, plan.at(i), list.at(i)))
+            return;
 }
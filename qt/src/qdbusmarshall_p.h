@@ -37,11 +37,42 @@
 #ifndef QDBUSMARSHALLPRIVATE_H
 #define QDBUSMARSHALLPRIVATE_H
 
+#include <QtCore/qlist.h>
+#include <QtCore/qstring.h>
+#include <QtCore/qvariant.h>
+#include <QtCore/qvarlengtharray.h>
+
 struct DBusMessage;
 
-template <typename T> class QList;
-class QVariant;
-class QString;
+/*!
+    \internal
+    Storage for the input arguments of a slot, filled in by QDBusMarshall::messageToArguments.
+    Basic types and strings are read straight into it; only the other types go through QVariant.
+*/
+struct QDBusSlotArguments
+{
+    union Basic
+    {
+        bool b;
+        uchar y;
+        short n;
+        ushort q;
+        int i;
+        uint u;
+        qlonglong x;
+        qulonglong t;
+        double d;
+    };
+
+    inline explicit QDBusSlotArguments(int count)
+        : basics(count), strings(count), variants(count), pointers(count)
+    { }
+
+    QVarLengthArray<Basic, 8> basics;
+    QVarLengthArray<QString, 8> strings;
+    QVarLengthArray<QVariant, 8> variants;
+    QVarLengthArray<void *, 8> pointers; // what the slot's argv gets
+};
 
 /*!
     \internal
@@ -52,6 +83,8 @@ public:
     static void listToMessage(const QList<QVariant> &list, DBusMessage *message,
                               const QString& signature);
     static void messageToList(QList<QVariant> &list, DBusMessage *message);
+    static int messageToArguments(DBusMessage *message, const QList<int> &metaTypes, int count,
+                                  QDBusSlotArguments &arguments);
 };
 
 #endif
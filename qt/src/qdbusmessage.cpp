@@ -40,6 +40,19 @@ QDBusMessagePrivate::QDBusMessagePrivate()
 {
 }
 
+QDBusMessagePrivate::QDBusMessagePrivate(const QDBusMessagePrivate &other)
+    : service(other.service), path(other.path), interface(other.interface), name(other.name),
+      message(other.message), signature(other.signature), connection(other.connection),
+      msg(other.msg), arguments(other.arguments), reply(other.reply), type(other.type),
+      timeout(other.timeout), ref(1), repliedTo(other.repliedTo)
+{
+    // used when detaching
+    if (msg)
+        dbus_message_ref(msg);
+    if (reply)
+        dbus_message_ref(reply);
+}
+
 QDBusMessagePrivate::~QDBusMessagePrivate()
 {
     if (msg)
@@ -242,7 +255,36 @@ static inline const char *data(const QByteArray &arr)
 DBusMessage *QDBusMessage::toDBusMessage() const
 {
     DBusMessage *msg = 0;
-    
+
+    if (d_ptr->msg && (d_ptr->type == DBUS_MESSAGE_TYPE_METHOD_CALL ||
+                       d_ptr->type == DBUS_MESSAGE_TYPE_SIGNAL)) {
+        // A received message is being forwarded. If its arguments are still the ones that were
+        // read from it (the list was not detached), copy the message, which shares the body,
+        // instead of marshalling them again, and only update the header.
+        if (constBegin() == d_ptr->arguments.constBegin() &&
+            d_ptr->signature == QString::fromUtf8(dbus_message_get_signature(d_ptr->msg))) {
+            msg = dbus_message_copy(d_ptr->msg);
+            if (!msg)
+                return 0;
+
+            bool isCall = d_ptr->type == DBUS_MESSAGE_TYPE_METHOD_CALL;
+            if (!dbus_message_set_path(msg, data(d_ptr->path.toUtf8())) ||
+                !dbus_message_set_interface(msg, data(d_ptr->interface.toUtf8())) ||
+                !dbus_message_set_member(msg, data(d_ptr->name.toUtf8())) ||
+                !dbus_message_set_destination(msg, isCall ? data(d_ptr->service.toUtf8()) : 0) ||
+                !dbus_message_set_sender(msg, 0)) {
+                dbus_message_unref(msg);
+                return 0;
+            }
+
+            // the flags are the received message's; give the copy those of a new message, as if
+            // the arguments had been marshalled again
+            dbus_message_set_no_reply(msg, FALSE);
+            dbus_message_set_auto_start(msg, TRUE);
+            return msg;
+        }
+    }
+
     switch (d_ptr->type) {
     case DBUS_MESSAGE_TYPE_METHOD_CALL:
         msg = dbus_message_new_method_call(data(d_ptr->service.toUtf8()), data(d_ptr->path.toUtf8()),
@@ -271,6 +313,23 @@ DBusMessage *QDBusMessage::toDBusMessage() const
     Constructs a QDBusMessage by parsing the given DBusMessage object.
 */
 QDBusMessage QDBusMessage::fromDBusMessage(DBusMessage *dmsg, const QDBusConnection &connection)
+{
+    QDBusMessage message = fromDBusMessageHeader(dmsg, connection);
+    if (dmsg) {
+        QDBusMarshall::messageToList(message, dmsg);
+        qAtomicDetach(message.d_ptr);
+        message.d_ptr->arguments = message;
+    }
+    return message;
+}
+
+/*!
+    \internal
+    Constructs a QDBusMessage from the header fields of the given DBusMessage object, without
+    demarshalling the arguments. They can be read later from the DBusMessage kept in d_ptr->msg.
+*/
+QDBusMessage QDBusMessage::fromDBusMessageHeader(DBusMessage *dmsg,
+                                                 const QDBusConnection &connection)
 {
     QDBusMessage message;
     if (!dmsg)
@@ -287,7 +346,6 @@ QDBusMessage QDBusMessage::fromDBusMessage(DBusMessage *dmsg, const QDBusConnect
     message.d_ptr->signature = QString::fromUtf8(dbus_message_get_signature(dmsg));
     message.d_ptr->msg = dbus_message_ref(dmsg);
 
-    QDBusMarshall::messageToList(message, dmsg);
     return message;
 }
 
@@ -312,6 +370,21 @@ QString QDBusMessage::path() const
     return d_ptr->path;
 }
 
+/*!
+    Sets the path of the object this message is sent to (in the case of a method call) or
+    emitted from (in the case of a signal) to \a path.
+
+    Changing the path of a received message does not change its arguments: if it is sent again
+    without modifying them, the arguments are not marshalled again.
+
+    \sa setService()
+*/
+void QDBusMessage::setPath(const QString &path)
+{
+    qAtomicDetach(d_ptr);
+    d_ptr->path = path;
+}
+
 /*!
     Returns the interface of the method being called (in the case of a method call) or of
     the signal being received from.
@@ -350,6 +423,21 @@ QString QDBusMessage::service() const
     return d_ptr->service;
 }
 
+/*!
+    Sets the name of the service this method call is sent to to \a service. This is the way to
+    forward a method call that was received: set the new destination and send the message.
+
+    If the arguments of a received message are left unchanged, they are not marshalled again
+    when it is sent: the new message shares their encoded form with the received one.
+
+    \sa setPath()
+*/
+void QDBusMessage::setService(const QString &service)
+{
+    qAtomicDetach(d_ptr);
+    d_ptr->service = service;
+}
+
 /*!
     \fn QDBusMessage::sender() const
     Returns the unique name of the remote sender.
@@ -557,6 +645,13 @@ QDBusMessage::MessageType QDBusMessage::type() const
     This function is not available if the remote call returns \c void.
 */
 
+/*!
+    \internal
+    \fn QDBusReply::fromValue(const Type &value)
+    Constructs a success reply containing \a value. This is used by the code generated by
+    dbusidl2cpp -s, which reads the reply arguments itself.
+*/
+
 /*!
     \internal
     \fn QDBusReply::fromVariant(const QDBusReply<QVariant> &variantReply)
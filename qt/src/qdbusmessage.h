@@ -62,11 +62,13 @@ public:
     static QDBusMessage error(const QDBusMessage &other, const QDBusError &error);
 
     QString path() const;
+    void setPath(const QString &path);
     QString interface() const;
     QString name() const;
     inline QString member() const { return name(); }
     inline QString method() const { return name(); }
     QString service() const;
+    void setService(const QString &service);
     inline QString sender() const { return service(); }
     MessageType type() const;
 
@@ -87,6 +89,7 @@ public:
 private:
     DBusMessage *toDBusMessage() const;
     static QDBusMessage fromDBusMessage(DBusMessage *dmsg, const QDBusConnection &connection);
+    static QDBusMessage fromDBusMessageHeader(DBusMessage *dmsg, const QDBusConnection &connection);
     static QDBusMessage fromError(const QDBusError& error);
     QDBusMessagePrivate *d_ptr;
 };
@@ -26,7 +26,9 @@
 #define QDBUSMESSAGE_P_H
 
 #include <qatomic.h>
+#include <qlist.h>
 #include <qstring.h>
+#include <qvariant.h>
 #include "qdbusconnection.h"
 struct DBusMessage;
 
@@ -34,11 +36,13 @@ class QDBusMessagePrivate
 {
 public:
     QDBusMessagePrivate();
+    QDBusMessagePrivate(const QDBusMessagePrivate &other);
     ~QDBusMessagePrivate();
 
     QString service, path, interface, name, message, signature;
     QDBusConnection connection;
     DBusMessage *msg;
+    QList<QVariant> arguments;  // as read from msg; see QDBusMessage::toDBusMessage
     DBusMessage *reply;
     int type;
     int timeout;
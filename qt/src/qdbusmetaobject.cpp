@@ -24,14 +24,22 @@
 #include "qdbusmetaobject_p.h"
 
 #include <QtCore/qbytearray.h>
+#include <QtCore/qfile.h>
 #include <QtCore/qhash.h>
 #include <QtCore/qstring.h>
+#include <QtCore/qstringlist.h>
 #include <QtCore/qvarlengtharray.h>
 
+#include <stdio.h>              // rename
+#include <stdlib.h>             // getenv, mkstemp
+#include <sys/stat.h>           // fchmod
+#include <unistd.h>             // close, unlink
+
 #include "qdbusutil.h"
 #include "qdbuserror.h"
 #include "qdbusintrospection_p.h"
 #include "qdbusabstractinterface_p.h"
+#include "qdbustype_p.h"
 
 class QDBusMetaObjectGenerator
 {
@@ -41,6 +49,10 @@ public:
     void write(QDBusMetaObject *obj);
     void writeWithoutXml(QDBusMetaObject *obj);
 
+    // sizes of the tables created by write()
+    int dataSize;
+    int stringSize;
+
 private:
     struct Method {
         QByteArray parameters;
@@ -127,7 +139,7 @@ struct QDBusMetaObjectPrivate
 
 QDBusMetaObjectGenerator::QDBusMetaObjectGenerator(const QString &interfaceName,
                                                    const QDBusIntrospection::Interface *parsedData)
-    : data(parsedData), interface(interfaceName)
+    : dataSize(0), stringSize(0), data(parsedData), interface(interfaceName)
 {
     if (data) {
         parseProperties();
@@ -403,6 +415,9 @@ void QDBusMetaObjectGenerator::write(QDBusMetaObject *obj)
     uint *uint_data = new uint[idata.size()];
     memcpy(uint_data, idata.data(), idata.size() * sizeof(int));
 
+    dataSize = idata.size();
+    stringSize = stringdata.length();
+
     // put the metaobject together
     obj->d.data = uint_data;
     obj->d.extradata = 0;
@@ -434,14 +449,307 @@ void QDBusMetaObjectGenerator::writeWithoutXml(const QString &interface)
 }
 #endif
 
+/////////
+// the disk cache
+//
+// If QDBUS_METAOBJECT_CACHE is set to a directory, the tables that QDBusMetaObjectGenerator
+// creates are saved there, one file per interface, so that other processes can load them instead
+// of introspecting and parsing the XML again. The files are flat: a header followed by the integer
+// table and the string table, with offsets instead of pointers. The only thing that depends on
+// the process is the metatype ids of the non-builtin types, which are recomputed from the D-Bus
+// signatures on load.
+//
+// Remote objects are still introspected: a file is only used when the document they return is
+// one we have seen before. Each introspection document we parse is recorded (by hash) with the
+// list of interfaces it contained and the hashes of their descriptions, and the files are loaded
+// from there, so that parsing is skipped unless the document or one of the files changed since.
+// A file is rewritten whenever we parse a newer description of its interface.
+//
+// The files are not trusted: anything that doesn't check out makes us parse the XML again, and a
+// file that doesn't load is removed so that it gets written again.
+
+static const char metaObjectCacheMagic[4] = { 'Q', 'D', 'M', 'O' };
+enum { MetaObjectCacheVersion = 1 };
+
+struct QDBusMetaObjectCacheHeader
+{
+    char magic[4];
+    quint32 version;
+    quint32 hashLow, hashHigh;  // of the interface's XML description
+    quint32 dataSize;           // in ints
+    quint32 stringSize;         // in bytes
+};
+
+static QString qDBusMetaObjectCacheDir()
+{
+    const char *dir = getenv("QDBUS_METAOBJECT_CACHE");
+    if (!dir || !*dir)
+        return QString();
+    return QFile::decodeName(dir);
+}
+
+// 64-bit FNV-1a
+static quint64 qDBusHash(const QString &str)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    const uchar *p = reinterpret_cast<const uchar *>(str.constData());
+    const uchar *end = p + str.length() * sizeof(QChar);
+    for ( ; p != end; ++p) {
+        hash ^= *p;
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+static inline QString qMetaObjectFileName(const QString &dir, const QString &interface)
+{
+    return dir + QLatin1Char('/') + interface + QLatin1String(".qdbusmo");
+}
+
+static inline QString qIndexFileName(const QString &dir, quint64 hash)
+{
+    return dir + QLatin1Char('/') + QString::number(hash, 16) + QLatin1String(".qdbusidx");
+}
+
+// writes to a temporary file first, so that readers never see half a file
+// the temporary file has a unique name, so that concurrent writers don't write to the same one
+static bool qWriteCacheFile(const QString &fileName, const QByteArray &contents)
+{
+    QByteArray tmpName = QFile::encodeName(fileName) + ".XXXXXX";
+    int fd = ::mkstemp(tmpName.data());
+    if (fd == -1)
+        return false;
+    ::fchmod(fd, 0644);         // mkstemp creates it readable by us only
+
+    QFile file;
+    bool ok = file.open(fd, QIODevice::WriteOnly) && file.write(contents) == contents.size();
+    file.close();               // doesn't close fd
+    ::close(fd);
+
+    if (!ok || ::rename(tmpName, QFile::encodeName(fileName)) != 0) {
+        ::unlink(tmpName);
+        return false;
+    }
+    return true;
+}
+
+static void qSaveMetaObject(const QString &dir, const QString &interface, quint64 hash,
+                            const QDBusMetaObject *obj, int dataSize, int stringSize)
+{
+    QDBusMetaObjectCacheHeader header;
+    memcpy(header.magic, metaObjectCacheMagic, sizeof header.magic);
+    header.version = MetaObjectCacheVersion;
+    header.hashLow = quint32(hash);
+    header.hashHigh = quint32(hash >> 32);
+    header.dataSize = dataSize;
+    header.stringSize = stringSize;
+
+    QByteArray contents;
+    contents.reserve(sizeof header + dataSize * sizeof(uint) + stringSize);
+    contents.append(reinterpret_cast<const char *>(&header), sizeof header);
+    contents.append(reinterpret_cast<const char *>(obj->d.data), dataSize * sizeof(uint));
+    contents.append(obj->d.stringdata, stringSize);
+
+    qWriteCacheFile(qMetaObjectFileName(dir, interface), contents);
+}
+
+// returns the hash stored in the file for the interface, or 0 if there's none
+static quint64 qCachedMetaObjectHash(const QString &dir, const QString &interface)
+{
+    QFile file(qMetaObjectFileName(dir, interface));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+
+    QDBusMetaObjectCacheHeader header;
+    if (file.read(reinterpret_cast<char *>(&header), sizeof header) != sizeof header ||
+        memcmp(header.magic, metaObjectCacheMagic, sizeof header.magic) != 0 ||
+        header.version != MetaObjectCacheVersion)
+        return 0;
+
+    return quint64(header.hashHigh) << 32 | header.hashLow;
+}
+
+// recomputes the metatype ids in a list written by QDBusMetaObjectGenerator::write
+static bool qFixTypeList(uint *data, uint dataSize, uint offset, const char *signature)
+{
+    QDBusTypeList types(signature);
+    if (offset >= dataSize || data[offset] != uint(types.count()) ||
+        offset + types.count() >= dataSize)
+        return false;
+
+    for (int i = 0; i < types.count(); ++i) {
+        int typeId = QDBusUtil::signatureToType(QString::fromLatin1(types.at(i).dbusSignature()));
+        if (typeId == QVariant::Invalid)
+            return false;
+        data[offset + 1 + i] = typeId;
+    }
+    return true;
+}
+
+// checks that the count entries of size ints each, starting at offset, are inside the table
+static inline bool qCheckTable(uint dataSize, int offset, int count, int size)
+{
+    return offset >= 0 && count >= 0 &&
+        quint64(offset) + quint64(count) * quint64(size) <= dataSize;
+}
+
+// checks that the first count ints of each entry are offsets inside the string table
+static bool qCheckStrings(const uint *data, int offset, int count, int size, int strings,
+                          uint stringSize)
+{
+    for (int i = 0; i < count; ++i)
+        for (int j = 0; j < strings; ++j)
+            if (data[offset + i * size + j] >= stringSize)
+                return false;
+    return true;
+}
+
+// fills in the tables of obj, which takes ownership of them even if this fails
+// if hash isn't 0, the file must have been generated from the description with that hash
+static bool qLoadMetaObject(const QString &dir, const QString &interface, quint64 hash,
+                            QDBusMetaObject *obj)
+{
+    QFile file(qMetaObjectFileName(dir, interface));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray contents = file.readAll();
+
+    QDBusMetaObjectCacheHeader header;
+    if (uint(contents.size()) < sizeof header)
+        return false;
+    memcpy(&header, contents.constData(), sizeof header);
+    if (memcmp(header.magic, metaObjectCacheMagic, sizeof header.magic) != 0 ||
+        header.version != MetaObjectCacheVersion ||
+        (hash && (header.hashLow != quint32(hash) || header.hashHigh != quint32(hash >> 32))) ||
+        header.dataSize < sizeof(QDBusMetaObjectPrivate) / sizeof(int) ||
+        header.stringSize == 0 ||
+        quint64(contents.size()) != sizeof header + quint64(header.dataSize) * sizeof(uint) +
+                                    header.stringSize)
+        return false;
+
+    uint *data = new uint[header.dataSize];
+    memcpy(data, contents.constData() + sizeof header, header.dataSize * sizeof(uint));
+    char *stringdata = new char[header.stringSize];
+    memcpy(stringdata, contents.constData() + sizeof header + header.dataSize * sizeof(uint),
+           header.stringSize);
+
+    obj->d.data = data;
+    obj->d.stringdata = stringdata;
+
+    // QMetaObject trusts every offset in its tables, so check them all against what
+    // QDBusMetaObjectGenerator::write creates: no class info nor enumerators, five ints per
+    // method and three per property, the first ones being strings
+    const QDBusMetaObjectPrivate *layout = reinterpret_cast<const QDBusMetaObjectPrivate *>(data);
+    uint dataSize = header.dataSize;
+    uint stringSize = header.stringSize;
+    bool ok = stringdata[stringSize - 1] == '\0' &&
+              layout->revision == 1 &&
+              uint(layout->className) < stringSize &&
+              layout->classInfoCount == 0 && layout->enumeratorCount == 0 &&
+              qCheckTable(dataSize, layout->methodData, layout->methodCount, 5) &&
+              qCheckTable(dataSize, layout->propertyData, layout->propertyCount, 3) &&
+              qCheckTable(dataSize, layout->methodDBusData, layout->methodCount, intsPerMethod) &&
+              qCheckTable(dataSize, layout->propertyDBusData, layout->propertyCount,
+                          intsPerProperty) &&
+              qCheckStrings(data, layout->methodData, layout->methodCount, 5, 4, stringSize) &&
+              qCheckStrings(data, layout->propertyData, layout->propertyCount, 3, 2, stringSize);
+
+    // the ids of the types that aren't builtin depend on the order in which they were registered
+    for (int i = 0; ok && i < layout->methodCount; ++i) {
+        const uint *handle = data + layout->methodDBusData + i * intsPerMethod;
+        ok = handle[0] < stringSize && handle[1] < stringSize &&
+             qFixTypeList(data, dataSize, handle[2], stringdata + handle[0]) &&
+             qFixTypeList(data, dataSize, handle[3], stringdata + handle[1]);
+    }
+    for (int i = 0; ok && i < layout->propertyCount; ++i) {
+        uint *handle = data + layout->propertyDBusData + i * intsPerProperty;
+        ok = handle[0] < stringSize;
+        if (ok) {
+            handle[1] = QDBusUtil::signatureToType(QString::fromLatin1(stringdata + handle[0]));
+            ok = handle[1] != uint(QVariant::Invalid);
+        }
+    }
+
+    return ok;
+}
+
 /////////
 // class QDBusMetaObject
 
+/*!
+    \internal
+    Loads the meta object for \a interface from the disk cache, if it is enabled and has it, and
+    adds it to \a cache. If \a hash isn't 0, the cached meta object must have been generated from
+    the description with that hash.
+*/
+QDBusMetaObject *QDBusMetaObject::loadFromDiskCache(const QString &interface,
+                                                    QHash<QString, QDBusMetaObject *> &cache,
+                                                    quint64 hash)
+{
+    QString dir = qDBusMetaObjectCacheDir();
+    if (dir.isEmpty() || interface.isEmpty() || interface.startsWith(QLatin1String("local.")))
+        return 0;
+
+    QDBusMetaObject *obj = new QDBusMetaObject;
+    obj->d.data = 0;
+    obj->d.extradata = 0;
+    obj->d.stringdata = 0;
+    obj->d.superdata = &QDBusAbstractInterface::staticMetaObject;
+    obj->cached = true;
+    if (!qLoadMetaObject(dir, interface, hash, obj)) {
+        delete obj;
+
+        // a file for another description of the interface is fine: it is rewritten by whoever
+        // parses the newer one; anything else is damaged
+        quint64 stored = qCachedMetaObjectHash(dir, interface);
+        if (!hash || !stored || stored == hash)
+            QFile::remove(qMetaObjectFileName(dir, interface));
+        return 0;
+    }
+
+    cache.insert(interface, obj);
+    return obj;
+}
+
 QDBusMetaObject *QDBusMetaObject::createMetaObject(const QString &interface, const QString &xml,
                                                    QHash<QString, QDBusMetaObject *> &cache,
                                                    QDBusError &error)
 {
     error = QDBusError();
+
+    QString cacheDir = qDBusMetaObjectCacheDir();
+    quint64 xmlHash = 0;
+    if (!cacheDir.isEmpty() && !interface.isEmpty()) {
+        // have we seen this document before?
+        xmlHash = qDBusHash(xml);
+        QFile index(qIndexFileName(cacheDir, xmlHash));
+        if (index.open(QIODevice::ReadOnly)) {
+            // one "interface hash" line per interface
+            QStringList lines = QString::fromUtf8(index.readAll()).split(QLatin1Char('\n'),
+                                                                      QString::SkipEmptyParts);
+            QDBusMetaObject *we = 0;
+            bool ok = true;
+            foreach (const QString &line, lines) {
+                QStringList fields = line.split(QLatin1Char(' '));
+                quint64 hash = fields.count() == 2 ? fields.at(1).toULongLong(0, 16) : 0;
+                QDBusMetaObject *obj = 0;
+                if (hash) {
+                    obj = cache.value(fields.at(0), 0);
+                    if (!obj)
+                        obj = loadFromDiskCache(fields.at(0), cache, hash);
+                }
+                if (!obj) {
+                    ok = false;
+                    break;
+                }
+                if (fields.at(0) == interface)
+                    we = obj;
+            }
+            if (ok && we)
+                return we;
+        }
+    }
+
     QDBusIntrospection::Interfaces parsed = QDBusIntrospection::parseInterfaces(xml);
 
     QDBusMetaObject *we = 0;
@@ -456,10 +764,18 @@ QDBusMetaObject *QDBusMetaObject::createMetaObject(const QString &interface, con
             QDBusMetaObjectGenerator generator(it.key(), it.value().constData());
             generator.write(obj);
 
-            if ( (obj->cached = !it.key().startsWith( QLatin1String("local.") )) )
+            if ( (obj->cached = !it.key().startsWith( QLatin1String("local.") )) ) {
                 // cache it
                 cache.insert(it.key(), obj);
 
+                if (!cacheDir.isEmpty()) {
+                    // and save it, unless the same description is there already
+                    quint64 hash = qDBusHash(it.value()->introspection);
+                    if (hash != qCachedMetaObjectHash(cacheDir, it.key()))
+                        qSaveMetaObject(cacheDir, it.key(), hash, obj,
+                                        generator.dataSize, generator.stringSize);
+                }
+            }
         }
 
         if (it.key() == interface)
@@ -467,6 +783,16 @@ QDBusMetaObject *QDBusMetaObject::createMetaObject(const QString &interface, con
             we = obj;
     }
 
+    if (xmlHash && !parsed.isEmpty()) {
+        // remember which interfaces this document has
+        QStringList lines;
+        for (it = parsed.constBegin(); it != end; ++it)
+            if (!it.key().startsWith(QLatin1String("local.")))
+                lines << it.key() + QLatin1Char(' ') +
+                         QString::number(qDBusHash(it.value()->introspection), 16);
+        qWriteCacheFile(qIndexFileName(cacheDir, xmlHash), lines.join(QLatin1String("\n")).toUtf8());
+    }
+
     if (we)
         return we;
     // still nothing?
@@ -49,6 +49,9 @@ struct QDBUS_EXPORT QDBusMetaObject: public QMetaObject
     static QDBusMetaObject *createMetaObject(const QString &interface, const QString &xml,
                                              QHash<QString, QDBusMetaObject *> &map,
                                              QDBusError &error);
+    static QDBusMetaObject *loadFromDiskCache(const QString &interface,
+                                              QHash<QString, QDBusMetaObject *> &map,
+                                              quint64 hash = 0);
     ~QDBusMetaObject()
     {
         delete [] d.stringdata;
@@ -86,6 +86,13 @@ public:
         return m_data;
     }
 
+    static QDBusReply<T> fromValue(const Type &value)
+    {
+        QDBusReply<T> retval;
+        retval.m_data = value;
+        return retval;
+    }
+
     static QDBusReply<T> fromVariant(const QDBusReply<QVariant> &variantReply)
     {
         QDBusReply<T> retval;
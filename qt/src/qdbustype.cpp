@@ -26,21 +26,111 @@
 #include "qdbustypehelper_p.h"
 #include <dbus/dbus.h>
 
+#include <QtCore/qhash.h>
+#include <QtCore/qreadwritelock.h>
 #include <QtCore/qstringlist.h>
+#include <QtCore/qvarlengtharray.h>
 
 class QDBusTypePrivate: public QSharedData
 {
 public:
     int code;
-    mutable int qvariantType;
+    mutable int qvariantType;   // -1 if not computed yet
     mutable QByteArray signature;
     QDBusTypeList subTypes;
 
     inline QDBusTypePrivate()
-        : code(0), qvariantType(QVariant::Invalid)
+        : code(0), qvariantType(-1)
     { }
 };
 
+// The intern table
+//
+// Parsing a signature allocates a whole tree of QDBusTypePrivate, and the same few signatures
+// are parsed over and over for every message. So the types and type lists built from signatures
+// are kept here and shared. The trees are never modified once they are in the table: their
+// lazily-computed fields are filled in before they are inserted, and QSharedDataPointer detaches
+// anyone who tries to write to them.
+//
+// The table must not grow forever if the signatures are generated, so it is emptied when it is
+// full and filled again from there. The marshalling plan cache in qdbusmarshall.cpp does the
+// same. Emptying is cheap, since whoever holds a type keeps sharing it, and the signatures still
+// in use come back at once; a table that stopped accepting entries instead would keep the first
+// ones it saw forever, even if they were never used again.
+struct QDBusTypeInternTable
+{
+    enum { MaxEntries = 1024 };
+
+    QReadWriteLock lock;
+    QHash<QByteArray, QDBusType> types;
+    QHash<QByteArray, QDBusTypeList> lists;
+};
+Q_GLOBAL_STATIC(QDBusTypeInternTable, qDBusTypeInternTable)
+
+/*!
+    \internal
+    Computes the data that QDBusType computes on first use, in \a type and in all of its subtypes,
+    so that it can be shared between threads without being written to.
+*/
+void qDBusPrepareType(const QDBusType &type)
+{
+    type.dbusSignature();
+    type.qvariantType();
+    foreach (const QDBusType &sub, type.subTypes())
+        qDBusPrepareType(sub);
+}
+
+template<typename T>
+static bool qFindInterned(const QHash<QByteArray, T> QDBusTypeInternTable::*hash,
+                          const char *signature, T &result)
+{
+    QDBusTypeInternTable *table = qDBusTypeInternTable();
+    if (!table)
+        return false;           // being destroyed
+
+    // doesn't allocate
+    QByteArray key = QByteArray::fromRawData(signature, qstrlen(signature));
+
+    QReadLocker locker(&table->lock);
+    typename QHash<QByteArray, T>::ConstIterator it = (table->*hash).constFind(key);
+    if (it == (table->*hash).constEnd())
+        return false;
+
+    result = it.value();
+    return true;
+}
+
+template<typename T>
+static void qIntern(QHash<QByteArray, T> QDBusTypeInternTable::*hash,
+                    const char *signature, const T &value)
+{
+    QDBusTypeInternTable *table = qDBusTypeInternTable();
+    if (!table)
+        return;
+
+    QWriteLocker locker(&table->lock);
+    if ((table->*hash).count() >= QDBusTypeInternTable::MaxEntries)
+        (table->*hash).clear();
+    (table->*hash).insert(QByteArray(signature), value);
+}
+
+// converts a signature in a QString to a nul-terminated string, without allocating for the
+// usual (short) signatures. Signatures are pure ASCII, so anything else makes it invalid.
+static bool qSignatureFromString(const QString &str, QVarLengthArray<char, 64> &buffer)
+{
+    int len = str.length();
+    buffer.resize(len + 1);
+    const QChar *data = str.constData();
+    for (int i = 0; i < len; ++i) {
+        ushort c = data[i].unicode();
+        if (c == 0 || c > 0x7f)
+            return false;
+        buffer[i] = char(c);
+    }
+    buffer[len] = '\0';
+    return true;
+}
+
 /*!
     \class QDBusType
     \brief Represents one single D-Bus type.
@@ -132,14 +222,22 @@ QDBusType::QDBusType(QVariant::Type type)
 */
 QDBusType::QDBusType(const char* signature)
 {
+    if (!signature)
+        return;
+    if (qFindInterned(&QDBusTypeInternTable::types, signature, *this))
+        return;
+
     if ( !dbus_signature_validate_single(signature, 0) )
         return;
 
     DBusSignatureIter iter;
     dbus_signature_iter_init(&iter, signature);
     *this = QDBusType(&iter);
-    if (d)
+    if (d) {
         d->signature = signature;
+        qDBusPrepareType(*this);
+        qIntern(&QDBusTypeInternTable::types, signature, *this);
+    }
 }
 
 /*!
@@ -148,7 +246,9 @@ QDBusType::QDBusType(const char* signature)
 */
 QDBusType::QDBusType(const QString& str)
 {
-    *this = QDBusType( str.toUtf8().constData() );
+    QVarLengthArray<char, 64> buffer;
+    if (qSignatureFromString(str, buffer))
+        *this = QDBusType( buffer.constData() );
 }
 
 /*!
@@ -283,7 +383,7 @@ QByteArray QDBusType::dbusSignature() const
 */
 int QDBusType::qvariantType() const
 {
-    if (d && d->qvariantType != QVariant::Invalid)
+    if (d && d->qvariantType != -1)
         return d->qvariantType;
 
     if (!d)
@@ -796,6 +896,8 @@ QDBusTypeList::QDBusTypeList(const char* signature)
 {
     if (!signature || !*signature)
         return;                 // empty
+    if (qFindInterned(&QDBusTypeInternTable::lists, signature, *this))
+        return;
 
     // validate it first
     if ( !dbus_signature_validate(signature, 0) )
@@ -806,8 +908,12 @@ QDBusTypeList::QDBusTypeList(const char* signature)
     dbus_signature_iter_init(&iter, signature);
 
     do {
-        *this << QDBusType(&iter);
+        QDBusType type(&iter);
+        qDBusPrepareType(type);
+        *this << type;
     } while (dbus_signature_iter_next(&iter));
+
+    qIntern(&QDBusTypeInternTable::lists, signature, *this);
 }
 
 /*!
@@ -106,4 +106,6 @@ public:
     QByteArray dbusSignature() const;
 };
 
+void qDBusPrepareType(const QDBusType &type);
+
 #endif // QDBUSTYPE_H
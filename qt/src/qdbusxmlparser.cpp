@@ -28,214 +28,507 @@
 #include "qdbusconnection_p.h"
 #include "qdbusutil.h"
 
-#include <QtXml/qdom.h>
+#include <QtXml/qxml.h>
 #include <QtCore/qmap.h>
-#include <QtCore/qvariant.h>
-#include <QtCore/qtextstream.h>
-
-static QDBusIntrospection::Annotations
-parseAnnotations(const QDomElement& elem)
+#include <QtCore/qvector.h>
+
+// The introspection data is read in a single pass: the SAX reader hands us the elements
+// in document order and we fill in the QDBusIntrospection structures as we go, without
+// building a DOM tree first. Like QDomDocument did, we accept broken documents up to the
+// point where the reader gives up; whatever is still open then is closed as if the
+// document had ended there.
+//
+// Each element belongs to the nearest enclosing element that can hold it: an <arg> to the
+// nearest <method> or <signal>, a <method> to the nearest <interface>, an <interface> to
+// the nearest <node> and so on.
+
+class QDBusXmlHandler: public QXmlDefaultHandler
 {
-    QDBusIntrospection::Annotations retval;
-    QDomNodeList list = elem.elementsByTagName(QLatin1String("annotation"));
-    for (int i = 0; i < list.count(); ++i)
+public:
+    enum Mode {
+        InterfacesMode,         // the interfaces of the top-level node only
+        ObjectMode,             // the names of the interfaces and sub-objects of the top-level node
+        ObjectTreeMode          // everything, recursively
+    };
+
+    QDBusXmlHandler(const QString &service, const QString &path, Mode mode);
+    ~QDBusXmlHandler();
+
+    bool startElement(const QString &namespaceURI, const QString &localName,
+                      const QString &qName, const QXmlAttributes &atts);
+    bool endElement(const QString &namespaceURI, const QString &localName,
+                    const QString &qName);
+
+    QDBusIntrospection::ObjectTree *finish();
+
+private:
+    struct Frame
+    {
+        enum Kind {
+            Other = 0,
+            Node = 1,
+            Interface = 2,
+            Method = 4,
+            Signal = 8,
+            Property = 16
+        };
+
+        int kind;
+        bool hasChildren;
+        QString tag;
+        QString name;
+
+        // at most one of these is set: the one matching kind, if the element was valid
+        QDBusIntrospection::ObjectTree *node;
+        QDBusIntrospection::Interface *interface;
+        QDBusIntrospection::Method *method;
+        QDBusIntrospection::Signal *signal;
+        QDBusIntrospection::Property *property;
+    };
+
+    // an element whose XML text we're saving (in Object::introspection or
+    // Interface::introspection), starting at the given depth
+    struct Capture
     {
-        QDomElement ann = list.item(i).toElement();
-        if (ann.isNull())
-            continue;
+        QString *xml;
+        int depth;
+    };
+
+    QString service;
+    QString path;
+    Mode mode;
+    bool tagOpen;
+    QDBusIntrospection::ObjectTree *root;
+    QVector<Frame> stack;
+    QVector<Capture> captures;
+
+    Frame *findFrame(int kinds);
+    void startNode(Frame &frame, const QXmlAttributes &atts);
+    void startInterface(Frame &frame, const QXmlAttributes &atts);
+    void startMember(Frame &frame, const QXmlAttributes &atts);
+    void addAnnotation(const QXmlAttributes &atts);
+    void addArgument(const QXmlAttributes &atts);
+    void closeElement();
+    void capture(QString *xml);
+    void writeStartTag(const QString &tag, const QXmlAttributes &atts);
+    void writeEndTag(const QString &tag);
+};
+
+static QString escapeAttribute(const QString &value)
+{
+    QString retval = value;
+    retval.replace(QLatin1Char('&'), QLatin1String("&amp;"));
+    retval.replace(QLatin1Char('<'), QLatin1String("&lt;"));
+    retval.replace(QLatin1Char('>'), QLatin1String("&gt;"));
+    retval.replace(QLatin1Char('"'), QLatin1String("&quot;"));
+    return retval;
+}
 
-        QString name = ann.attribute(QLatin1String("name")),
-               value = ann.attribute(QLatin1String("value"));
+QDBusXmlHandler::QDBusXmlHandler(const QString &s, const QString &p, Mode m)
+    : service(s), path(p), mode(m), tagOpen(false), root(0)
+{
+}
 
-        if (!QDBusUtil::isValidInterfaceName(name)) {
-            qWarning("Invalid D-BUS annotation '%s' found while parsing introspection",
-                     qPrintable(name));
-            continue;
-        }
+QDBusXmlHandler::~QDBusXmlHandler()
+{
+    delete finish();
+}
+
+QDBusXmlHandler::Frame *QDBusXmlHandler::findFrame(int kinds)
+{
+    for (int i = stack.count() - 1; i >= 0; --i)
+        if (stack[i].kind & kinds)
+            return &stack[i];
+    return 0;
+}
 
-        retval.insert(name, value);
+bool QDBusXmlHandler::startElement(const QString &, const QString &, const QString &qName,
+                                   const QXmlAttributes &atts)
+{
+    // the document element must be a <node>, or there's nothing for us in here
+    if (stack.isEmpty() && (root || qName != QLatin1String("node")))
+        return false;
+
+    if (tagOpen) {
+        // the parent element has children, so finish its start tag
+        for (int i = 0; i < captures.count(); ++i)
+            captures[i].xml->append(QLatin1String(">\n"));
+        tagOpen = false;
     }
+    if (!stack.isEmpty())
+        stack.last().hasChildren = true;
+
+    Frame frame;
+    frame.kind = Frame::Other;
+    frame.hasChildren = false;
+    frame.tag = qName;
+    frame.node = 0;
+    frame.interface = 0;
+    frame.method = 0;
+    frame.signal = 0;
+    frame.property = 0;
+
+    if (qName == QLatin1String("node"))
+        startNode(frame, atts);
+    else if (qName == QLatin1String("interface"))
+        startInterface(frame, atts);
+    else if (qName == QLatin1String("method") || qName == QLatin1String("signal") ||
+             qName == QLatin1String("property"))
+        startMember(frame, atts);
+    else if (qName == QLatin1String("annotation"))
+        addAnnotation(atts);
+    else if (qName == QLatin1String("arg"))
+        addArgument(atts);
+
+    writeStartTag(qName, atts);
+    stack.append(frame);
+    return true;
+}
 
+bool QDBusXmlHandler::endElement(const QString &, const QString &, const QString &)
+{
+    closeElement();
+    return true;
+}
+
+QDBusIntrospection::ObjectTree *QDBusXmlHandler::finish()
+{
+    // close anything the reader left open
+    while (!stack.isEmpty())
+        closeElement();
+
+    QDBusIntrospection::ObjectTree *retval = root;
+    root = 0;
     return retval;
 }
 
-static QDBusIntrospection::Arguments
-parseArgs(const QDomElement& elem, const QLatin1String& direction, bool acceptEmpty = false)
+void QDBusXmlHandler::startNode(Frame &frame, const QXmlAttributes &atts)
 {
-    QDBusIntrospection::Arguments retval;
-    QDomNodeList list = elem.elementsByTagName(QLatin1String("arg"));
-    for (int i = 0; i < list.count(); ++i)
-    {
-        QDomElement arg = list.item(i).toElement();
-        if (arg.isNull())
-            continue;
-
-        if ((acceptEmpty && !arg.hasAttribute(QLatin1String("direction"))) ||
-            arg.attribute(QLatin1String("direction")) == direction) {
-
-            QDBusIntrospection::Argument argData;
-            if (arg.hasAttribute(QLatin1String("name")))
-                argData.name = arg.attribute(QLatin1String("name")); // can be empty
-            argData.type = arg.attribute(QLatin1String("type"));
-            if (!QDBusUtil::isValidSingleSignature(argData.type)) {
-                qWarning("Invalid D-BUS type signature '%s' found while parsing introspection",
-                         qPrintable(argData.type));
-                continue;
-            }
-
-            retval << argData;
-        }
+    frame.kind = Frame::Node;
+    if (stack.isEmpty()) {
+        // the top-level node: it doesn't need a name
+        root = new QDBusIntrospection::ObjectTree;
+        root->service = service;
+        root->path = path;
+        frame.node = root;
+
+        if (mode != InterfacesMode)
+            capture(&root->introspection);
+        return;
+    }
+
+    Frame *parent = findFrame(Frame::Node);
+    if (!parent || !parent->node || mode == InterfacesMode)
+        return;                 // we're not interested in this one's contents
+
+    frame.name = atts.value(QLatin1String("name"));
+    if (frame.name.isEmpty())
+        return;
+
+    QString objAbsName = parent->node->path;
+    if (!objAbsName.endsWith(QLatin1Char('/')))
+        objAbsName.append(QLatin1Char('/'));
+    objAbsName += frame.name;
+    if (!QDBusUtil::isValidObjectPath(objAbsName)) {
+        qWarning("Invalid D-BUS object path '%s' found while parsing introspection",
+                 qPrintable(objAbsName));
+        return;
+    }
+
+    parent->node->childObjects.append(frame.name);
+    if (mode == ObjectTreeMode) {
+        frame.node = new QDBusIntrospection::ObjectTree;
+        frame.node->service = service;
+        frame.node->path = objAbsName;
+        capture(&frame.node->introspection);
     }
-    return retval;
 }
 
-QDBusXmlParser::QDBusXmlParser(const QString& service, const QString& path,
-                               const QString& xmlData)
-    : m_service(service), m_path(path)
+void QDBusXmlHandler::startInterface(Frame &frame, const QXmlAttributes &atts)
 {
-    QDomDocument doc;
-    doc.setContent(xmlData);
-    m_node = doc.firstChildElement(QLatin1String("node"));
+    frame.kind = Frame::Interface;
+
+    Frame *parent = findFrame(Frame::Node);
+    if (!parent || !parent->node)
+        return;
+
+    frame.name = atts.value(QLatin1String("name"));
+    if (!QDBusUtil::isValidInterfaceName(frame.name)) {
+        qWarning("Invalid D-BUS interface name '%s' found while parsing introspection",
+                 qPrintable(frame.name));
+        return;
+    }
+
+    if (mode == ObjectMode) {
+        // only the name is needed
+        parent->node->interfaces.append(frame.name);
+        return;
+    }
+
+    frame.interface = new QDBusIntrospection::Interface;
+    frame.interface->name = frame.name;
+    capture(&frame.interface->introspection);
 }
 
-QDBusXmlParser::QDBusXmlParser(const QString& service, const QString& path,
-                               const QDomElement& node)
-    : m_service(service), m_path(path), m_node(node)
+void QDBusXmlHandler::startMember(Frame &frame, const QXmlAttributes &atts)
 {
+    if (frame.tag == QLatin1String("method"))
+        frame.kind = Frame::Method;
+    else if (frame.tag == QLatin1String("signal"))
+        frame.kind = Frame::Signal;
+    else
+        frame.kind = Frame::Property;
+
+    Frame *parent = findFrame(Frame::Interface);
+    if (!parent || !parent->interface)
+        return;
+
+    const QString &ifaceName = parent->interface->name;
+    frame.name = atts.value(QLatin1String("name"));
+    if (!QDBusUtil::isValidMemberName(frame.name)) {
+        qWarning("Invalid D-BUS member name '%s' found in interface '%s' while parsing introspection",
+                 qPrintable(frame.name), qPrintable(ifaceName));
+        return;
+    }
+
+    if (frame.kind == Frame::Method) {
+        frame.method = new QDBusIntrospection::Method;
+        frame.method->name = frame.name;
+    } else if (frame.kind == Frame::Signal) {
+        frame.signal = new QDBusIntrospection::Signal;
+        frame.signal->name = frame.name;
+    } else {
+        QString type = atts.value(QLatin1String("type"));
+        if (!QDBusUtil::isValidSingleSignature(type)) {
+            // cannot be!
+            qWarning("Invalid D-BUS type signature '%s' found in property '%s.%s' while parsing introspection",
+                     qPrintable(type), qPrintable(ifaceName), qPrintable(frame.name));
+            return;
+        }
+
+        QDBusIntrospection::Property::Access access;
+        QString accessName = atts.value(QLatin1String("access"));
+        if (accessName == QLatin1String("read"))
+            access = QDBusIntrospection::Property::Read;
+        else if (accessName == QLatin1String("write"))
+            access = QDBusIntrospection::Property::Write;
+        else if (accessName == QLatin1String("readwrite"))
+            access = QDBusIntrospection::Property::ReadWrite;
+        else {
+            qWarning("Invalid D-BUS property access '%s' found in property '%s.%s' while parsing introspection",
+                     qPrintable(accessName), qPrintable(ifaceName), qPrintable(frame.name));
+            return;             // invalid one!
+        }
+
+        frame.property = new QDBusIntrospection::Property;
+        frame.property->name = frame.name;
+        frame.property->type = type;
+        frame.property->access = access;
+    }
 }
 
-QDBusIntrospection::Interfaces
-QDBusXmlParser::interfaces() const
+void QDBusXmlHandler::addAnnotation(const QXmlAttributes &atts)
 {
-    QDBusIntrospection::Interfaces retval;
+    Frame *parent = findFrame(Frame::Interface | Frame::Method | Frame::Signal | Frame::Property);
+    if (!parent)
+        return;
+
+    QDBusIntrospection::Annotations *annotations = 0;
+    if (parent->interface)
+        annotations = &parent->interface->annotations;
+    else if (parent->method)
+        annotations = &parent->method->annotations;
+    else if (parent->signal)
+        annotations = &parent->signal->annotations;
+    else if (parent->property)
+        annotations = &parent->property->annotations;
+    else
+        return;
+
+    QString name = atts.value(QLatin1String("name"));
+    if (!QDBusUtil::isValidInterfaceName(name)) {
+        qWarning("Invalid D-BUS annotation '%s' found while parsing introspection",
+                 qPrintable(name));
+        return;
+    }
 
-    if (m_node.isNull())
-        return retval;
+    annotations->insert(name, atts.value(QLatin1String("value")));
+}
 
-    QDomNodeList interfaceList = m_node.elementsByTagName(QLatin1String("interface"));
-    for (int i = 0; i < interfaceList.count(); ++i)
-    {
-        QDomElement iface = interfaceList.item(i).toElement();
-        QString ifaceName = iface.attribute(QLatin1String("name"));
-        if (iface.isNull())
-            continue;           // for whatever reason
-        if (!QDBusUtil::isValidInterfaceName(ifaceName)) {
-            qWarning("Invalid D-BUS interface name '%s' found while parsing introspection",
-                     qPrintable(ifaceName));
-            continue;
+void QDBusXmlHandler::addArgument(const QXmlAttributes &atts)
+{
+    Frame *parent = findFrame(Frame::Method | Frame::Signal);
+    if (!parent)
+        return;
+
+    QString direction = atts.value(QLatin1String("direction"));
+    QDBusIntrospection::Arguments *args = 0;
+    if (parent->method) {
+        if (direction == QLatin1String("in"))
+            args = &parent->method->inputArgs;
+        else if (direction == QLatin1String("out"))
+            args = &parent->method->outputArgs;
+    } else if (parent->signal) {
+        // signal arguments don't need to say which direction they go
+        if (atts.index(QLatin1String("direction")) == -1 || direction == QLatin1String("out"))
+            args = &parent->signal->outputArgs;
+    }
+    if (!args)
+        return;
+
+    QDBusIntrospection::Argument argData;
+    if (atts.index(QLatin1String("name")) != -1)
+        argData.name = atts.value(QLatin1String("name")); // can be empty
+    argData.type = atts.value(QLatin1String("type"));
+    if (!QDBusUtil::isValidSingleSignature(argData.type)) {
+        qWarning("Invalid D-BUS type signature '%s' found while parsing introspection",
+                 qPrintable(argData.type));
+        return;
+    }
+
+    args->append(argData);
+}
+
+void QDBusXmlHandler::closeElement()
+{
+    Frame frame = stack.last();
+    writeEndTag(frame.tag);
+    stack.resize(stack.count() - 1);
+
+    switch (frame.kind) {
+    case Frame::Node:
+        if (!frame.node)
+            break;
+
+        if (mode == ObjectTreeMode)
+            frame.node->interfaces = frame.node->interfaceData.keys();
+
+        if (frame.node == root) {
+            if (mode == ObjectMode && !frame.hasChildren)
+                root->introspection = QLatin1String("<node/>\n");
+        } else if (frame.hasChildren) {
+            // only sub-objects with contents are introspected
+            Frame *parent = findFrame(Frame::Node);
+            parent->node->childObjectData.insert(frame.name,
+                QSharedDataPointer<QDBusIntrospection::ObjectTree>(frame.node));
+        } else {
+            delete frame.node;
         }
+        break;
 
-        QDBusIntrospection::Interface *ifaceData = new QDBusIntrospection::Interface;
-        ifaceData->name = ifaceName;
-        {
-            // save the data
-            QTextStream ts(&ifaceData->introspection);
-            iface.save(ts,2);
+    case Frame::Interface:
+        if (frame.interface) {
+            Frame *parent = findFrame(Frame::Node);
+            parent->node->interfaceData.insert(frame.name,
+                QSharedDataPointer<QDBusIntrospection::Interface>(frame.interface));
         }
+        break;
 
-        // parse annotations
-        ifaceData->annotations = parseAnnotations(iface);
-
-        // parse methods
-        QDomNodeList list = iface.elementsByTagName(QLatin1String("method"));
-        for (int j = 0; j < list.count(); ++j)
-        {
-            QDomElement method = list.item(j).toElement();
-            QString methodName = method.attribute(QLatin1String("name"));
-            if (method.isNull())
-                continue;
-            if (!QDBusUtil::isValidMemberName(methodName)) {
-                qWarning("Invalid D-BUS member name '%s' found in interface '%s' while parsing introspection",
-                         qPrintable(methodName), qPrintable(ifaceName));
-                continue;
-            }
-
-            QDBusIntrospection::Method methodData;
-            methodData.name = methodName;
-
-            // parse arguments
-            methodData.inputArgs = parseArgs(method, QLatin1String("in"));
-            methodData.outputArgs = parseArgs(method, QLatin1String("out"));
-            methodData.annotations = parseAnnotations(method);
-
-            // add it
-            ifaceData->methods.insert(methodName, methodData);
+    case Frame::Method:
+        if (frame.method) {
+            findFrame(Frame::Interface)->interface->methods.insert(frame.name, *frame.method);
+            delete frame.method;
         }
+        break;
 
-        // parse signals
-        list = iface.elementsByTagName(QLatin1String("signal"));
-        for (int j = 0; j < list.count(); ++j)
-        {
-            QDomElement signal = list.item(j).toElement();
-            QString signalName = signal.attribute(QLatin1String("name"));
-            if (signal.isNull())
-                continue;
-            if (!QDBusUtil::isValidMemberName(signalName)) {
-                qWarning("Invalid D-BUS member name '%s' found in interface '%s' while parsing introspection",
-                         qPrintable(signalName), qPrintable(ifaceName));
-                continue;
-            }
-
-            QDBusIntrospection::Signal signalData;
-            signalData.name = signalName;
-
-            // parse data
-            signalData.outputArgs = parseArgs(signal, QLatin1String("out"), true);
-            signalData.annotations = parseAnnotations(signal);
-
-            // add it
-            ifaceData->signals_.insert(signalName, signalData);
+    case Frame::Signal:
+        if (frame.signal) {
+            findFrame(Frame::Interface)->interface->signals_.insert(frame.name, *frame.signal);
+            delete frame.signal;
         }
+        break;
 
-        // parse properties
-        list = iface.elementsByTagName(QLatin1String("property"));
-        for (int j = 0; j < list.count(); ++j)
-        {
-            QDomElement property = list.item(j).toElement();
-            QString propertyName = property.attribute(QLatin1String("name"));
-            if (property.isNull())
-                continue;
-            if (!QDBusUtil::isValidMemberName(propertyName)) {
-                qWarning("Invalid D-BUS member name '%s' found in interface '%s' while parsing introspection",
-                         qPrintable(propertyName), qPrintable(ifaceName));
-                continue;
-            }
-
-            QDBusIntrospection::Property propertyData;
-
-            // parse data
-            propertyData.name = propertyName;
-            propertyData.type = property.attribute(QLatin1String("type"));
-            propertyData.annotations = parseAnnotations(property);
-
-            if (!QDBusUtil::isValidSingleSignature(propertyData.type)) {
-                // cannot be!
-                qWarning("Invalid D-BUS type signature '%s' found in property '%s.%s' while parsing introspection",
-                         qPrintable(propertyData.type), qPrintable(ifaceName),
-                         qPrintable(propertyName));
-                continue;
-            }
-
-            QString access = property.attribute(QLatin1String("access"));
-            if (access == QLatin1String("read"))
-                propertyData.access = QDBusIntrospection::Property::Read;
-            else if (access == QLatin1String("write"))
-                propertyData.access = QDBusIntrospection::Property::Write;
-            else if (access == QLatin1String("readwrite"))
-                propertyData.access = QDBusIntrospection::Property::ReadWrite;
-            else {
-                qWarning("Invalid D-BUS property access '%s' found in property '%s.%s' while parsing introspection",
-                         qPrintable(access), qPrintable(ifaceName),
-                         qPrintable(propertyName));
-                continue;       // invalid one!
-            }
-
-            // add it
-            ifaceData->properties.insert(propertyName, propertyData);
+    case Frame::Property:
+        if (frame.property) {
+            findFrame(Frame::Interface)->interface->properties.insert(frame.name, *frame.property);
+            delete frame.property;
         }
+        break;
+    }
+}
+
+void QDBusXmlHandler::capture(QString *xml)
+{
+    Capture c;
+    c.xml = xml;
+    c.depth = stack.count();
+    captures.append(c);
+}
+
+void QDBusXmlHandler::writeStartTag(const QString &tag, const QXmlAttributes &atts)
+{
+    if (captures.isEmpty())
+        return;
+
+    QString text(QLatin1Char('<'));
+    text += tag;
+    for (int i = 0; i < atts.count(); ++i) {
+        text += QLatin1Char(' ');
+        text += atts.qName(i);
+        text += QLatin1String("=\"");
+        text += escapeAttribute(atts.value(i));
+        text += QLatin1Char('"');
+    }
 
-        // add it
-        retval.insert(ifaceName, QSharedDataPointer<QDBusIntrospection::Interface>(ifaceData));
+    int depth = stack.count();
+    for (int i = 0; i < captures.count(); ++i) {
+        QString *xml = captures.at(i).xml;
+        xml->append(QString((depth - captures.at(i).depth) * 2, QLatin1Char(' ')));
+        xml->append(text);
+    }
+    tagOpen = true;
+}
+
+void QDBusXmlHandler::writeEndTag(const QString &tag)
+{
+    int depth = stack.count() - 1;
+    for (int i = 0; i < captures.count(); ++i) {
+        QString *xml = captures.at(i).xml;
+        if (tagOpen) {
+            xml->append(QLatin1String("/>\n"));
+        } else {
+            xml->append(QString((depth - captures.at(i).depth) * 2, QLatin1Char(' ')));
+            xml->append(QLatin1String("</") + tag + QLatin1String(">\n"));
+        }
+    }
+    tagOpen = false;
+
+    // stop saving the elements that end here
+    while (!captures.isEmpty() && captures.last().depth == depth)
+        captures.resize(captures.count() - 1);
+}
+
+static QDBusIntrospection::ObjectTree *
+parseDocument(const QString &service, const QString &path, const QString &xmlData,
+              QDBusXmlHandler::Mode mode)
+{
+    QDBusXmlHandler handler(service, path, mode);
+
+    QXmlInputSource source;
+    source.setData(xmlData);
+    QXmlSimpleReader reader;
+    reader.setContentHandler(&handler);
+    reader.parse(&source);      // on error, we keep what was read until then
+
+    return handler.finish();
+}
+
+QDBusXmlParser::QDBusXmlParser(const QString& service, const QString& path,
+                               const QString& xmlData)
+    : m_service(service), m_path(path), m_data(xmlData)
+{
+}
+
+QDBusIntrospection::Interfaces
+QDBusXmlParser::interfaces() const
+{
+    QDBusIntrospection::Interfaces retval;
+
+    QDBusIntrospection::ObjectTree *tree =
+        parseDocument(m_service, m_path, m_data, QDBusXmlHandler::InterfacesMode);
+    if (tree) {
+        retval = tree->interfaceData;
+        delete tree;
     }
 
     return retval;
@@ -244,106 +537,24 @@ QDBusXmlParser::interfaces() const
 QSharedDataPointer<QDBusIntrospection::Object>
 QDBusXmlParser::object() const
 {
-    if (m_node.isNull())
+    QDBusIntrospection::ObjectTree *tree =
+        parseDocument(m_service, m_path, m_data, QDBusXmlHandler::ObjectMode);
+    if (!tree)
         return QSharedDataPointer<QDBusIntrospection::Object>();
 
-    QDBusIntrospection::Object* objData;
-    objData = new QDBusIntrospection::Object;
-    objData->service = m_service;
-    objData->path = m_path;
-
-    // check if we have anything to process
-    if (objData->introspection.isNull() && !m_node.firstChild().isNull()) {
-        // yes, introspect this object
-        QTextStream ts(&objData->introspection);
-        m_node.save(ts,2);
-
-        QDomNodeList objects = m_node.elementsByTagName(QLatin1String("node"));
-        for (int i = 0; i < objects.count(); ++i) {
-            QDomElement obj = objects.item(i).toElement();
-            QString objName = obj.attribute(QLatin1String("name"));
-            if (obj.isNull())
-                continue;           // for whatever reason
-            if (!QDBusUtil::isValidObjectPath(m_path + QLatin1Char('/') + objName)) {
-                qWarning("Invalid D-BUS object path '%s/%s' found while parsing introspection",
-                         qPrintable(m_path), qPrintable(objName));
-                continue;
-            }
-
-            objData->childObjects.append(objName);
-        }
-
-        QDomNodeList interfaceList = m_node.elementsByTagName(QLatin1String("interface"));
-        for (int i = 0; i < interfaceList.count(); ++i) {
-            QDomElement iface = interfaceList.item(i).toElement();
-            QString ifaceName = iface.attribute(QLatin1String("name"));
-            if (iface.isNull())
-                continue;
-            if (!QDBusUtil::isValidInterfaceName(ifaceName)) {
-                qWarning("Invalid D-BUS interface name '%s' found while parsing introspection",
-                         qPrintable(ifaceName));
-                continue;
-            }
-
-            objData->interfaces.append(ifaceName);
-        }
-    } else {
-        objData->introspection = QLatin1String("<node/>\n");
-    }
-
     QSharedDataPointer<QDBusIntrospection::Object> retval;
-    retval = objData;
+    retval = new QDBusIntrospection::Object(*tree);
+    delete tree;
     return retval;
 }
 
 QSharedDataPointer<QDBusIntrospection::ObjectTree>
 QDBusXmlParser::objectTree() const
 {
-    QSharedDataPointer<QDBusIntrospection::ObjectTree> retval;
-
-    if (m_node.isNull())
-        return retval;
-
-    retval = new QDBusIntrospection::ObjectTree;
-
-    retval->service = m_service;
-    retval->path = m_path;
-
-    QTextStream ts(&retval->introspection);
-    m_node.save(ts,2);
-
-    // interfaces are easy:
-    retval->interfaceData = interfaces();
-    retval->interfaces = retval->interfaceData.keys();
-
-    // sub-objects are slightly more difficult:
-    QDomNodeList objects = m_node.elementsByTagName(QLatin1String("node"));
-    for (int i = 0; i < objects.count(); ++i) {
-        QDomElement obj = objects.item(i).toElement();
-        QString objName = obj.attribute(QLatin1String("name"));
-        if (obj.isNull() || objName.isEmpty())
-            continue;           // for whatever reason
-
-        // check if we have anything to process
-        if (!obj.firstChild().isNull()) {
-            // yes, introspect this object
-            QString xml;
-            QTextStream ts2(&xml);
-            obj.save(ts2,0);
-
-            // parse it
-            QString objAbsName = m_path;
-            if (!objAbsName.endsWith(QLatin1Char('/')))
-                objAbsName.append(QLatin1Char('/'));
-            objAbsName += objName;
-
-            QDBusXmlParser parser(m_service, objAbsName, obj);
-            retval->childObjectData.insert(objName, parser.objectTree());
-        }
+    QDBusIntrospection::ObjectTree *tree =
+        parseDocument(m_service, m_path, m_data, QDBusXmlHandler::ObjectTreeMode);
+    if (!tree)
+        return QSharedDataPointer<QDBusIntrospection::ObjectTree>();
 
-        retval->childObjects << objName;
-    }
-
-    return QSharedDataPointer<QDBusIntrospection::ObjectTree>( retval );
+    return QSharedDataPointer<QDBusIntrospection::ObjectTree>(tree);
 }
-
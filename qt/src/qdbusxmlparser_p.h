@@ -26,7 +26,6 @@
 #define QDBUSXMLPARSER_H
 
 #include <QtCore/qmap.h>
-#include <QtXml/qdom.h>
 #include "qdbusmacros.h"
 #include "qdbusintrospection_p.h"
 
@@ -37,13 +36,11 @@ class QDBusXmlParser
 {
     QString m_service;
     QString m_path;
-    QDomElement m_node;
+    QString m_data;
 
 public:
     QDBusXmlParser(const QString& service, const QString& path,
                    const QString& xmlData);
-    QDBusXmlParser(const QString& service, const QString& path,
-                   const QDomElement& node);
 
     QDBusIntrospection::Interfaces interfaces() const;
     QSharedDataPointer<QDBusIntrospection::Object> object() const;
@@ -42,7 +42,7 @@
 
 #define ANNOTATION_NO_WAIT      "org.freedesktop.DBus.Method.NoReply"
 
-static const char cmdlineOptions[] = "a:c:hmNp:vV";
+static const char cmdlineOptions[] = "a:c:hmNp:svV";
 static const char *globalClassName;
 static const char *proxyFile;
 static const char *adaptorFile;
@@ -50,6 +50,7 @@ static const char *inputFile;
 static bool skipNamespaces;
 static bool verbose;
 static bool includeMocs;
+static bool staticDispatch;
 static QStringList wantedInterfaces;
 
 static const char help[] =
@@ -64,6 +65,8 @@ static const char help[] =
     "  -m               Generate #include \"filename.moc\" statements in the .cpp files\n"
     "  -N               Don't use namespaces\n"
     "  -p <filename>    Write the proxy code to <filename>\n"
+    "  -s               Generate static marshalling code in the proxies and\n"
+    "                   static dispatch code in the adaptors\n"
     "  -v               Be verbose.\n"
     "  -V               Show the program version and quit.\n"
     "\n"
@@ -127,6 +130,10 @@ static void parseCmdLine(int argc, char **argv)
         case 'N':
             skipNamespaces = true;
             break;
+
+        case 's':
+            staticDispatch = true;
+            break;
             
         case 'h':
             showHelp();
@@ -386,6 +393,314 @@ static QString stringify(const QString &data)
     return retval;
 }
 
+// C types used to read and write the basic D-Bus types with dbus_message_iter_get_basic and
+// dbus_message_iter_append_basic. Strings are handled separately.
+static const char *basicTypeStorage(char type)
+{
+    switch (type) {
+    case 'y': return "uchar";
+    case 'b': return "dbus_bool_t";
+    case 'n': return "dbus_int16_t";
+    case 'q': return "dbus_uint16_t";
+    case 'i': return "dbus_int32_t";
+    case 'u': return "dbus_uint32_t";
+    case 'x': return "dbus_int64_t";
+    case 't': return "dbus_uint64_t";
+    case 'd': return "double";
+    case 's':
+    case 'o':
+    case 'g': return "const char *";
+    }
+    return 0;
+}
+
+static const char *basicTypeCode(char type)
+{
+    switch (type) {
+    case 'y': return "DBUS_TYPE_BYTE";
+    case 'b': return "DBUS_TYPE_BOOLEAN";
+    case 'n': return "DBUS_TYPE_INT16";
+    case 'q': return "DBUS_TYPE_UINT16";
+    case 'i': return "DBUS_TYPE_INT32";
+    case 'u': return "DBUS_TYPE_UINT32";
+    case 'x': return "DBUS_TYPE_INT64";
+    case 't': return "DBUS_TYPE_UINT64";
+    case 'd': return "DBUS_TYPE_DOUBLE";
+    case 's': return "DBUS_TYPE_STRING";
+    case 'o': return "DBUS_TYPE_OBJECT_PATH";
+    case 'g': return "DBUS_TYPE_SIGNATURE";
+    }
+    return 0;
+}
+
+static bool isBasicType(const QString &signature)
+{
+    return signature.length() == 1 && basicTypeStorage(signature.at(0).toLatin1());
+}
+
+// returns true if all arguments of the method can be read and written with typed calls
+static bool canDispatchStatically(const QDBusIntrospection::Method &method)
+{
+    foreach (const QDBusIntrospection::Argument &arg, method.inputArgs)
+        if (!isBasicType(arg.type))
+            return false;
+    foreach (const QDBusIntrospection::Argument &arg, method.outputArgs)
+        if (!isBasicType(arg.type))
+            return false;
+    return true;
+}
+
+// writes the code reading a value of the basic type signature from the iterator "it" into name
+static void writeReadBasic(QTextStream &ts, const char *indent, const QString &name,
+                           const QString &signature, bool declare)
+{
+    char type = signature.at(0).toLatin1();
+    QByteArray storage = basicTypeStorage(type);
+    if (!storage.endsWith('*'))
+        storage += ' ';
+
+    ts << indent << storage << name << "_raw;" << endl
+       << indent << "dbus_message_iter_get_basic(&it, &" << name << "_raw);" << endl
+       << indent << "dbus_message_iter_next(&it);" << endl
+       << indent;
+    if (declare)
+        ts << qtTypeName(signature) << " ";
+    if (qtTypeName(signature) == "QString")
+        ts << name << " = QString::fromUtf8(" << name << "_raw);" << endl;
+    else
+        ts << name << " = " << name << "_raw;" << endl;
+}
+
+// writes the code appending name, of the basic type signature, to the iterator iter
+static void writeAppendBasic(QTextStream &ts, const char *indent, const QString &name,
+                             const QString &signature, const char *iter)
+{
+    char type = signature.at(0).toLatin1();
+    if (qtTypeName(signature) == "QString")
+        ts << indent << "QByteArray " << name << "_utf8 = " << name << ".toUtf8();" << endl
+           << indent << "const char *" << name << "_raw = " << name << "_utf8.constData();"
+           << endl;
+    else
+        ts << indent << basicTypeStorage(type) << " " << name << "_raw = " << name << ";" << endl;
+    ts << indent << "dbus_message_iter_append_basic(&" << iter << ", " << basicTypeCode(type)
+       << ", &" << name << "_raw);" << endl;
+}
+
+static void writeStaticDispatcher(QTextStream &cs, const QString &className,
+                                  const QDBusIntrospection::Interface *interface)
+{
+    // group the methods by the length of their names
+    QMap<int, QList<const QDBusIntrospection::Method *> > methodsByLength;
+    QDBusIntrospection::Methods::ConstIterator mit = interface->methods.constBegin();
+    for ( ; mit != interface->methods.constEnd(); ++mit) {
+        const QDBusIntrospection::Method &method = mit.value();
+        bool isAsync =
+            method.annotations.value(QLatin1String(ANNOTATION_NO_WAIT)) == QLatin1String("true");
+        if (isAsync && !method.outputArgs.isEmpty())
+            continue;           // not generated, see writeAdaptor
+        if (!canDispatchStatically(method)) {
+            if (verbose)
+                fprintf(stderr, "%s: method %s in interface %s will use dynamic dispatch\n",
+                        PROGRAMNAME, qPrintable(method.name), qPrintable(interface->name));
+            continue;
+        }
+        methodsByLength[method.name.toUtf8().length()].append(&method);
+    }
+
+    if (methodsByLength.isEmpty())
+        return;
+
+    QString dispatcherName = QLatin1String("qDBusDispatch_") + className;
+    cs << "/*" << endl
+       << " * Static dispatch for adaptor class " << className << endl
+       << " * Called with a null adaptor to find out if the call is handled here." << endl
+       << " */" << endl
+       << "static DBusMessage *" << dispatcherName
+       << "(QDBusAbstractAdaptor *adaptor, DBusMessage *call, bool *handled)" << endl
+       << "{" << endl
+       << "    " << className << " *self = static_cast<" << className << " *>(adaptor);" << endl
+       << "    const char *member = dbus_message_get_member(call);" << endl
+       << "    const char *signature = dbus_message_get_signature(call);" << endl
+       << "    *handled = false;" << endl
+       << endl
+       << "    switch (qstrlen(member)) {" << endl;
+
+    QMap<int, QList<const QDBusIntrospection::Method *> >::ConstIterator it;
+    for (it = methodsByLength.constBegin(); it != methodsByLength.constEnd(); ++it) {
+        cs << "    case " << it.key() << ":" << endl;
+
+        foreach (const QDBusIntrospection::Method *method, it.value()) {
+            QString signature;
+            foreach (const QDBusIntrospection::Argument &arg, method->inputArgs)
+                signature += arg.type;
+
+            cs << "        if (qstrcmp(member, \"" << method->name << "\") == 0 && "
+               << "qstrcmp(signature, \"" << signature << "\") == 0) {" << endl
+               << "            *handled = true;" << endl
+               << "            if (!self)" << endl
+               << "                return 0;" << endl
+               << endl;
+
+            // read the input arguments
+            int argPos = 0;
+            if (!method->inputArgs.isEmpty())
+                cs << "            DBusMessageIter it;" << endl
+                   << "            dbus_message_iter_init(call, &it);" << endl;
+            foreach (const QDBusIntrospection::Argument &arg, method->inputArgs) {
+                QString name = QString(QLatin1String("arg%1")).arg(argPos++);
+                writeReadBasic(cs, "            ", name, arg.type, true);
+            }
+
+            // declare the output arguments, except for the return value
+            for (int i = 1; i < method->outputArgs.count(); ++i)
+                cs << "            " << qtTypeName(method->outputArgs.at(i).type) << " arg"
+                   << argPos + i << ";" << endl;
+
+            // make the call
+            cs << "            ";
+            if (!method->outputArgs.isEmpty())
+                cs << qtTypeName(method->outputArgs.first().type) << " arg" << argPos << " = ";
+            cs << "self->" << method->name << "(";
+            bool first = true;
+            for (int i = 0; i < argPos; ++i) {
+                cs << (first ? "" : ", ") << "arg" << i;
+                first = false;
+            }
+            for (int i = 1; i < method->outputArgs.count(); ++i) {
+                cs << (first ? "" : ", ") << "arg" << argPos + i;
+                first = false;
+            }
+            cs << ");" << endl
+               << endl;
+
+            // write the reply
+            cs << "            DBusMessage *reply = dbus_message_new_method_return(call);" << endl
+               << "            if (!reply)" << endl
+               << "                return 0;" << endl;
+            if (!method->outputArgs.isEmpty())
+                cs << "            DBusMessageIter out;" << endl
+                   << "            dbus_message_iter_init_append(reply, &out);" << endl;
+            for (int i = 0; i < method->outputArgs.count(); ++i) {
+                QString name = QString(QLatin1String("arg%1")).arg(argPos + i);
+                writeAppendBasic(cs, "            ", name, method->outputArgs.at(i).type, "out");
+            }
+            cs << "            return reply;" << endl
+               << "        }" << endl;
+        }
+
+        cs << "        break;" << endl;
+    }
+
+    cs << "    }" << endl
+       << endl
+       << "    return 0;" << endl
+       << "}" << endl
+       << endl
+       << "static const bool " << dispatcherName << "_registered =" << endl
+       << "    (qDBusAddAdaptorDispatcher(&" << className << "::staticMetaObject, "
+       << dispatcherName << "), true);" << endl
+       << endl;
+}
+
+// the definition goes to cs, and is marked inline if it ends up in the header
+static void writeStaticProxyMethod(QTextStream &hs, QTextStream &cs, const QString &className,
+                                   const QDBusIntrospection::Method &method, bool isAsync,
+                                   bool isInline)
+{
+    QStringList argNames = makeArgNames(method.inputArgs, method.outputArgs);
+
+    // don't let the arguments hide our local variables
+    QStringList taken;
+    taken << QLatin1String("msg") << QLatin1String("it") << QLatin1String("reply")
+          << QLatin1String("value");
+    for (int i = 0; i < argNames.count(); ++i) {
+        while (taken.contains(argNames.at(i)))
+            argNames[i] += QLatin1String("_");
+        taken << argNames.at(i);
+    }
+
+    QString returnType;
+    if (isAsync)
+        returnType = QLatin1String("void");
+    else if (method.outputArgs.isEmpty())
+        returnType = QLatin1String("QDBusReply<void>");
+    else
+        returnType = QLatin1String("QDBusReply<") + templateArg(qtTypeName(method.outputArgs.first().type))
+                     + QLatin1String(">");
+
+    hs << "    ";
+    if (method.annotations.value(QLatin1String("org.freedesktop.DBus.Deprecated")) == QLatin1String("true"))
+        hs << "Q_DECL_DEPRECATED ";
+    if (isAsync)
+        hs << "Q_ASYNC ";
+    hs << returnType << " " << method.name << "(";
+    writeArgList(hs, argNames, method.inputArgs, method.outputArgs);
+    hs << ");" << endl
+       << endl;
+
+    if (isInline)
+        cs << "inline ";
+    cs << returnType << " " << className << "::" << method.name << "(";
+    writeArgList(cs, argNames, method.inputArgs, method.outputArgs);
+    cs << ")" << endl
+       << "{" << endl
+       << "    DBusMessage *msg = internalMethodCall(\"" << method.name << "\");" << endl
+       << "    if (!msg)" << endl;
+    if (isAsync)
+        cs << "        return;" << endl;
+    else
+        cs << "        return QDBusError(QDBusError::NoMemory, QLatin1String(\"Out of memory\"));" << endl;
+    cs << endl;
+
+    // append the input arguments
+    int argPos = 0;
+    if (!method.inputArgs.isEmpty())
+        cs << "    DBusMessageIter it;" << endl
+           << "    dbus_message_iter_init_append(msg, &it);" << endl;
+    foreach (const QDBusIntrospection::Argument &arg, method.inputArgs)
+        writeAppendBasic(cs, "    ", argNames.at(argPos++), arg.type, "it");
+
+    if (isAsync) {
+        cs << "    internalSend(msg);" << endl
+           << "}" << endl
+           << endl;
+        return;
+    }
+
+    QString signature;
+    foreach (const QDBusIntrospection::Argument &arg, method.outputArgs)
+        signature += arg.type;
+
+    cs << endl
+       << "    DBusMessage *reply = internalCallWithReply(msg);" << endl
+       << "    if (!reply)" << endl
+       << "        return lastError();" << endl
+       << "    if (qstrcmp(dbus_message_get_signature(reply), \"" << signature << "\") != 0) {" << endl
+       << "        dbus_message_unref(reply);" << endl
+       << "        return QDBusError(QDBusError::InvalidSignature," << endl
+       << "                          QLatin1String(\"Unexpected reply signature\"));" << endl
+       << "    }" << endl;
+
+    // read the output arguments
+    if (!method.outputArgs.isEmpty()) {
+        if (method.inputArgs.isEmpty())
+            cs << "    DBusMessageIter it;" << endl;
+        cs << "    dbus_message_iter_init(reply, &it);" << endl;
+        writeReadBasic(cs, "    ", QLatin1String("value"), method.outputArgs.first().type, true);
+        ++argPos;           // skip the return value's name
+        for (int i = 1; i < method.outputArgs.count(); ++i)
+            writeReadBasic(cs, "    ", argNames.at(argPos++), method.outputArgs.at(i).type, false);
+    }
+
+    cs << "    dbus_message_unref(reply);" << endl;
+    if (method.outputArgs.isEmpty())
+        cs << "    return QDBusError();" << endl;
+    else
+        cs << "    return " << returnType << "::fromValue(value);" << endl;
+    cs << "}" << endl
+       << endl;
+}
+
 static void writeProxy(const char *filename, const QDBusIntrospection::Interfaces &interfaces)
 {
     // open the file
@@ -401,6 +716,11 @@ static void writeProxy(const char *filename, const QDBusIntrospection::Interface
     QByteArray cppData;
     QTextStream cs(&cppData);
 
+    // with no separate .cpp, the definitions of the static proxy methods are inline and go in
+    // the header, after the classes and inside the include guard
+    QByteArray inlineData;
+    QTextStream is(&inlineData);
+
     // write the header:
     writeHeader(hs, true);
 
@@ -430,7 +750,12 @@ static void writeProxy(const char *filename, const QDBusIntrospection::Interface
 
     if (cppName != headerName) {
         writeHeader(cs, false);        
-        cs << "#include \"" << headerName << "\"" << endl
+        cs << "#include \"" << headerName << "\"" << endl;
+        if (staticDispatch)
+            cs << "#include <dbus/dbus.h>" << endl;
+        cs << endl;
+    } else if (staticDispatch) {
+        hs << "#include <dbus/dbus.h>" << endl
            << endl;
     }
     
@@ -525,6 +850,14 @@ static void writeProxy(const char *filename, const QDBusIntrospection::Interface
                         qPrintable(method.name), qPrintable(interface->name));
                 continue;
             }
+
+            if (staticDispatch && canDispatchStatically(method)) {
+                if (headerName == cppName)
+                    writeStaticProxyMethod(hs, is, className, method, isAsync, true);
+                else
+                    writeStaticProxyMethod(hs, cs, className, method, isAsync, false);
+                continue;
+            }
             
             hs << "    inline ";
 
@@ -607,6 +940,9 @@ static void writeProxy(const char *filename, const QDBusIntrospection::Interface
            << endl;
     }
 
+    is.flush();
+    hs << inlineData;
+
     if (!skipNamespaces) {
         QStringList last;
         QDBusIntrospection::Interfaces::ConstIterator it = interfaces.constBegin();
@@ -712,11 +1048,15 @@ static void writeAdaptor(const char *filename, const QDBusIntrospection::Interfa
         writeHeader(cs, false);        
         cs << "#include \"" << headerName << "\"" << endl
            << "#include <QtCore/QMetaObject>" << endl
-           << includeList
-           << endl;
+           << includeList;
+        if (staticDispatch)
+            cs << "#include <dbus/dbus.h>" << endl;
+        cs << endl;
         hs << forwardDeclarations;
     } else {
         hs << includeList;
+        if (staticDispatch)
+            hs << "#include <dbus/dbus.h>" << endl;
     }
 
     hs << endl;
@@ -913,6 +1253,9 @@ static void writeAdaptor(const char *filename, const QDBusIntrospection::Interfa
         // close the class:
         hs << "};" << endl
            << endl;        
+
+        if (staticDispatch)
+            writeStaticDispatcher(cs, className, interface);
     }
 
     // close the include guard
@@ -969,4 +1312,15 @@ int main(int argc, char **argv)
     The adaptor classes generated by \c dbusidl2cpp are just a skeleton that must be completed. It
     generates, by default, calls to slots with the same name on the object the adaptor is attached
     to. However, you may modify those slots or the property accessor functions to suit your needs.
+
+    When run with the \c -s option, \c dbusidl2cpp also generates static dispatch code for each
+    adaptor class. Calls to methods whose arguments are all basic types (numbers, booleans and
+    strings) are then matched by member name and signature, their arguments read and their reply
+    written without going through the generic slot lookup and QVariant conversions. Other methods
+    are still dispatched as usual. The generated source file must be compiled with the D-Bus
+    headers in the include path.
+
+    The same option makes the proxy classes marshall the arguments of such methods themselves:
+    the method call is built with typed append calls and the reply is read straight into the
+    returned QDBusReply, instead of going through a list of QVariant.
 */
@@ -0,0 +1,208 @@
+/**
+* Regression benchmark for a connection that owns many names going
+* away. The bus has to tell everyone who is listening that each of
+* the names has lost its owner; this used to take a separate trip
+* through the match rules and security policy for every name, and
+* stalled the bus for seconds when a big service restarted.
+*
+* An owner connection requests NUM_NAMES names and disconnects,
+* while a listener connection times how long it takes to see all the
+* NameOwnerChanged signals. Some watcher connections add a pile of
+* rules for other names, like clients waiting for a service to appear
+* would, so the bus has something to wade through for each signal.
+**/
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-sysdeps.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_NAMES 1000
+#define NUM_WATCHERS 8
+#define NUM_WATCHER_RULES 400
+#define NAME_PREFIX "org.freedesktop.DBus.TestSuite.NamesDisconnect.N"
+#define MAX_SECONDS 5
+
+static void
+die (const char *message)
+{
+  printf ("Failed: %s ***\n", message);
+  exit (1);
+}
+
+/* Returns TRUE if the message is a NameOwnerChanged for one of our
+ * names going from old_owner (if non-NULL) to new_owner
+ */
+static dbus_bool_t
+is_our_owner_change (DBusMessage *message,
+                     const char  *old_owner,
+                     const char  *new_owner)
+{
+  const char *name;
+  const char *old;
+  const char *new;
+
+  if (!dbus_message_is_signal (message, DBUS_INTERFACE_DBUS,
+                               "NameOwnerChanged"))
+    return FALSE;
+
+  if (!dbus_message_get_args (message, NULL,
+                              DBUS_TYPE_STRING, &name,
+                              DBUS_TYPE_STRING, &old,
+                              DBUS_TYPE_STRING, &new,
+                              DBUS_TYPE_INVALID))
+    return FALSE;
+
+  if (strncmp (name, NAME_PREFIX, strlen (NAME_PREFIX)) != 0)
+    return FALSE;
+
+  if (old_owner != NULL && strcmp (old, old_owner) != 0)
+    return FALSE;
+
+  return strcmp (new, new_owner) == 0;
+}
+
+/* Reads messages on the listener until count owner changes
+ * have been seen, giving up after MAX_SECONDS * 4
+ */
+static void
+wait_for_owner_changes (DBusConnection *listener,
+                        int             count,
+                        const char     *old_owner,
+                        const char     *new_owner)
+{
+  long start_tv_sec, start_tv_usec;
+  long now_tv_sec, now_tv_usec;
+  int seen;
+
+  _dbus_get_current_time (&start_tv_sec, &start_tv_usec);
+
+  seen = 0;
+  while (seen < count)
+    {
+      DBusMessage *message;
+
+      _dbus_get_current_time (&now_tv_sec, &now_tv_usec);
+      if (now_tv_sec - start_tv_sec >= MAX_SECONDS * 4)
+        {
+          printf ("Saw only %d of %d NameOwnerChanged signals\n", seen, count);
+          die ("timed out waiting for NameOwnerChanged");
+        }
+
+      if (!dbus_connection_read_write (listener, 1000))
+        die ("listener was disconnected");
+
+      while ((message = dbus_connection_pop_message (listener)) != NULL)
+        {
+          if (is_our_owner_change (message, old_owner, new_owner))
+            ++seen;
+
+          dbus_message_unref (message);
+        }
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  long start_tv_sec, start_tv_usec;
+  long end_tv_sec, end_tv_usec;
+  long delta_msec;
+  DBusConnection *listener;
+  DBusConnection *owner;
+  DBusConnection *watchers[NUM_WATCHERS];
+  char *owner_name;
+  char buf[256];
+  DBusError error;
+  int i, j;
+
+  printf ("*** Testing disconnect of a connection owning %d names\n", NUM_NAMES);
+
+  dbus_error_init (&error);
+
+  listener = dbus_bus_get_private (DBUS_BUS_SESSION, &error);
+  if (listener == NULL)
+    die (error.message);
+
+  owner = dbus_bus_get_private (DBUS_BUS_SESSION, &error);
+  if (owner == NULL)
+    die (error.message);
+
+  dbus_connection_set_exit_on_disconnect (owner, FALSE);
+
+  owner_name = strdup (dbus_bus_get_unique_name (owner));
+  if (owner_name == NULL)
+    die ("no memory");
+
+  for (i = 0; i < NUM_WATCHERS; i++)
+    {
+      watchers[i] = dbus_bus_get_private (DBUS_BUS_SESSION, &error);
+      if (watchers[i] == NULL)
+        die (error.message);
+
+      for (j = 0; j < NUM_WATCHER_RULES; j++)
+        {
+          snprintf (buf, sizeof (buf),
+                    "type='signal',sender='" DBUS_SERVICE_DBUS "',"
+                    "interface='" DBUS_INTERFACE_DBUS "',member='NameOwnerChanged',"
+                    "arg0='org.freedesktop.DBus.TestSuite.Unused%d.N%d'", i, j);
+          dbus_bus_add_match (watchers[i], buf, &error);
+          if (dbus_error_is_set (&error))
+            die (error.message);
+        }
+    }
+
+  dbus_bus_add_match (listener,
+                      "type='signal',sender='" DBUS_SERVICE_DBUS "',"
+                      "interface='" DBUS_INTERFACE_DBUS "',member='NameOwnerChanged'",
+                      &error);
+  if (dbus_error_is_set (&error))
+    die (error.message);
+
+  for (i = 0; i < NUM_NAMES; i++)
+    {
+      int result;
+
+      snprintf (buf, sizeof (buf), NAME_PREFIX "%d", i);
+      result = dbus_bus_request_name (owner, buf, DBUS_NAME_FLAG_DO_NOT_QUEUE,
+                                      &error);
+      if (dbus_error_is_set (&error))
+        die (error.message);
+
+      if (result != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+        die ("did not become primary owner of the name");
+    }
+
+  wait_for_owner_changes (listener, NUM_NAMES, NULL, owner_name);
+
+  _dbus_get_current_time (&start_tv_sec, &start_tv_usec);
+
+  dbus_connection_close (owner);
+  dbus_connection_unref (owner);
+
+  wait_for_owner_changes (listener, NUM_NAMES, owner_name, "");
+
+  _dbus_get_current_time (&end_tv_sec, &end_tv_usec);
+
+  delta_msec = (end_tv_sec - start_tv_sec) * 1000 +
+    (end_tv_usec - start_tv_usec) / 1000;
+  printf ("Released %d names in %ldms\n", NUM_NAMES, delta_msec);
+
+  if (delta_msec >= MAX_SECONDS * 1000)
+    die ("releasing the names took too long");
+
+  free (owner_name);
+  for (i = 0; i < NUM_WATCHERS; i++)
+    {
+      dbus_connection_close (watchers[i]);
+      dbus_connection_unref (watchers[i]);
+    }
+  dbus_connection_close (listener);
+  dbus_connection_unref (listener);
+
+  dbus_shutdown ();
+
+  printf ("Success ***\n");
+  exit (0);
+}
@@ -136,6 +136,40 @@ namespace QTest {
         return printableMap(map);
     }
 }
+
+// something like what HAL or NetworkManager send us
+inline QString largeIntrospectionDocument(int interfaceCount, int memberCount, int objectCount)
+{
+    QString interfaces;
+    for (int i = 0; i < interfaceCount; ++i) {
+        interfaces += QString("  <interface name=\"iface.iface%1\">\n").arg(i + 1);
+        for (int j = 0; j < memberCount; ++j)
+            interfaces += QString("    <method name=\"Method%1\">\n"
+                                  "      <arg name=\"in\" type=\"a{sv}\" direction=\"in\"/>\n"
+                                  "      <arg name=\"out\" type=\"as\" direction=\"out\"/>\n"
+                                  "      <annotation name=\"foo.testing\" value=\"nothing\"/>\n"
+                                  "    </method>\n"
+                                  "    <signal name=\"Signal%1\">\n"
+                                  "      <arg type=\"s\"/>\n"
+                                  "    </signal>\n"
+                                  "    <property name=\"property%1\" type=\"i\" access=\"read\"/>\n")
+                          .arg(j);
+        interfaces += "  </interface>\n";
+    }
+
+    QString xmlData = "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+                      "\"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+                      "<node>\n";
+    xmlData += interfaces;
+    for (int i = 0; i < objectCount; ++i)
+        xmlData += QString("  <node name=\"obj%1\">\n"
+                           "    <interface name=\"iface.iface1\">\n"
+                           "      <method name=\"Method0\"/>\n"
+                           "    </interface>\n"
+                           "  </node>\n").arg(i + 1);
+    xmlData += "</node>\n";
+    return xmlData;
+}
 #endif
 bool compare(const QVariantList &l1, const QVariantList &l2);
 bool compare(const QVariantMap &m1, const QVariantMap &m2);
@@ -4,7 +4,22 @@
 class Pong: public QObject
 {
     Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.selftest")
+    Q_PROPERTY(QString value READ value WRITE setValue)
+public:
+    QString value() const
+    { return m_value; }
+
 public slots:
+    void setValue(const QString &value)
+    {
+        m_value = value;
+
+        QDBusMessage msg = QDBusMessage::signal("/org/kde/selftest", "org.kde.selftest",
+                                                "valueChanged");
+        msg << QString("value");
+        QDBus::sessionBus().send(msg);
+    }
 
     void ping(const QDBusMessage &msg)
     {
@@ -14,6 +29,9 @@ public slots:
         if (!msg.connection().send(reply))
             exit(1);
     }
+
+private:
+    QString m_value;
 };
 
 int main(int argc, char *argv[])
@@ -28,7 +46,8 @@ int main(int argc, char *argv[])
         exit(2);
 
     Pong pong;
-    con.registerObject("/org/kde/selftest", &pong, QDBusConnection::ExportSlots);
+    con.registerObject("/org/kde/selftest", &pong,
+                      QDBusConnection::ExportSlots | QDBusConnection::ExportProperties);
 
     printf("ready.\n");
 
@@ -4,6 +4,7 @@
 #include <QtTest/QtTest>
 
 #include <dbus/qdbus.h>
+#include <dbus/dbus.h>
 
 #include "common.h"
 
@@ -48,10 +49,13 @@ private slots:
     void overloadedSignalEmission_data();
     void overloadedSignalEmission();
     void readProperties();
+    void readAllProperties();
     void writeProperties();
 
     void typeMatching_data();
     void typeMatching();
+
+    void staticDispatch();
 };
 
 class QDBusSignalSpy: public QObject
@@ -427,6 +431,103 @@ public slots:
     }
 };
 
+// the same as what dbusidl2cpp -s generates
+class StaticInterface: public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "local.StaticInterface")
+public:
+    StaticInterface(QObject *parent) : QDBusAbstractAdaptor(parent)
+    { }
+
+    static int dispatched;
+
+public slots:
+    int add(int a, int b)
+    { slotSpy = __PRETTY_FUNCTION__; return a + b; }
+    QString echo(const QString &s, bool &reversed)
+    { slotSpy = __PRETTY_FUNCTION__; reversed = false; return s; }
+    QString echo(const QVariant &v)
+    { slotSpy = __PRETTY_FUNCTION__; return v.toString(); }
+};
+
+int StaticInterface::dispatched = 0;
+
+static DBusMessage *qDBusDispatch_StaticInterface(QDBusAbstractAdaptor *adaptor, DBusMessage *call,
+                                                  bool *handled)
+{
+    StaticInterface *self = static_cast<StaticInterface *>(adaptor);
+    const char *member = dbus_message_get_member(call);
+    const char *signature = dbus_message_get_signature(call);
+    *handled = false;
+
+    switch (qstrlen(member)) {
+    case 3:
+        if (qstrcmp(member, "add") == 0 && qstrcmp(signature, "ii") == 0) {
+            *handled = true;
+            if (!self)
+                return 0;
+
+            DBusMessageIter it;
+            dbus_message_iter_init(call, &it);
+            dbus_int32_t arg0_raw;
+            dbus_message_iter_get_basic(&it, &arg0_raw);
+            dbus_message_iter_next(&it);
+            int arg0 = arg0_raw;
+            dbus_int32_t arg1_raw;
+            dbus_message_iter_get_basic(&it, &arg1_raw);
+            dbus_message_iter_next(&it);
+            int arg1 = arg1_raw;
+            int arg2 = self->add(arg0, arg1);
+            ++StaticInterface::dispatched;
+
+            DBusMessage *reply = dbus_message_new_method_return(call);
+            if (!reply)
+                return 0;
+            DBusMessageIter out;
+            dbus_message_iter_init_append(reply, &out);
+            dbus_int32_t arg2_raw = arg2;
+            dbus_message_iter_append_basic(&out, DBUS_TYPE_INT32, &arg2_raw);
+            return reply;
+        }
+        break;
+    case 4:
+        if (qstrcmp(member, "echo") == 0 && qstrcmp(signature, "s") == 0) {
+            *handled = true;
+            if (!self)
+                return 0;
+
+            DBusMessageIter it;
+            dbus_message_iter_init(call, &it);
+            const char *arg0_raw;
+            dbus_message_iter_get_basic(&it, &arg0_raw);
+            dbus_message_iter_next(&it);
+            QString arg0 = QString::fromUtf8(arg0_raw);
+            bool arg2;
+            QString arg1 = self->echo(arg0, arg2);
+            ++StaticInterface::dispatched;
+
+            DBusMessage *reply = dbus_message_new_method_return(call);
+            if (!reply)
+                return 0;
+            DBusMessageIter out;
+            dbus_message_iter_init_append(reply, &out);
+            QByteArray arg1_utf8 = arg1.toUtf8();
+            const char *arg1_raw = arg1_utf8.constData();
+            dbus_message_iter_append_basic(&out, DBUS_TYPE_STRING, &arg1_raw);
+            dbus_bool_t arg2_raw = arg2;
+            dbus_message_iter_append_basic(&out, DBUS_TYPE_BOOLEAN, &arg2_raw);
+            return reply;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+static const bool qDBusDispatch_StaticInterface_registered =
+    (qDBusAddAdaptorDispatcher(&StaticInterface::staticMetaObject, qDBusDispatch_StaticInterface), true);
+
 void tst_QDBusAbstractAdaptor::methodCalls_data()
 {
     QTest::addColumn<int>("nInterfaces");
@@ -699,6 +800,48 @@ void tst_QDBusAbstractAdaptor::readProperties()
     }
 }
 
+void tst_QDBusAbstractAdaptor::readAllProperties()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    MyObject obj;
+    con.registerObject("/", &obj);
+
+    QDBusInterfacePtr properties(con, con.baseService(), "/", "org.freedesktop.DBus.Properties");
+    for (int i = 2; i <= 4; ++i) {
+        QString name = QString("Interface%1").arg(i);
+
+        QDBusMessage reply =
+            properties->call(QDBusInterface::UseEventLoop, "GetAll", "local." + name);
+        QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+        QCOMPARE(reply.signature(), QString("a{sv}"));
+
+        QVariantMap map = reply.at(0).toMap();
+        QCOMPARE(map.count(), 2);
+        for (int j = 1; j <= 2; ++j) {
+            QString propname = QString("prop%1").arg(j);
+            QVariant value = QDBusTypeHelper<QVariant>::fromVariant(map.value(propname));
+
+            QCOMPARE(value.userType(), int(QVariant::String));
+            QCOMPARE(value.toString(), QString("QString %1::%2() const").arg(name, propname));
+        }
+
+        // now the same through the interface
+        QDBusInterfacePtr iface(con, con.baseService(), "/", "local." + name);
+        map = iface->allProperties(QDBusInterface::UseEventLoop);
+        QCOMPARE(map.count(), 2);
+        QCOMPARE(map.value("prop1").userType(), int(QVariant::String));
+        QCOMPARE(map.value("prop1").toString(), QString("QString %1::prop1() const").arg(name));
+        QCOMPARE(map.value("prop2").toString(), QString("QString %1::prop2() const").arg(name));
+    }
+
+    // unknown interfaces fail
+    QDBusMessage reply =
+        properties->call(QDBusInterface::UseEventLoop, "GetAll", QString("local.Nonexistent"));
+    QCOMPARE(reply.type(), QDBusMessage::ErrorMessage);
+}
+
 void tst_QDBusAbstractAdaptor::writeProperties()
 {
     QDBusConnection &con = QDBus::sessionBus();
@@ -984,6 +1127,45 @@ void tst_QDBusAbstractAdaptor::typeMatching()
     iface->deleteLater();
 }
 
+void tst_QDBusAbstractAdaptor::staticDispatch()
+{
+    QObject obj;
+    new StaticInterface(&obj);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+    con.registerObject("/static", &obj);
+
+    QDBusInterface *iface = con.findInterface(con.baseService(), "/static", "local.StaticInterface");
+    QObject deleter;
+    iface->setParent(&deleter);
+    StaticInterface::dispatched = 0;
+
+    // handled by the dispatcher
+    QDBusMessage reply = iface->call(QDBusInterface::UseEventLoop, "add", 40, 2);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(slotSpy, "int StaticInterface::add(int, int)");
+    QCOMPARE(reply.count(), 1);
+    QCOMPARE(reply.at(0).toInt(), 42);
+    QCOMPARE(StaticInterface::dispatched, 1);
+
+    reply = iface->call(QDBusInterface::UseEventLoop, "echo", QString("Hello"));
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(slotSpy, "QString StaticInterface::echo(const QString&, bool&)");
+    QCOMPARE(reply.count(), 2);
+    QCOMPARE(reply.at(0).toString(), QString("Hello"));
+    QCOMPARE(reply.at(1).toBool(), false);
+    QCOMPARE(StaticInterface::dispatched, 2);
+
+    // not known to the dispatcher: goes through the usual slot lookup
+    reply = iface->callWithArgs("echo.v", QVariantList() << QVariant(QString("World")),
+                                QDBusInterface::UseEventLoop);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(slotSpy, "QString StaticInterface::echo(const QVariant&)");
+    QCOMPARE(reply.at(0).toString(), QString("World"));
+    QCOMPARE(StaticInterface::dispatched, 2);
+}
+
 QTEST_MAIN(tst_QDBusAbstractAdaptor)
 
 #include "tst_qdbusabstractadaptor.moc"
@@ -0,0 +1,278 @@
+#include <QtCore/QtCore>
+#include <QtTest/QtTest>
+#include <dbus/qdbus.h>
+
+#define USE_PRIVATE_CODE
+#include "common.h"
+
+// number of messages sent per row
+static const int Iterations = 2000;
+
+// number of calls placed per row of threadedDispatch, and the work done by each
+static const int ThreadedIterations = 400;
+static const int WorkUnits = 200000;
+static const int ObjectCount = 4;
+
+class Worker: public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.selftest")
+public slots:
+    int work(int n)
+    {
+        // burn some CPU, so that the call takes longer than its dispatch
+        volatile int sum = 0;
+        for (int i = 0; i < n; ++i)
+            sum += i % 7;
+        return sum;
+    }
+};
+
+class ServerThread: public QThread
+{
+protected:
+    void run()
+    {
+        exec();
+    }
+};
+
+class ReplyCounter: public QObject
+{
+    Q_OBJECT
+public:
+    int count;
+    int errors;
+
+    ReplyCounter() : count(0), errors(0)
+    { }
+
+public slots:
+    void reply(const QDBusMessage &msg)
+    {
+        if (msg.type() != QDBusMessage::ReplyMessage)
+            ++errors;
+        ++count;
+    }
+};
+
+class tst_QDBusBenchmark: public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+private slots:
+    void sendSignal_data();
+    void sendSignal();
+
+    void callLatency_data();
+    void callLatency();
+
+    void threadedDispatch_data();
+    void threadedDispatch();
+
+    void parseLargeDocument_data();
+    void parseLargeDocument();
+
+private:
+    QProcess proc;
+};
+
+void tst_QDBusBenchmark::initTestCase()
+{
+    QVERIFY(QDBus::sessionBus().isConnected());
+
+    proc.start("./qpong");
+    QVERIFY(proc.waitForStarted());
+    QTest::qWait(2000);
+}
+
+void tst_QDBusBenchmark::cleanupTestCase()
+{
+    proc.close();
+    proc.kill();
+}
+
+void tst_QDBusBenchmark::sendSignal_data()
+{
+    QTest::addColumn<QVariantList>("args");
+    QTest::addColumn<QString>("sig");
+
+    QStringList strings;
+    QList<int> ints;
+    QVariantMap map;
+    for (int i = 0; i < 32; ++i) {
+        strings << QString("string%1").arg(i);
+        ints << i;
+        map.insert(QString("key%1").arg(i), i);
+    }
+
+    QTest::newRow("i") << (QVariantList() << 42) << "i";
+    QTest::newRow("s") << (QVariantList() << QString("ping")) << "s";
+    QTest::newRow("as") << (QVariantList() << strings) << "as";
+    QTest::newRow("ai") << (QVariantList() << qVariantFromValue(ints)) << "ai";
+    QTest::newRow("ay") << (QVariantList() << QByteArray(1024, 'x')) << "ay";
+    QTest::newRow("a{sv}") << (QVariantList() << map) << "a{sv}";
+    QTest::newRow("sisu") << (QVariantList() << QString("ping") << 42 << QString("pong") << 42U)
+                          << "sisu";
+
+    // no signature: the types come from the variants
+    QTest::newRow("i-guessed") << (QVariantList() << 42) << QString();
+    QTest::newRow("as-guessed") << (QVariantList() << strings) << QString();
+    QTest::newRow("sisu-guessed") << (QVariantList() << QString("ping") << 42 << QString("pong") << 42U)
+                                  << QString();
+}
+
+void tst_QDBusBenchmark::sendSignal()
+{
+    QFETCH(QVariantList, args);
+    QFETCH(QString, sig);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusMessage msg = QDBusMessage::signal("/org/kde/selftest", "org.kde.selftest", "benchmark");
+    msg += args;
+    if (!sig.isEmpty())
+        msg.setSignature(sig);
+
+    QTime timer;
+    timer.start();
+    for (int i = 0; i < Iterations; ++i)
+        QVERIFY(con.send(msg));
+    int elapsed = timer.elapsed();
+
+    qDebug() << Iterations << "messages with signature" << (sig.isEmpty() ? QString("(none)") : sig)
+             << "in" << elapsed << "ms";
+}
+
+void tst_QDBusBenchmark::callLatency_data()
+{
+    QTest::addColumn<int>("mode");
+
+    QTest::newRow("NoUseEventLoop") << int(QDBusConnection::NoUseEventLoop);
+    QTest::newRow("UseEventLoop") << int(QDBusConnection::UseEventLoop);
+}
+
+void tst_QDBusBenchmark::callLatency()
+{
+    QFETCH(int, mode);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusMessage msg = QDBusMessage::methodCall("org.kde.selftest", "/org/kde/selftest",
+                                                "org.kde.selftest", "ping");
+    msg << 42;
+
+    QTime timer;
+    timer.start();
+    for (int i = 0; i < Iterations; ++i) {
+        QDBusMessage reply = con.sendWithReply(msg, QDBusConnection::WaitMode(mode));
+        QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    }
+    int elapsed = timer.elapsed();
+
+    qDebug() << Iterations << "calls to qpong in" << elapsed << "ms";
+}
+
+void tst_QDBusBenchmark::threadedDispatch_data()
+{
+    QTest::addColumn<int>("threadCount");
+
+    // the objects live in threadCount threads of their own; 0 means in the main thread,
+    // registered with ConcurrentCalls
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("ConcurrentCalls") << 0;
+}
+
+void tst_QDBusBenchmark::threadedDispatch()
+{
+    QFETCH(int, threadCount);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusConnection::RegisterOptions options = QDBusConnection::ExportAllSlots;
+    if (!threadCount)
+        options |= QDBusConnection::ConcurrentCalls;
+
+    QList<QThread *> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        QThread *thread = new ServerThread;
+        thread->start();
+        threads << thread;
+    }
+
+    QList<Worker *> workers;
+    for (int i = 0; i < ObjectCount; ++i) {
+        Worker *worker = new Worker;
+        if (threadCount)
+            worker->moveToThread(threads.at(i % threadCount));
+        QVERIFY(con.registerObject(QString("/org/kde/selftest/worker%1").arg(i), worker, options));
+        workers << worker;
+    }
+
+    ReplyCounter counter;
+    QTime timer;
+    timer.start();
+    for (int i = 0; i < ThreadedIterations; ++i) {
+        QDBusMessage msg = QDBusMessage::methodCall(con.baseService(),
+                                                    QString("/org/kde/selftest/worker%1").arg(i % ObjectCount),
+                                                    "org.kde.selftest", "work");
+        msg << WorkUnits;
+        QVERIFY(con.sendWithReplyAsync(msg, &counter, SLOT(reply(QDBusMessage))));
+    }
+    while (counter.count < ThreadedIterations && timer.elapsed() < 60000)
+        QTest::qWait(10);
+    int elapsed = timer.elapsed();
+
+    for (int i = 0; i < ObjectCount; ++i)
+        con.unregisterObject(QString("/org/kde/selftest/worker%1").arg(i));
+    foreach (QThread *thread, threads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(workers);
+    qDeleteAll(threads);
+
+    QCOMPARE(counter.count, ThreadedIterations);
+    QCOMPARE(counter.errors, 0);
+
+    qDebug() << ThreadedIterations << "calls to" << ObjectCount << "objects in"
+             << elapsed << "ms";
+}
+
+void tst_QDBusBenchmark::parseLargeDocument_data()
+{
+    QTest::addColumn<int>("interfaceCount");
+    QTest::addColumn<int>("memberCount");
+    QTest::addColumn<int>("objectCount");
+
+    QTest::newRow("many-members") << 1 << 2000 << 0;
+    QTest::newRow("many-interfaces") << 200 << 10 << 0;
+    QTest::newRow("many-objects") << 1 << 10 << 2000;
+    QTest::newRow("everything") << 50 << 50 << 500;
+}
+
+void tst_QDBusBenchmark::parseLargeDocument()
+{
+    QFETCH(int, interfaceCount);
+    QFETCH(int, memberCount);
+    QFETCH(int, objectCount);
+
+    // the structure is checked by tst_qdbusxmlparser
+    QString xmlData = largeIntrospectionDocument(interfaceCount, memberCount, objectCount);
+
+    QTime timer;
+    timer.start();
+    QDBusIntrospection::ObjectTree tree =
+        QDBusIntrospection::parseObjectTree(xmlData, "local.testing", "/");
+    int elapsed = timer.elapsed();
+
+    QCOMPARE(tree.childObjects.count(), objectCount);
+    qDebug() << xmlData.length() << "characters parsed in" << elapsed << "ms";
+}
+
+QTEST_MAIN(tst_QDBusBenchmark)
+
+#include "tst_qdbusbenchmark.moc"
@@ -10,6 +10,10 @@ class MyObject: public QObject
     Q_OBJECT
 public slots:
     void method(const QDBusMessage &msg) { serial = msg.serialNumber(); path = msg.path(); }
+    QString typed(int i, short s, const QString &str, const QStringList &list, const QVariant &v)
+    {
+        return QString("%1 %2 %3 %4 %5").arg(i).arg(s).arg(str).arg(list.join(",")).arg(v.toString());
+    }
 
 public:
     int serial;
@@ -17,6 +21,97 @@ public:
     MyObject() : serial(0) { }
 };
 
+class ThreadedObject: public QObject
+{
+    Q_OBJECT
+public slots:
+    void method() { thread = QThread::currentThread(); }
+    void concurrent()
+    {
+        // waits for a second call to come in while this one is still running
+        QMutexLocker locker(&mutex);
+        if (++running > maxRunning)
+            maxRunning = running;
+        condition.wakeAll();
+        if (running < 2)
+            condition.wait(&mutex, 2000);
+        --running;
+    }
+
+public:
+    QThread *thread;
+    QMutex mutex;
+    QWaitCondition condition;
+    int running;
+    int maxRunning;
+    ThreadedObject() : thread(0), running(0), maxRunning(0) { }
+};
+
+class ConnectionCloser: public QObject
+{
+    Q_OBJECT
+public slots:
+    void close() { QDBusConnection::closeConnection("closer"); closed = true; }
+
+public:
+    bool closed;
+    ConnectionCloser() : closed(false) { }
+};
+
+class EventLoopThread: public QThread
+{
+protected:
+    void run() { exec(); }
+};
+
+class MyAdaptor: public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "local.MyAdaptor")
+public:
+    MyAdaptor(QObject *parent) : QDBusAbstractAdaptor(parent) { }
+
+public slots:
+    void method() { }
+};
+
+class QDBusForwarder: public QObject
+{
+    Q_OBJECT
+public slots:
+    void forward(const QDBusMessage &msg)
+    {
+        QDBusMessage copy = msg;
+        copy.setPath("/org/kde/selftest/forwarded");
+        if (!replacement.isEmpty()) {
+            copy.clear();
+            copy << replacement;
+        }
+        msg.connection().send(copy);
+    }
+
+public:
+    QString replacement;
+};
+
+class QDBusCallForwarder: public QObject
+{
+    Q_OBJECT
+public slots:
+    void method(const QDBusMessage &msg)
+    {
+        QDBusMessage copy = msg;
+        copy.setPath("/forward-target");
+        msg.connection().sendWithReplyAsync(copy, this, SLOT(reply(QDBusMessage)));
+    }
+    void reply(const QDBusMessage &msg) { replyType = msg.type(); ++count; }
+
+public:
+    int replyType;
+    int count;
+    QDBusCallForwarder() : replyType(-1), count(0) { }
+};
+
 class tst_QDBusConnection: public QObject
 {
     Q_OBJECT
@@ -24,26 +119,44 @@ class tst_QDBusConnection: public QObject
 private slots:
     void addConnection();
     void connect();
+    void connectFiltered();
+    void connectAfterOwnerChange();
     void send();
     void sendAsync();
+    void sendBatch();
+    void sendBatchUnsent();
+    void sendBatchAsync();
     void sendSignal();
+    void forwardSignal();
+    void forwardCall();
 
     void registerObject();
+    void registerChildObjects();
+    void callTypedSlot();
+    void introspectionCache();
+    void callObjectInThread();
+    void concurrentCalls();
+    void closeFromSlot();
 
 public:
     bool callMethod(const QDBusConnection &conn, const QString &path);
+    QString introspect(const QDBusConnection &conn, const QString &path);
 };
 
 class QDBusSpy: public QObject
 {
     Q_OBJECT
 public slots:
-    void handlePing(const QString &str) { args.clear(); args << str; }
+    void handlePing(const QString &str) { args.clear(); args << str; ++count; }
     void asyncReply(const QDBusMessage &msg) { args << msg; serial = msg.replySerialNumber(); }
+    void batchReply(const QDBusMessage &msg) { serials << msg.replySerialNumber(); ++count; }
 
 public:
     QList<QVariant> args;
+    QList<int> serials;
     int serial;
+    int count;
+    QDBusSpy() : serial(0), count(0) { }
 };
 
 void tst_QDBusConnection::sendSignal()
@@ -96,6 +209,156 @@ void tst_QDBusConnection::sendAsync()
     QCOMPARE(spy.serial, msgId);
 }
 
+static QList<QDBusMessage> batchMessages(const QDBusConnection &con)
+{
+    QList<QDBusMessage> batch;
+    for (int i = 0; i < 10; ++i) {
+        QDBusMessage msg = QDBusMessage::methodCall("org.freedesktop.DBus",
+                "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
+        msg << (i % 2 ? con.baseService() : QString("org.kde.selftest.nonexistent"));
+        batch << msg;
+    }
+    return batch;
+}
+
+void tst_QDBusConnection::connectAfterOwnerChange()
+{
+    QDBusSpy spy;
+    QDBusConnection &con = QDBus::sessionBus();
+    QString name("org.kde.selftest.ownerchange");
+
+    QVERIFY(!con.busService()->requestName(name, QDBusBusService::DoNotQueueName).isError());
+    QVERIFY(con.connect(name, "/org/kde/selftest", "org.kde.selftest", "ping", &spy,
+                        SLOT(handlePing(QString))));
+
+    // the connection must notice that the name went away
+    QVERIFY(!con.busService()->releaseName(name).isError());
+    QTest::qWait(500);
+    QVERIFY(!con.connect(name, "/org/kde/selftest", "org.kde.selftest", "ping", &spy,
+                         SLOT(handlePing(QString))));
+
+    // and that it came back
+    QVERIFY(!con.busService()->requestName(name, QDBusBusService::DoNotQueueName).isError());
+    QTest::qWait(500);
+    QVERIFY(con.connect(name, "/org/kde/selftest", "org.kde.selftest", "ping", &spy,
+                        SLOT(handlePing(QString))));
+}
+
+void tst_QDBusConnection::sendBatch()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    QList<QDBusMessage> replies = con.sendWithReplies(batchMessages(con));
+    QCOMPARE(replies.count(), 10);
+
+    // the replies must be in order
+    for (int i = 0; i < replies.count(); ++i) {
+        if (i % 2) {
+            QCOMPARE(replies.at(i).type(), QDBusMessage::ReplyMessage);
+            QCOMPARE(replies.at(i).at(0).toString(), con.baseService());
+        } else {
+            QCOMPARE(replies.at(i).type(), QDBusMessage::ErrorMessage);
+        }
+    }
+    QVERIFY(con.lastError().isValid());
+}
+
+void tst_QDBusConnection::sendBatchUnsent()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    // an invalid message can't be sent, but must not look like a reply either
+    QList<QDBusMessage> batch = batchMessages(con).mid(1, 2);
+    batch.insert(1, QDBusMessage());
+
+    QList<QDBusMessage> replies = con.sendWithReplies(batch);
+    QCOMPARE(replies.count(), 3);
+    QCOMPARE(replies.at(0).type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(replies.at(1).type(), QDBusMessage::ErrorMessage);
+    QCOMPARE(replies.at(2).type(), QDBusMessage::ErrorMessage);
+    QVERIFY(con.lastError() == QDBusError::Failed);     // the first error in the batch
+}
+
+void tst_QDBusConnection::sendBatchAsync()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    QDBusSpy spy;
+    QList<int> serials = con.sendWithRepliesAsync(batchMessages(con), &spy,
+                                                  SLOT(batchReply(QDBusMessage)));
+    QCOMPARE(serials.count(), 10);
+    QVERIFY(!serials.contains(0));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(spy.count, 10);
+    qSort(spy.serials);
+    QCOMPARE(spy.serials, serials);
+}
+
+void tst_QDBusConnection::forwardSignal()
+{
+    QDBusForwarder forwarder;
+    QDBusSpy spy;
+
+    QDBusConnection &con = QDBus::sessionBus();
+
+    QVERIFY(con.connect(con.baseService(), "/org/kde/selftest", "org.kde.selftest", "forward",
+                        &forwarder, SLOT(forward(QDBusMessage))));
+    QVERIFY(con.connect(con.baseService(), "/org/kde/selftest/forwarded", "org.kde.selftest",
+                        "forward", &spy, SLOT(handlePing(QString))));
+
+    // the arguments are sent as they were received
+    QDBusMessage msg = QDBusMessage::signal("/org/kde/selftest", "org.kde.selftest", "forward");
+    msg << QLatin1String("unchanged");
+    QVERIFY(con.send(msg));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(spy.count, 1);
+    QCOMPARE(spy.args.at(0).toString(), QString("unchanged"));
+
+    // changed arguments must be marshalled again
+    forwarder.replacement = "changed";
+    msg = QDBusMessage::signal("/org/kde/selftest", "org.kde.selftest", "forward");
+    msg << QLatin1String("original");
+    QVERIFY(con.send(msg));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(spy.count, 2);
+    QCOMPARE(spy.args.at(0).toString(), QString("changed"));
+}
+
+void tst_QDBusConnection::forwardCall()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    MyObject target;
+    QDBusCallForwarder forwarder;
+    QVERIFY(con.registerObject("/forward-target", &target, QDBusConnection::ExportSlots));
+    QVERIFY(con.registerObject("/forwarder", &forwarder, QDBusConnection::ExportSlots));
+
+    // send() asks for no reply; the forwarded copy must not inherit that
+    QDBusMessage msg = QDBusMessage::methodCall(con.baseService(), "/forwarder", "local.any",
+                                                "method");
+    msg << QLatin1String("unchanged");
+    QVERIFY(con.send(msg));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(target.path, QString("/forward-target"));
+    QCOMPARE(forwarder.count, 1);
+    QCOMPARE(forwarder.replyType, int(QDBusMessage::ReplyMessage));
+
+    con.unregisterObject("/forwarder");
+    con.unregisterObject("/forward-target");
+}
+
 void tst_QDBusConnection::connect()
 {
     QDBusSpy spy;
@@ -117,6 +380,41 @@ void tst_QDBusConnection::connect()
     QCOMPARE(spy.args.at(0).toString(), QString("ping"));
 }
 
+void tst_QDBusConnection::connectFiltered()
+{
+    QDBusSpy pathSpy, anyPathSpy, otherSenderSpy;
+
+    QDBusConnection &con = QDBus::sessionBus();
+
+    QVERIFY(con.connect(con.baseService(), "/org/kde/selftest/a", "org.kde.selftest", "filtered",
+                        &pathSpy, SLOT(handlePing(QString))));
+    QVERIFY(con.connect(QString(), QString(), "org.kde.selftest", "filtered",
+                        &anyPathSpy, SLOT(handlePing(QString))));
+    QVERIFY(con.connect("org.freedesktop.DBus", "/org/kde/selftest/a", "org.kde.selftest",
+                        "filtered", &otherSenderSpy, SLOT(handlePing(QString))));
+
+    QDBusMessage msg = QDBusMessage::signal("/org/kde/selftest/a", "org.kde.selftest",
+            "filtered");
+    msg << QLatin1String("a");
+    QVERIFY(con.send(msg));
+
+    msg = QDBusMessage::signal("/org/kde/selftest/b", "org.kde.selftest", "filtered");
+    msg << QLatin1String("b");
+    QVERIFY(con.send(msg));
+
+    // same member, other interface
+    msg = QDBusMessage::signal("/org/kde/selftest/a", "org.kde.selftest2", "filtered");
+    msg << QLatin1String("c");
+    QVERIFY(con.send(msg));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(pathSpy.count, 1);
+    QCOMPARE(pathSpy.args.at(0).toString(), QString("a"));
+    QCOMPARE(anyPathSpy.count, 2);
+    QCOMPARE(otherSenderSpy.count, 0);
+}
+
 void tst_QDBusConnection::addConnection()
 {
     {
@@ -243,6 +541,75 @@ void tst_QDBusConnection::registerObject()
     }
 }
 
+void tst_QDBusConnection::callTypedSlot()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    MyObject obj;
+    QVERIFY(con.registerObject("/typed", &obj, QDBusConnection::ExportSlots));
+
+    // the arguments are read straight into the slot's parameters,
+    // including the int to short conversion and the nested variant
+    QDBusMessage msg = QDBusMessage::methodCall(con.baseService(), "/typed", "local.any", "typed");
+    msg << 42 << -3 << QString("abc") << (QStringList() << "d" << "e")
+        << QDBusTypeHelper<QVariant>::toVariant(QString("xyz"));
+    QDBusMessage reply = con.sendWithReply(msg, QDBusConnection::UseEventLoop);
+
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QCOMPARE(reply.count(), 1);
+    QCOMPARE(reply.at(0).toString(), QString("42 -3 abc d,e xyz"));
+
+    con.unregisterObject("/typed");
+}
+
+void tst_QDBusConnection::registerChildObjects()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    QObject parent;
+    QList<MyObject *> children;
+    for (int i = 0; i < 2000; ++i) {
+        MyObject *child = new MyObject;
+        child->setObjectName(QString("child%1").arg(i));
+        child->setParent(&parent);
+        children << child;
+    }
+    QVERIFY(con.registerObject("/p1", &parent,
+                               QDBusConnection::ExportChildObjects | QDBusConnection::ExportSlots));
+
+    QVERIFY(callMethod(con, "/p1/child1500"));
+    QCOMPARE(children.at(1500)->path, QString("/p1/child1500"));
+    QVERIFY(callMethod(con, "/p1/child0"));
+    QCOMPARE(children.at(0)->path, QString("/p1/child0"));
+    QVERIFY(!callMethod(con, "/p1/child2000"));
+
+    // grandchildren
+    MyObject *grandchild = new MyObject;
+    grandchild->setObjectName("grandchild");
+    grandchild->setParent(children.at(10));
+    QVERIFY(callMethod(con, "/p1/child10/grandchild"));
+    QCOMPARE(grandchild->path, QString("/p1/child10/grandchild"));
+
+    // renamed, added and deleted children
+    children.at(20)->setObjectName("renamed");
+    QVERIFY(!callMethod(con, "/p1/child20"));
+    QVERIFY(callMethod(con, "/p1/renamed"));
+    QCOMPARE(children.at(20)->path, QString("/p1/renamed"));
+
+    MyObject *added = new MyObject;
+    added->setObjectName("added");
+    added->setParent(&parent);
+    QVERIFY(callMethod(con, "/p1/added"));
+    QCOMPARE(added->path, QString("/p1/added"));
+
+    delete children.at(1500);
+    QVERIFY(!callMethod(con, "/p1/child1500"));
+
+    con.unregisterObject("/p1");
+}
+
 bool tst_QDBusConnection::callMethod(const QDBusConnection &conn, const QString &path)
 {
     QDBusMessage msg = QDBusMessage::methodCall(conn.baseService(), path, "local.any", "method");
@@ -251,6 +618,127 @@ bool tst_QDBusConnection::callMethod(const QDBusConnection &conn, const QString
     return reply.type() == QDBusMessage::ReplyMessage;
 }    
 
+void tst_QDBusConnection::introspectionCache()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    QString child = "<node name=\"q\"/>";
+    QVERIFY(!introspect(con, "/p1").contains(child));
+
+    {
+        MyObject obj;
+        QVERIFY(con.registerObject("/p1/q", &obj, QDBusConnection::ExportSlots |
+                                   QDBusConnection::ExportAdaptors));
+        QString xml = introspect(con, "/p1");
+        QVERIFY(xml.contains(child));
+        QCOMPARE(introspect(con, "/p1"), xml);
+
+        // adding an adaptor changes the object's introspection
+        xml = introspect(con, "/p1/q");
+        QVERIFY(!xml.contains("local.MyAdaptor"));
+        new MyAdaptor(&obj);
+        xml = introspect(con, "/p1/q");
+        QVERIFY(xml.contains("local.MyAdaptor"));
+        QCOMPARE(introspect(con, "/p1/q"), xml);
+
+        // so does unregistering and registering again
+        con.unregisterObject("/p1/q");
+        QVERIFY(!introspect(con, "/p1").contains(child));
+        QVERIFY(con.registerObject("/p1/q", &obj, QDBusConnection::ExportSlots));
+        QVERIFY(introspect(con, "/p1").contains(child));
+        QVERIFY(!introspect(con, "/p1/q").contains("local.MyAdaptor"));
+    }
+
+    // and destroying the object
+    QVERIFY(!introspect(con, "/p1").contains(child));
+}
+
+void tst_QDBusConnection::callObjectInThread()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    EventLoopThread thread;
+    thread.start();
+    ThreadedObject obj;
+    obj.moveToThread(&thread);
+    QVERIFY(con.registerObject("/threaded", &obj, QDBusConnection::ExportSlots));
+
+    // the call is delivered in the thread the object lives in, and the reply still comes back
+    QDBusMessage msg = QDBusMessage::methodCall(con.baseService(), "/threaded", "local.any",
+                                                "method");
+    QDBusMessage reply = con.sendWithReply(msg, QDBusConnection::UseEventLoop);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+    QVERIFY(obj.thread == &thread);
+
+    con.unregisterObject("/threaded");
+    thread.quit();
+    QVERIFY(thread.wait(5000));
+}
+
+void tst_QDBusConnection::concurrentCalls()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QVERIFY(con.isConnected());
+
+    ThreadedObject obj;
+    QVERIFY(con.registerObject("/concurrent", &obj,
+                               QDBusConnection::ExportSlots | QDBusConnection::ConcurrentCalls));
+
+    // the second call must start while the first is still running; delivered one after the
+    // other, each would wait two seconds for the other in vain
+    QDBusSpy spy;
+    QDBusMessage msg = QDBusMessage::methodCall(con.baseService(), "/concurrent", "local.any",
+                                                "concurrent");
+    QVERIFY(con.sendWithReplyAsync(msg, &spy, SLOT(batchReply(QDBusMessage))));
+    QVERIFY(con.sendWithReplyAsync(msg, &spy, SLOT(batchReply(QDBusMessage))));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(spy.count, 2);
+    QCOMPARE(obj.maxRunning, 2);
+
+    con.unregisterObject("/concurrent");
+}
+
+void tst_QDBusConnection::closeFromSlot()
+{
+    EventLoopThread thread;
+    thread.start();
+    ConnectionCloser obj;
+    obj.moveToThread(&thread);
+
+    QString service;
+    {
+        QDBusConnection closer = QDBusConnection::addConnection(QDBusConnection::SessionBus,
+                                                                "closer");
+        QVERIFY(closer.isConnected());
+        QVERIFY(closer.registerObject("/closer", &obj, QDBusConnection::ExportSlots));
+        service = closer.baseService();
+    }
+
+    // the slot drops the last reference to the connection delivering the call to it
+    QDBusMessage msg = QDBusMessage::methodCall(service, "/closer", "local.any", "close");
+    QVERIFY(QDBus::sessionBus().send(msg));
+    QTest::qWait(1000);
+    QVERIFY(obj.closed);
+
+    thread.quit();
+    QVERIFY(thread.wait(5000));
+}
+
+QString tst_QDBusConnection::introspect(const QDBusConnection &conn, const QString &path)
+{
+    QDBusMessage msg = QDBusMessage::methodCall(conn.baseService(), path,
+                                                "org.freedesktop.DBus.Introspectable",
+                                                "Introspect");
+    QDBusMessage reply = conn.sendWithReply(msg, QDBusConnection::UseEventLoop);
+    if (reply.type() != QDBusMessage::ReplyMessage || reply.count() != 1)
+        return QString();
+    return reply.at(0).toString();
+}
+
 QTEST_MAIN(tst_QDBusConnection)
 
 #include "tst_qdbusconnection.moc"
@@ -28,6 +28,7 @@
 #include <QtCore/qvariant.h>
 
 #include "common.h"
+#include "selftestinterface.h"       // generated from org.kde.selftest.xml
 
 Q_DECLARE_METATYPE(QVariantList)
 
@@ -80,8 +81,10 @@ class Spy: public QObject
 public:
     QString received;
     int count;
+    int readyCount;
+    QList<QDBusMessage> replies;
 
-    Spy() : count(0)
+    Spy() : count(0), readyCount(0)
     { }
 
 public slots:
@@ -90,6 +93,16 @@ public slots:
         received = arg;
         ++count;
     }
+
+    void readySlot()
+    {
+        ++readyCount;
+    }
+
+    void replySlot(const QDBusMessage &reply)
+    {
+        replies << reply;
+    }
 };
 
 // helper function
@@ -113,8 +126,13 @@ private slots:
     void call();
 
     void introspect();
+    void introspectAsync();
 
     void signal();
+
+    void propertyCache();
+    void signalBeforeReady();
+    void typedProxy();
 };
 
 void tst_QDBusInterface::initTestCase()
@@ -270,6 +288,36 @@ void tst_QDBusInterface::introspect()
     iface->deleteLater();
 }
 
+void tst_QDBusInterface::introspectAsync()
+{
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusInterface *iface = con.findInterfaceAsync(con.baseService(), QLatin1String("/"),
+                                                   TEST_INTERFACE_NAME);
+    QVERIFY(iface);
+    QVERIFY(!iface->isValid());
+
+    Spy spy;
+    spy.connect(iface, SIGNAL(interfaceReady()), SLOT(readySlot()));
+
+    // this one must wait for the introspection
+    QVERIFY(iface->callWithArgs("ping", &spy, SLOT(replySlot(QDBusMessage)),
+                                QVariantList() << 42));
+
+    QTest::qWait(1000);
+
+    QCOMPARE(spy.readyCount, 1);
+    QVERIFY(iface->isValid());
+
+    const QMetaObject *mo = iface->metaObject();
+    QCOMPARE(mo->methodCount() - mo->methodOffset(), 3);
+    QVERIFY(mo->indexOfSignal(TEST_SIGNAL_NAME "(QString)") != -1);
+
+    QCOMPARE(spy.replies.count(), 1);
+    QCOMPARE(spy.replies.at(0).type(), QDBusMessage::ReplyMessage);
+
+    iface->deleteLater();
+}
+
 void tst_QDBusInterface::signal()
 {
     QDBusConnection &con = QDBus::sessionBus();
@@ -289,6 +337,132 @@ void tst_QDBusInterface::signal()
     iface->deleteLater();
 }
 
+void tst_QDBusInterface::propertyCache()
+{
+    // property reads block, so they must go to another process
+    QProcess proc;
+    proc.start("./qpong");
+    QVERIFY(proc.waitForStarted());
+    QTest::qWait(2000);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusInterface *iface = con.findInterface("org.kde.selftest", "/org/kde/selftest",
+                                              "org.kde.selftest");
+    QVERIFY(iface->isValid());
+    QVERIFY(!iface->isPropertyCacheEnabled());
+
+    QCOMPARE(iface->call("setValue", QString("first")).type(), QDBusMessage::ReplyMessage);
+    QTest::qWait(200);
+
+    iface->setPropertyCacheEnabled(true);
+    iface->setPropertyChangeSignal("valueChanged");
+    QCOMPARE(iface->propertyChangeSignal(), QString("valueChanged"));
+
+    // first read goes to the remote object, the second one doesn't
+    QCOMPARE(iface->property("value").toString(), QString("first"));
+    QCOMPARE(iface->propertyCacheMisses(), 1);
+    QCOMPARE(iface->property("value").toString(), QString("first"));
+    QCOMPARE(iface->propertyCacheHits(), 1);
+
+    // the change signal drops the entry
+    iface->call("setValue", QString("second"));
+    QTest::qWait(200);
+    QCOMPARE(iface->property("value").toString(), QString("second"));
+    QCOMPARE(iface->propertyCacheMisses(), 2);
+
+    iface->invalidatePropertyCache();
+    QCOMPARE(iface->property("value").toString(), QString("second"));
+    QCOMPARE(iface->propertyCacheMisses(), 3);
+
+    // a bulk read fills the cache
+    iface->invalidatePropertyCache();
+    QCOMPARE(iface->allProperties().value("value").toString(), QString("second"));
+    QCOMPARE(iface->property("value").toString(), QString("second"));
+    QCOMPARE(iface->propertyCacheHits(), 2);
+    QCOMPARE(iface->propertyCacheMisses(), 3);
+
+    iface->setPropertyCacheEnabled(false);
+    QCOMPARE(iface->property("value").toString(), QString("second"));
+    QCOMPARE(iface->propertyCacheHits(), 2);
+    QCOMPARE(iface->propertyCacheMisses(), 3);
+
+    iface->deleteLater();
+    proc.close();
+    proc.kill();
+}
+
+void tst_QDBusInterface::signalBeforeReady()
+{
+    // property reads block, so they must go to another process
+    QProcess proc;
+    proc.start("./qpong");
+    QVERIFY(proc.waitForStarted());
+    QTest::qWait(2000);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    QDBusInterface *iface = con.findInterfaceAsync("org.kde.selftest", "/org/kde/selftest",
+                                                   "org.kde.selftest");
+    QVERIFY(!iface->isValid());
+
+    // connected under the well-known name, before the owner is known
+    iface->setPropertyCacheEnabled(true);
+    iface->setPropertyChangeSignal("valueChanged");
+
+    Spy spy;
+    spy.connect(iface, SIGNAL(interfaceReady()), SLOT(readySlot()));
+    QTest::qWait(1000);
+    QCOMPARE(spy.readyCount, 1);
+    QVERIFY(iface->isValid());
+
+    QCOMPARE(iface->call("setValue", QString("first")).type(), QDBusMessage::ReplyMessage);
+    QTest::qWait(200);
+    QCOMPARE(iface->property("value").toString(), QString("first"));
+    QCOMPARE(iface->propertyCacheMisses(), 1);
+
+    // the signal comes from the unique name and must still reach the interface
+    iface->call("setValue", QString("second"));
+    QTest::qWait(200);
+    QCOMPARE(iface->property("value").toString(), QString("second"));
+    QCOMPARE(iface->propertyCacheMisses(), 2);
+
+    iface->deleteLater();
+    proc.close();
+    proc.kill();
+}
+
+void tst_QDBusInterface::typedProxy()
+{
+    // the calls block, so they must go to another process
+    QProcess proc;
+    proc.start("./qpong");
+    QVERIFY(proc.waitForStarted());
+    QTest::qWait(2000);
+
+    QDBusConnection &con = QDBus::sessionBus();
+    OrgKdeSelftestInterface *iface =
+        con.findInterface<OrgKdeSelftestInterface>("org.kde.selftest", "/org/kde/selftest");
+    QVERIFY(iface);
+    QVERIFY(iface->isValid());
+
+    // qpong replies with the arguments it got
+    int number = 0;
+    QDBusReply<QString> reply = iface->ping(QString("Hello"), 42, number);
+    QVERIFY(reply.isSuccess());
+    QCOMPARE(reply.value(), QString("Hello"));
+    QCOMPARE(number, 42);
+    QVERIFY(!iface->lastError().isValid());
+
+    QVERIFY(iface->setValue(QString("typed")).isSuccess());
+    QDBusInterface *check = con.findInterface("org.kde.selftest", "/org/kde/selftest",
+                                              "org.kde.selftest");
+    QCOMPARE(check->property("value").toString(), QString("typed"));
+
+    check->deleteLater();
+    iface->deleteLater();
+    proc.close();
+    proc.kill();
+}
+
 QTEST_MAIN(tst_QDBusInterface)
 
 #include "tst_qdbusinterface.moc"
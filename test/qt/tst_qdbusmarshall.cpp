@@ -3,6 +3,7 @@
 #include <dbus/qdbus.h>
 
 #include "common.h"
+#include "../../qt/src/qdbustype_p.h"
 #include <limits>
 
 class tst_QDBusMarshall: public QObject
@@ -32,6 +33,9 @@ private slots:
     void sendStringMapOfMap_data();
     void sendStringMapOfMap();
 
+    void internedTypes_data();
+    void internedTypes();
+
 private:
     QProcess proc;
 };
@@ -117,6 +121,9 @@ void tst_QDBusMarshall::sendArrays_data()
     QTest::newRow("emptyboollist") << qVariantFromValue(bools) << "ab";
     bools << false << true << false;
     QTest::newRow("boollist") << qVariantFromValue(bools) << "ab";
+    for (int i = 0; i < 65536; ++i)
+        bools << (i % 3 == 0);
+    QTest::newRow("hugeboollist") << qVariantFromValue(bools) << "ab";
 
     QList<short> shorts;
     QTest::newRow("emptyshortlist") << qVariantFromValue(shorts) << "an";
@@ -132,6 +139,9 @@ void tst_QDBusMarshall::sendArrays_data()
     QTest::newRow("emptyintlist") << qVariantFromValue(ints) << "ai";
     ints << 42 << -43 << 44 << 45 << 2147483647 << -2147483647-1;
     QTest::newRow("intlist") << qVariantFromValue(ints) << "ai";
+    for (int i = 0; i < 65536; ++i)
+        ints << i * 3 - 100000;
+    QTest::newRow("hugeintlist") << qVariantFromValue(ints) << "ai";
 
     QList<uint> uints;
     QTest::newRow("emptyuintlist") << qVariantFromValue(uints) << "au";
@@ -157,6 +167,10 @@ void tst_QDBusMarshall::sendArrays_data()
             << std::numeric_limits<double>::infinity()
             << std::numeric_limits<double>::quiet_NaN();
     QTest::newRow("doublelist") << qVariantFromValue(doubles) << "ad";
+    doubles.clear();
+    for (int i = 0; i < 65536; ++i)
+        doubles << i / 7.0;
+    QTest::newRow("hugedoublelist") << qVariantFromValue(doubles) << "ad";
 
     QVariantList variants;
     QTest::newRow("emptyvariantlist") << QVariant(variants) << "av";
@@ -194,6 +208,11 @@ void tst_QDBusMarshall::sendStringMapOfMap_data()
     sendStringMap_data();
 }
 
+void tst_QDBusMarshall::internedTypes_data()
+{
+    sendStringMap_data();
+}
+
 void tst_QDBusMarshall::sendBasic()
 {
     QFETCH(QVariant, value);
@@ -337,6 +356,51 @@ void tst_QDBusMarshall::sendStringMapOfMap()
         QVERIFY(compare(reply.at(i), msg.at(i)));
 }
 
+void tst_QDBusMarshall::internedTypes()
+{
+    QFETCH(QVariant, value);
+    QFETCH(QString, sig);
+    QByteArray signature = sig.toLatin1();
+
+    // the same type parsed from the signature, which interns it (the second time returns the
+    // shared copy), read with a signature iterator and guessed from the value, which don't
+    QDBusType interned(signature.constData());
+    QDBusType shared(signature.constData());
+    DBusSignatureIter iter;
+    dbus_signature_iter_init(&iter, signature.constData());
+    QDBusType fromIter(&iter);
+    QDBusType guessed = QDBusType::guessFromVariant(value);
+
+    QVERIFY(shared == interned);
+    QVERIFY(fromIter == interned);
+    QVERIFY(interned == fromIter);
+    QVERIFY(guessed == interned);
+    QCOMPARE(fromIter.dbusSignature(), interned.dbusSignature());
+    QCOMPARE(fromIter.qvariantType(), interned.qvariantType());
+    QCOMPARE(fromIter.subTypes().count(), interned.subTypes().count());
+
+    QDBusConnection &con = QDBus::sessionBus();
+
+    QVERIFY(con.isConnected());
+
+    // marshalled with the guessed type, and with the interned one
+    QDBusMessage msg = QDBusMessage::methodCall("org.kde.selftest",
+            "/org/kde/selftest", "org.kde.selftest", "ping");
+    msg << value;
+    QDBusMessage reply = con.sendWithReply(msg);
+
+    QDBusMessage msg2 = QDBusMessage::methodCall("org.kde.selftest",
+            "/org/kde/selftest", "org.kde.selftest", "ping");
+    msg2.setSignature(sig);
+    msg2 << value;
+    QDBusMessage reply2 = con.sendWithReply(msg2);
+
+    QCOMPARE(reply.signature(), sig);
+    QCOMPARE(reply2.signature(), reply.signature());
+    QCOMPARE(reply2.count(), reply.count());
+    for (int i = 0; i < reply.count(); ++i)
+        QVERIFY(compare(reply2.at(i), reply.at(i)));
+}
 
 QTEST_MAIN(tst_QDBusMarshall)
 #include "tst_qdbusmarshall.moc"
@@ -0,0 +1,213 @@
+#include <qcoreapplication.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <QtTest/QtTest>
+
+#include <dbus/qdbus.h>
+#include "../../qt/src/qdbusmetaobject_p.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef QHash<QString, QDBusMetaObject *> MetaObjectHash;
+
+// the layout of the cache files, as written by qSaveMetaObject
+static const int CacheHeaderSize = 24;
+enum { ClassNameIndex = 1, MethodDataIndex = 5 };
+
+static const char interfaceName[] = "org.kde.selftest.Cached";
+
+static const char firstXml[] =
+    "<node><interface name=\"org.kde.selftest.Cached\">"
+    "<method name=\"echo\"><arg type=\"s\" direction=\"in\"/><arg type=\"s\" direction=\"out\"/></method>"
+    "<property name=\"value\" type=\"i\" access=\"readwrite\"/>"
+    "</interface></node>";
+
+static const char secondXml[] =
+    "<node><interface name=\"org.kde.selftest.Cached\">"
+    "<method name=\"echo\"><arg type=\"s\" direction=\"in\"/><arg type=\"s\" direction=\"out\"/></method>"
+    "<method name=\"ping\"/>"
+    "<property name=\"value\" type=\"i\" access=\"readwrite\"/>"
+    "</interface></node>";
+
+class tst_QDBusMetaObject: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+
+    void roundTrip();
+    void corruptFile_data();
+    void corruptFile();
+    void staleHash();
+
+private:
+    QDBusMetaObject *create(const char *xml, MetaObjectHash &cache);
+    QString cacheFile() const;
+
+    QString cacheDir;
+};
+
+void tst_QDBusMetaObject::initTestCase()
+{
+    // registers the metatypes used by the generated meta objects
+    QDBus::sessionBus();
+
+    cacheDir = QDir::tempPath() + QString("/tst_qdbusmetaobject.%1").arg(getpid());
+    QVERIFY(QDir().mkpath(cacheDir));
+    ::setenv("QDBUS_METAOBJECT_CACHE", QFile::encodeName(cacheDir), 1);
+}
+
+void tst_QDBusMetaObject::init()
+{
+    QDir dir(cacheDir);
+    foreach (const QString &file, dir.entryList(QDir::Files))
+        dir.remove(file);
+}
+
+void tst_QDBusMetaObject::cleanupTestCase()
+{
+    init();
+    QDir().rmdir(cacheDir);
+    ::unsetenv("QDBUS_METAOBJECT_CACHE");
+}
+
+QDBusMetaObject *tst_QDBusMetaObject::create(const char *xml, MetaObjectHash &cache)
+{
+    QDBusError error;
+    return QDBusMetaObject::createMetaObject(interfaceName, xml, cache, error);
+}
+
+QString tst_QDBusMetaObject::cacheFile() const
+{
+    return cacheDir + QLatin1Char('/') + interfaceName + QLatin1String(".qdbusmo");
+}
+
+void tst_QDBusMetaObject::roundTrip()
+{
+    MetaObjectHash parsed;
+    QDBusMetaObject *original = create(firstXml, parsed);
+    QVERIFY(original);
+    QVERIFY(QFile::exists(cacheFile()));
+
+    MetaObjectHash loaded;
+    QDBusMetaObject *copy = QDBusMetaObject::loadFromDiskCache(interfaceName, loaded);
+    QVERIFY(copy);
+    QVERIFY(loaded.value(interfaceName) == copy);
+
+    QCOMPARE(QByteArray(copy->className()), QByteArray(original->className()));
+    QCOMPARE(copy->methodCount(), original->methodCount());
+    QCOMPARE(copy->propertyCount(), original->propertyCount());
+
+    // the D-Bus data is indexed without the offset of the superclass
+    int idx = copy->indexOfMethod("echo(QString)");
+    QVERIFY(idx != -1);
+    QCOMPARE(idx, original->indexOfMethod("echo(QString)"));
+    idx -= copy->methodOffset();
+    QCOMPARE(QByteArray(copy->inputSignatureForMethod(idx)), QByteArray("s"));
+    QCOMPARE(QByteArray(copy->outputSignatureForMethod(idx)), QByteArray("s"));
+    QCOMPARE(copy->inputTypesForMethod(idx)[0], 1);
+    QCOMPARE(copy->inputTypesForMethod(idx)[1], int(QVariant::String));
+
+    idx = copy->indexOfProperty("value");
+    QVERIFY(idx != -1);
+    idx -= copy->propertyOffset();
+    QCOMPARE(copy->propertyMetaType(idx), original->propertyMetaType(idx));
+
+    // parsing the same document again takes it from the cache
+    MetaObjectHash indexed;
+    QDBusMetaObject *fromIndex = create(firstXml, indexed);
+    QVERIFY(fromIndex);
+    QCOMPARE(fromIndex->methodCount(), original->methodCount());
+
+    qDeleteAll(parsed);
+    qDeleteAll(loaded);
+    qDeleteAll(indexed);
+}
+
+void tst_QDBusMetaObject::corruptFile_data()
+{
+    QTest::addColumn<int>("offset");        // -1 truncates the file instead
+    QTest::addColumn<uint>("value");
+
+    QTest::newRow("truncated") << -1 << 0u;
+    QTest::newRow("magic") << 0 << 0u;
+    QTest::newRow("class-name") << CacheHeaderSize + ClassNameIndex * 4 << 0x10000u;
+    QTest::newRow("method-data") << CacheHeaderSize + MethodDataIndex * 4 << 0x10000u;
+    QTest::newRow("negative-method-data") << CacheHeaderSize + MethodDataIndex * 4 << 0xffffff00u;
+}
+
+void tst_QDBusMetaObject::corruptFile()
+{
+    QFETCH(int, offset);
+    QFETCH(uint, value);
+
+    MetaObjectHash parsed;
+    QVERIFY(create(firstXml, parsed));
+
+    QFile file(cacheFile());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray contents = file.readAll();
+    file.close();
+
+    if (offset == -1)
+        contents.chop(1);
+    else
+        memcpy(contents.data() + offset, &value, sizeof value);
+
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(contents);
+    file.close();
+
+    // the file is rejected and removed
+    MetaObjectHash loaded;
+    QVERIFY(!QDBusMetaObject::loadFromDiskCache(interfaceName, loaded));
+    QVERIFY(loaded.isEmpty());
+    QVERIFY(!QFile::exists(cacheFile()));
+
+    // and the document is parsed again
+    MetaObjectHash reparsed;
+    QDBusMetaObject *obj = create(firstXml, reparsed);
+    QVERIFY(obj);
+    QVERIFY(obj->indexOfMethod("echo(QString)") != -1);
+    QVERIFY(QFile::exists(cacheFile()));
+
+    qDeleteAll(parsed);
+    qDeleteAll(reparsed);
+}
+
+void tst_QDBusMetaObject::staleHash()
+{
+    MetaObjectHash first;
+    QVERIFY(create(firstXml, first));
+
+    // a newer description of the interface replaces the file
+    MetaObjectHash second;
+    QDBusMetaObject *obj = create(secondXml, second);
+    QVERIFY(obj);
+    QVERIFY(obj->indexOfMethod("ping()") != -1);
+
+    MetaObjectHash loaded;
+    obj = QDBusMetaObject::loadFromDiskCache(interfaceName, loaded);
+    QVERIFY(obj);
+    QVERIFY(obj->indexOfMethod("ping()") != -1);
+
+    // the index of the first document must not hand out the newer file
+    MetaObjectHash again;
+    obj = create(firstXml, again);
+    QVERIFY(obj);
+    QCOMPARE(obj->indexOfMethod("ping()"), -1);
+    QVERIFY(obj->indexOfMethod("echo(QString)") != -1);
+
+    qDeleteAll(first);
+    qDeleteAll(second);
+    qDeleteAll(loaded);
+    qDeleteAll(again);
+}
+
+QTEST_MAIN(tst_QDBusMetaObject)
+
+#include "tst_qdbusmetaobject.moc"
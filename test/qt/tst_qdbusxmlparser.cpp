@@ -51,6 +51,13 @@ private slots:
     void signals_();
     void properties_data();
     void properties();
+
+    void largeDocument_data();
+    void largeDocument();
+
+    void childrenOfRoot_data();
+    void childrenOfRoot();
+    void nestedNodes();
 };
 
 void tst_QDBusXmlParser::parsing_data()
@@ -573,6 +580,106 @@ void tst_QDBusXmlParser::properties()
     QCOMPARE(propertyMap, parsedMap);
 }
 
+void tst_QDBusXmlParser::largeDocument_data()
+{
+    QTest::addColumn<int>("interfaceCount");
+    QTest::addColumn<int>("memberCount");
+    QTest::addColumn<int>("objectCount");
+
+    QTest::newRow("many-members") << 1 << 2000 << 0;
+    QTest::newRow("many-interfaces") << 200 << 10 << 0;
+    QTest::newRow("many-objects") << 1 << 10 << 2000;
+    QTest::newRow("everything") << 50 << 50 << 500;
+}
+
+void tst_QDBusXmlParser::largeDocument()
+{
+    QFETCH(int, interfaceCount);
+    QFETCH(int, memberCount);
+    QFETCH(int, objectCount);
+
+    QString xmlData = largeIntrospectionDocument(interfaceCount, memberCount, objectCount);
+    QDBusIntrospection::ObjectTree tree =
+        QDBusIntrospection::parseObjectTree(xmlData, "local.testing", "/");
+
+    QCOMPARE(tree.interfaces.count(), interfaceCount);
+    QCOMPARE(tree.childObjects.count(), objectCount);
+    QCOMPARE(tree.childObjectData.count(), objectCount);
+    foreach (QSharedDataPointer<QDBusIntrospection::Interface> iface, tree.interfaceData) {
+        QCOMPARE(iface->methods.count(), memberCount);
+        QCOMPARE(iface->signals_.count(), memberCount);
+        QCOMPARE(iface->properties.count(), memberCount);
+    }
+    if (objectCount) {
+        const QSharedDataPointer<QDBusIntrospection::ObjectTree> &obj =
+            tree.childObjectData.value("obj1");
+        QVERIFY(obj != 0);
+        QCOMPARE(obj->path, QString("/obj1"));
+        QCOMPARE(obj->interfaces, QStringList("iface.iface1"));
+        QCOMPARE(obj->interfaceData.value("iface.iface1")->methods.count(), 1);
+    }
+}
+
+void tst_QDBusXmlParser::childrenOfRoot_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QString>("childPath");
+
+    QTest::newRow("root") << "/" << "/obj1";
+    QTest::newRow("deeper") << "/p1" << "/p1/obj1";
+}
+
+void tst_QDBusXmlParser::childrenOfRoot()
+{
+    QFETCH(QString, path);
+    QFETCH(QString, childPath);
+
+    // the sub-objects of "/" used to be dropped by object(), because it checked "//obj1"
+    // sub-nodes without contents are not kept in the object tree
+    QString xmlData = "<node><interface name=\"iface.iface1\"/>"
+                      "<node name=\"obj1\"><interface name=\"iface.iface2\"/></node></node>";
+
+    QDBusIntrospection::Object obj =
+        QDBusIntrospection::parseObject(xmlData, "local.testing", path);
+    QCOMPARE(obj.childObjects, QStringList("obj1"));
+    QCOMPARE(obj.interfaces, QStringList("iface.iface1"));
+
+    QDBusIntrospection::ObjectTree tree =
+        QDBusIntrospection::parseObjectTree(xmlData, "local.testing", path);
+    QCOMPARE(tree.childObjects, QStringList("obj1"));
+    QVERIFY(tree.childObjectData.value("obj1") != 0);
+    QCOMPARE(tree.childObjectData.value("obj1")->path, childPath);
+}
+
+void tst_QDBusXmlParser::nestedNodes()
+{
+    // the elements of a sub-object belong to it alone; with QDom, elementsByTagName() also
+    // returned the interfaces and nodes of every descendant
+    QString xmlData = "<node><interface name=\"iface.iface1\"/>"
+                      "<node name=\"obj1\"><interface name=\"iface.iface2\"/>"
+                      "<node name=\"obj2\"><interface name=\"iface.iface3\"/></node>"
+                      "</node></node>";
+
+    QDBusIntrospection::Interfaces interfaces = QDBusIntrospection::parseInterfaces(xmlData);
+    QCOMPARE(interfaces.count(), 1);
+    QVERIFY(interfaces.contains("iface.iface1"));
+
+    QDBusIntrospection::Object obj =
+        QDBusIntrospection::parseObject(xmlData, "local.testing", "/");
+    QCOMPARE(obj.interfaces, QStringList("iface.iface1"));
+    QCOMPARE(obj.childObjects, QStringList("obj1"));
+
+    QDBusIntrospection::ObjectTree tree =
+        QDBusIntrospection::parseObjectTree(xmlData, "local.testing", "/");
+    QCOMPARE(tree.interfaces, QStringList("iface.iface1"));
+    QCOMPARE(tree.childObjects, QStringList("obj1"));
+
+    QVERIFY(tree.childObjectData.contains("obj1"));
+    QDBusIntrospection::ObjectTree child = *tree.childObjectData.value("obj1");
+    QCOMPARE(child.interfaces, QStringList("iface.iface2"));
+    QCOMPARE(child.childObjects, QStringList("obj2"));
+}
+
 QTEST_MAIN(tst_QDBusXmlParser)
 
 #include "tst_qdbusxmlparser.moc"
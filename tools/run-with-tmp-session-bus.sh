@@ -29,7 +29,8 @@ echo "escaped service dir is: $ESCAPED_SERVICE_DIR" >&2
 ## create a configuration file based on the standard session.conf
 cat $DBUS_TOP_BUILDDIR/bus/session.conf |  \
     sed -e 's/<servicedir>.*$/<servicedir>'$ESCAPED_SERVICE_DIR'<\/servicedir>/g' |  \
-    sed -e 's/<include.*$//g'                \
+    sed -e 's/<include.*$//g' |              \
+    sed -e 's/<\/busconfig>/<limit name="max_names_per_connection">2048<\/limit><\/busconfig>/g' \
   > $CONFIG_FILE
 
 echo "Created configuration file $CONFIG_FILE" >&2